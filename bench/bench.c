@@ -0,0 +1,384 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* Benchmark suite: times expansion over procedurally generated masks, image
+ * sizes, radii, and thread counts, and mask generation over triangle counts.
+ * Results are written as JSON.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+#include <imago2.h>
+#include "uvscene.h"
+#include "expand.h"
+#include "pullpush.h"
+#include "bitmask.h"
+#include "genmask.h"
+#include "batch.h"
+
+#define REPEAT	3
+
+/* in the order of the ALG_* enum of batch.h */
+static const char *alg_names[] = {"edt", "search", "pullpush"};
+#define NUM_ALGS	(int)(sizeof alg_names / sizeof *alg_names)
+
+enum { MASK_ISLANDS, MASK_ATLAS, MASK_PIXEL, MASK_SLIVERS, NUM_MASKS };
+static const char *mask_names[] = {"islands", "atlas", "pixel", "slivers"};
+
+static void gen_islands(unsigned char *pixels, int width, int height);
+static void gen_atlas(unsigned char *pixels, int width, int height);
+static void gen_pixel(unsigned char *pixels, int width, int height);
+static void gen_slivers(unsigned char *pixels, int width, int height);
+static double time_expand(int alg, struct img_pixmap *tex, struct img_pixmap *mask, int radius);
+static int bench_genmask(FILE *fp, int size);
+static double get_time(void);
+static int parse_args(int argc, char **argv);
+
+static void (*mask_func[])(unsigned char*, int, int) = {
+	gen_islands, gen_atlas, gen_pixel, gen_slivers
+};
+
+static const int sizes[] = {512, 1024, 2048};
+static const int quick_sizes[] = {256, 512};
+static const int radii[] = {8, 64, -1};
+static const int tri_counts[] = {1000, 10000, 100000, 1000000};
+
+static const char *opt_out_fname;
+static int opt_quick;
+static int opt_nogl;
+
+int main(int argc, char **argv)
+{
+	int i, j, k, a, t, num_sizes, max_threads, first = 1;
+	const int *sizelist;
+	FILE *fp = stdout;
+	struct img_pixmap tex, mask;
+
+	if(parse_args(argc, argv) == -1) {
+		return 1;
+	}
+	if(opt_out_fname && !(fp = fopen(opt_out_fname, "w"))) {
+		fprintf(stderr, "failed to open output file: %s\n", opt_out_fname);
+		return 1;
+	}
+
+	sizelist = opt_quick ? quick_sizes : sizes;
+	num_sizes = opt_quick ? sizeof quick_sizes / sizeof *quick_sizes : sizeof sizes / sizeof *sizes;
+	max_threads = omp_get_max_threads();
+
+	fprintf(fp, "{\n\t\"max_threads\": %d,\n\t\"repeat\": %d,\n", max_threads, REPEAT);
+	fprintf(fp, "\t\"expand\": [");
+
+	img_init(&tex);
+	img_init(&mask);
+
+	for(i=0; i<num_sizes; i++) {
+		int size = sizelist[i];
+
+		if(img_set_pixels(&tex, size, size, IMG_FMT_RGBA32, 0) == -1 ||
+				img_set_pixels(&mask, size, size, IMG_FMT_GREY8, 0) == -1) {
+			fprintf(stderr, "failed to allocate %dx%d images\n", size, size);
+			return 1;
+		}
+		srand(size);
+		for(j=0; j<size * size * 4; j++) {
+			((unsigned char*)tex.pixels)[j] = rand();
+		}
+
+		for(j=0; j<NUM_MASKS; j++) {
+			memset(mask.pixels, 0, size * size);
+			mask_func[j](mask.pixels, size, size);
+
+			for(a=0; a<NUM_ALGS; a++) {
+				for(k=0; k<(int)(sizeof radii / sizeof *radii); k++) {
+					double t1 = 0.0;
+
+					/* pull-push always fills everything, radius is irrelevant */
+					if(a == ALG_PULLPUSH && radii[k] > 0) continue;
+
+					for(t=1; ; t = t * 2 < max_threads ? t * 2 : max_threads) {
+						double sec, mpix;
+
+						omp_set_num_threads(t);
+						if((sec = time_expand(a, &tex, &mask, radii[k])) < 0.0) {
+							return 1;
+						}
+						if(t == 1) t1 = sec;
+						mpix = (double)size * size / sec * 1e-6;
+
+						fprintf(stderr, "expand %s %s %dx%d radius %d, %d threads: %.4f sec (%.2f Mpix/s)\n",
+								alg_names[a], mask_names[j], size, size, radii[k], t, sec, mpix);
+
+						fprintf(fp, "%s\n\t\t{\"alg\": \"%s\", \"mask\": \"%s\", \"size\": %d, \"radius\": %d, "
+								"\"threads\": %d, \"seconds\": %.6f, \"mpix_per_sec\": %.3f, \"efficiency\": %.3f}",
+								first ? "" : ",", alg_names[a], mask_names[j], size, radii[k], t, sec,
+								mpix, t1 / (sec * t));
+						first = 0;
+
+						if(t == max_threads) break;
+					}
+				}
+			}
+		}
+	}
+	omp_set_num_threads(max_threads);
+
+	img_destroy(&tex);
+	img_destroy(&mask);
+
+	fprintf(fp, "\n\t],\n\t\"gen_mask\": [");
+	if(!opt_nogl && bench_genmask(fp, opt_quick ? 512 : 1024) == -1) {
+		fprintf(stderr, "mask generation benchmark failed, skipping\n");
+	}
+	fprintf(fp, "\n\t]\n}\n");
+
+	if(fp != stdout) {
+		fclose(fp);
+	}
+	return 0;
+}
+
+/* best of REPEAT runs. The texture is expanded into a copy, so that every run
+ * starts from the same input
+ */
+static double time_expand(int alg, struct img_pixmap *tex, struct img_pixmap *mask, int radius)
+{
+	int i, res = 0;
+	double start, dt, best = 0.0;
+	struct img_pixmap out;
+	struct bitmask bmask;
+
+	img_init(&out);
+	for(i=0; i<REPEAT; i++) {
+		if(img_copy(&out, tex) == -1) {
+			fprintf(stderr, "failed to copy texture\n");
+			return -1.0;
+		}
+
+		start = get_time();
+		switch(alg) {
+		case ALG_EDT:
+			res = expand(&out, radius, tex, mask);
+			break;
+		case ALG_SEARCH:
+			res = expand_search(&out, radius, tex, mask);
+			break;
+		case ALG_PULLPUSH:
+			if((res = bitmask_from_img(&bmask, mask, EXPAND_MASK_THRES)) != -1) {
+				res = expand_pullpush(&out, &bmask);
+				bitmask_destroy(&bmask);
+			}
+			break;
+		}
+		dt = get_time() - start;
+
+		if(res == -1) {
+			img_destroy(&out);
+			return -1.0;
+		}
+		if(i == 0 || dt < best) best = dt;
+	}
+	img_destroy(&out);
+	return best;
+}
+
+/* Mask generation throughput, for meshes of random small triangles scattered
+ * over UV space. The scene is built directly in memory, so the timings don't
+ * include any file import.
+ */
+static int bench_genmask(FILE *fp, int size)
+{
+	int i, j, res = -1;
+	struct uvscene scn;
+	struct uvmesh mesh;
+	struct uvmaterial mtl;
+	struct img_pixmap mask;
+
+	if(begin_gen_mask(size, size) == -1) {
+		return -1;
+	}
+	img_init(&mask);
+
+	for(i=0; i<(int)(sizeof tri_counts / sizeof *tri_counts); i++) {
+		int num_tri = tri_counts[i];
+		float *uv;
+		double start, dt, best = 0.0;
+
+		memset(&scn, 0, sizeof scn);
+		memset(&mesh, 0, sizeof mesh);
+		memset(&mtl, 0, sizeof mtl);
+
+		if(!(uv = malloc(num_tri * 6 * sizeof *uv))) {
+			fprintf(stderr, "failed to allocate %d triangles\n", num_tri);
+			goto end;
+		}
+
+		srand(num_tri);
+		for(j=0; j<num_tri; j++) {
+			float x = (float)rand() / RAND_MAX;
+			float y = (float)rand() / RAND_MAX;
+			float tsz = 0.02f;
+			int k;
+
+			for(k=0; k<3; k++) {
+				uv[j * 6 + k * 2] = x + (float)rand() / RAND_MAX * tsz;
+				uv[j * 6 + k * 2 + 1] = y + (float)rand() / RAND_MAX * tsz;
+			}
+		}
+
+		mesh.name = "bench";
+		mesh.num_tri = num_tri;
+		mesh.uv[0] = uv;
+		scn.num_meshes = 1;
+		scn.meshes = &mesh;
+		scn.num_mtl = 1;
+		scn.mtl = &mtl;
+
+		for(j=0; j<REPEAT; j++) {
+			start = get_time();
+			if(gen_mask(&mask, size, size, &scn, 0, 0) == -1) {
+				free(uv);
+				goto end;
+			}
+			dt = get_time() - start;
+			if(j == 0 || dt < best) best = dt;
+		}
+
+		fprintf(stderr, "gen_mask %d triangles %dx%d: %.4f sec (%.2f Mtri/s)\n", num_tri,
+				size, size, best, num_tri / best * 1e-6);
+		fprintf(fp, "%s\n\t\t{\"triangles\": %d, \"size\": %d, \"seconds\": %.6f, \"mtri_per_sec\": %.3f}",
+				i ? "," : "", num_tri, size, best, num_tri / best * 1e-6);
+
+		free(uv);
+	}
+	res = 0;
+
+end:
+	img_destroy(&mask);
+	end_gen_mask();
+	return res;
+}
+
+/* scattered rectangular and round charts, covering roughly half the texture,
+ * with wide empty gutters between them
+ */
+static void gen_islands(unsigned char *pixels, int width, int height)
+{
+	int i, x, y, num = 24;
+
+	srand(1);
+	for(i=0; i<num; i++) {
+		int cx = rand() % width;
+		int cy = rand() % height;
+		int rad = width / 16 + rand() % (width / 8);
+		int round = rand() & 1;
+
+		for(y=cy-rad; y<=cy+rad; y++) {
+			if(y < 0 || y >= height) continue;
+			for(x=cx-rad; x<=cx+rad; x++) {
+				if(x < 0 || x >= width) continue;
+				if(round && (x - cx) * (x - cx) + (y - cy) * (y - cy) > rad * rad) continue;
+				pixels[y * width + x] = 0xff;
+			}
+		}
+	}
+}
+
+/* tightly packed grid of charts, with 2 texel gutters */
+static void gen_atlas(unsigned char *pixels, int width, int height)
+{
+	int x, y, cell = width / 32 > 4 ? width / 32 : 4;
+
+	for(y=0; y<height; y++) {
+		for(x=0; x<width; x++) {
+			if(x % cell >= 2 && y % cell >= 2) {
+				pixels[y * width + x] = 0xff;
+			}
+		}
+	}
+}
+
+/* a single used texel in a corner: every other texel is far from it */
+static void gen_pixel(unsigned char *pixels, int width, int height)
+{
+	pixels[0] = 0xff;
+}
+
+/* thin diagonal UV slivers, 1-2 texels wide */
+static void gen_slivers(unsigned char *pixels, int width, int height)
+{
+	int i, j, num = 32;
+
+	for(i=0; i<num; i++) {
+		int x0 = i * width / num;
+		for(j=0; j<height; j++) {
+			int x = (x0 + j / 2) % width;
+			pixels[j * width + x] = 0xff;
+			if(i & 1) pixels[j * width + (x + 1) % width] = 0xff;
+		}
+	}
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_usage(const char *progname, FILE *fp)
+{
+	fprintf(fp, "Usage: %s [options]\n", progname);
+	fprintf(fp, "Options:\n");
+	fprintf(fp, "   -o <fname>: write the JSON results to a file, instead of stdout\n");
+	fprintf(fp, "   -quick: smaller image sizes, for a fast sanity check\n");
+	fprintf(fp, "   -nogl: skip the mask generation benchmark\n");
+	fprintf(fp, "   -help, -h: print usage information and exit\n");
+}
+
+static int parse_args(int argc, char **argv)
+{
+	int i;
+
+	for(i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-o") == 0) {
+			if(!argv[++i]) {
+				fprintf(stderr, "-o must be followed by the output filename\n");
+				return -1;
+			}
+			opt_out_fname = argv[i];
+
+		} else if(strcmp(argv[i], "-quick") == 0) {
+			opt_quick = 1;
+
+		} else if(strcmp(argv[i], "-nogl") == 0) {
+			opt_nogl = 1;
+
+		} else if(strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
+			print_usage(argv[0], stdout);
+			exit(0);
+
+		} else {
+			fprintf(stderr, "invalid option: %s\n\n", argv[i]);
+			print_usage(argv[0], stderr);
+			return -1;
+		}
+	}
+	return 0;
+}
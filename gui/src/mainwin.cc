@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <thread>
@@ -25,15 +26,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QThread>
+#include <QGraphicsPixmapItem>
 #include "mainwin.h"
 #include "ui_mainwin.h"
 #include "genmask.h"
 #include "expand.h"
+#include "pullpush.h"
+#include "bitmask.h"
+#include "preview.h"
 
 #define IMAGES_SUFFIX_FILTER "Images (*.png *.jpg *.jpeg *.tga *.ppm)"
 #define IMAGE_VALID(img) (img && img->pixels && img->width > 0 && img->height > 0)
 
+// textures larger than this are first expanded at 1/8, 1/4 and 1/2 scale, and
+// each of these previews is shown while the next, finer pass is running
+#define PREVIEW_MIN_TEXELS	(1024 * 1024)
+#define PREVIEW_MAX_SCALE	8
+#define PREVIEW_MIN_SIZE	32
+#define MAX_PREVIEWS		3
+
+// the output view is a column of pixmaps this many rows tall, and the full
+// resolution pass hands each one over as soon as its rows are expanded
+#define VIEW_TILE_ROWS		256
+
 static bool update_image_widget(QGraphicsView *gview, struct img_pixmap *img);
+static QImage image_rows(struct img_pixmap *img, int y, int count);
+static void fit_view(QGraphicsView *gview);
 
 #if defined(__unix__) || defined(__APPLE__)
 static int pfd[2];
@@ -46,6 +64,9 @@ MainWin::MainWin(QWidget *parent)
 	ui->setupUi(this);
 
 	scn = 0;
+	mask_gen = 0;
+	reexpand_pending = false;
+	out_preview = 0;
 	in_tex = img_create();
 	out_tex = img_create();
 	mask = img_create();
@@ -72,6 +93,8 @@ MainWin::MainWin(QWidget *parent)
 #endif
 
 	connect(this, &MainWin::sig_expand_progress, this, &MainWin::expand_progress);
+	connect(this, &MainWin::sig_expand_preview, this, &MainWin::expand_preview);
+	connect(this, &MainWin::sig_expand_rows, this, &MainWin::expand_rows);
 	connect(this, &MainWin::sig_expand_done, this, &MainWin::expand_done);
 }
 
@@ -88,6 +111,7 @@ MainWin::~MainWin()
 	if(in_tex) img_free(in_tex);
 	if(out_tex) img_free(out_tex);
 	if(mask) img_free(mask);
+	free(expand_data.nearest);
 }
 
 // --- slots ---
@@ -103,7 +127,7 @@ void MainWin::socket_readable(int s)
 
 void MainWin::on_bn_selmesh_clicked()
 {
-	aiScene *new_scn;
+	uvscene *new_scn;
 
 	QString fname = QFileDialog::getOpenFileName(this, "Open mesh/scene file");
 	if(!fname.isEmpty()) {
@@ -131,6 +155,7 @@ void MainWin::on_bn_gen_mask_clicked()
 		assert(mask);
 	}
 	int uvset = ui->spin_uvset->value();
+	mask_gen++;
 	if(gen_mask(mask, in_tex->width, in_tex->height, scn, uvset, 0) == -1) {	// TODO filter
 		QMessageBox::critical(this, "Mask generation error", "Failed to generate mask. See output log for details.");
 		return;
@@ -148,7 +173,7 @@ void MainWin::on_bn_seltex_clicked()
 	QString fname = QFileDialog::getOpenFileName(this, "Open input texture", QString(), IMAGES_SUFFIX_FILTER);
 	if(!fname.isEmpty()) {
 		const char *cfname = fname.toUtf8().data();
-		if(img_load(in_tex, cfname) == -1 || img_convert(in_tex, IMG_FMT_RGBAF) == -1) {
+		if(img_load(in_tex, cfname) == -1) {
 			fprintf(stderr, "Failed to load image: %s\n", cfname);
 			QMessageBox::critical(this, "Image loading error", "Failed to load image: " + fname);
 			return;
@@ -157,9 +182,10 @@ void MainWin::on_bn_seltex_clicked()
 		update_image_widget(ui->gview_input, in_tex);
 
 		if(IMAGE_VALID(mask)) {
-			if(mask->width != in_tex->width && mask->height != in_tex->height) {
+			if(mask->width != in_tex->width || mask->height != in_tex->height) {
 				img_destroy(mask);
 				img_init(mask);
+				mask_gen++;
 				update_image_widget(ui->gview_mask, mask);
 			}
 		}
@@ -174,6 +200,7 @@ void MainWin::on_bn_selmask_clicked()
 	QString fname = QFileDialog::getOpenFileName(this, "Open mask image", QString(), IMAGES_SUFFIX_FILTER);
 	if(!fname.isEmpty()) {
 		const char *cfname = fname.toUtf8().data();
+		mask_gen++;
 		if(img_load(mask, cfname) == -1 || img_convert(mask, IMG_FMT_GREY8) == -1) {
 			fprintf(stderr, "Failed to load mask: %s\n", cfname);
 			QMessageBox::critical(this, "Image loading error", "Failed to load mask: " + fname);
@@ -181,7 +208,7 @@ void MainWin::on_bn_selmask_clicked()
 		}
 
 		if(IMAGE_VALID(in_tex)) {
-			if(mask->width != in_tex->width && mask->height != in_tex->height) {
+			if(mask->width != in_tex->width || mask->height != in_tex->height) {
 				char buf[128];
 				sprintf(buf, "Selected mask file's dimensions (%dx%d) differ from input texture (%dx%d)\n",
 						mask->width, mask->height, in_tex->width, in_tex->height);
@@ -232,28 +259,174 @@ void MainWin::on_bn_save_exp_clicked()
 	}
 }
 
+enum { ALG_NEAREST, ALG_PULLPUSH };	// order of the algorithm combo box entries
+
 struct ExpandData {
 	img_pixmap *input, *output, *mask;
+	img_pixmap *preview[MAX_PREVIEWS];	// handed over to expand_preview
+	int preview_scale[MAX_PREVIEWS];
 	int radius;
+	int alg;
+	float prog_start, prog_len;	// progress bar range of the current pass
+	int mask_gen;
+	// nearest texel map of the mask (of generation nearest_gen, and its
+	// dimensions) for unlimited radius, kept across expansions for instant
+	// radius changes
+	int *nearest;
+	int nearest_gen;
+	int nearest_width, nearest_height;
 	MainWin *win;
-	bool cancel;
+	volatile int cancel;
 } expand_data;
 
-#define BLOCKSZ	32
+// the cached nearest texel map applies to the mask of generation gen, if it
+// was computed from it, and all of them match the dimensions of the texture
+static bool nearest_valid(int gen, const img_pixmap *in, const img_pixmap *mask)
+{
+	return expand_data.nearest && expand_data.nearest_gen == gen &&
+		expand_data.nearest_width == in->width && expand_data.nearest_height == in->height &&
+		mask->width == in->width && mask->height == in->height;
+}
+
+static void progress_func(float done, void *cls)
+{
+	emit expand_data.win->sig_expand_progress(expand_data.prog_start + done * expand_data.prog_len);
+}
+
+// gather the nearest texels within radius, with the cached nearest texel map,
+// and pass every VIEW_TILE_ROWS rows to the GUI thread as soon as they're done
+static int gather_rows(img_pixmap *out, img_pixmap *in, int radius)
+{
+	int y;
+
+	for(y=0; y<out->height; y+=VIEW_TILE_ROWS) {
+		int count = out->height - y < VIEW_TILE_ROWS ? out->height - y : VIEW_TILE_ROWS;
+		if(expand_data.cancel || expand_nearest_limit(out, y, count, radius, in, expand_data.nearest) == -1) {
+			return -1;
+		}
+		emit expand_data.win->sig_expand_rows(y, count);
+	}
+	return 0;
+}
+
+// full is set for the full resolution pass, which shows its output rows as
+// they're done, and keeps the nearest texel map
+static int expand_pass(img_pixmap *out, img_pixmap *in, const struct bitmask *bmask,
+		int radius, struct expand_progress *prog, bool full)
+{
+	int y, res = -1;
+
+	if(expand_data.alg == ALG_PULLPUSH) {
+		// output is a copy of the input, so pull-push can fill it in place,
+		// but its last pass fills the whole image at once
+		if((res = expand_pullpush(out, bmask)) != -1 && full) {
+			for(y=0; y<out->height; y+=VIEW_TILE_ROWS) {
+				int count = out->height - y < VIEW_TILE_ROWS ? out->height - y : VIEW_TILE_ROWS;
+				emit expand_data.win->sig_expand_rows(y, count);
+			}
+		}
+		return res;
+	}
+
+	if(full) {
+		free(expand_data.nearest);
+		expand_data.nearest = (int*)malloc(bmask->width * bmask->height * sizeof *expand_data.nearest);
+		if(!expand_data.nearest || calc_nearest_progress(expand_data.nearest, 0, bmask, prog) == -1) {
+			free(expand_data.nearest);
+			expand_data.nearest = 0;
+			return -1;
+		}
+		expand_data.nearest_gen = expand_data.mask_gen;
+		expand_data.nearest_width = bmask->width;
+		expand_data.nearest_height = bmask->height;
+		return gather_rows(out, in, radius);
+	}
+
+	int *nearest = (int*)malloc(bmask->width * bmask->height * sizeof *nearest);
+	if(nearest && calc_nearest_progress(nearest, radius, bmask, prog) != -1) {
+		res = expand_nearest(out, in, nearest);
+	}
+	free(nearest);
+	return res;
+}
+
+// expand a downsampled copy of the input, and pass it to the GUI thread
+static int preview_pass(int idx, int scale, const struct bitmask *bmask, struct expand_progress *prog)
+{
+	img_pixmap *in, *out;
+	struct bitmask pmask;
+	int res = -1;
+
+	in = img_create();
+	out = img_create();
+	if(!in || !out || preview_downsample(in, &pmask, expand_data.input, bmask, scale) == -1) {
+		if(in) img_free(in);
+		if(out) img_free(out);
+		return -1;
+	}
+
+	if(img_copy(out, in) != -1 &&
+			expand_pass(out, in, &pmask, preview_radius(expand_data.radius, scale), prog, false) != -1 &&
+			!expand_data.cancel) {
+		expand_data.preview[idx] = out;
+		expand_data.preview_scale[idx] = scale;
+		emit expand_data.win->sig_expand_preview(idx);
+		out = 0;
+		res = 0;
+	}
+	bitmask_destroy(&pmask);
+	img_free(in);
+	if(out) img_free(out);
+	return res;
+}
 
 static void thread_func()
 {
-	int height = expand_data.input->height;
-	int idx = 0;
-	while(idx < height) {
-		if(expand_data.cancel) {
-			break;
+	int i, scale, num_previews = 0;
+	int scales[MAX_PREVIEWS];
+	float total = 1.0f;
+	struct bitmask bmask;
+	struct expand_progress prog;
+	img_pixmap *in = expand_data.input;
+
+	prog.func = progress_func;
+	prog.cls = 0;
+	prog.cancel = &expand_data.cancel;
+
+	expand_data.prog_start = 0.0f;
+	expand_data.prog_len = 1.0f;
+	emit expand_data.win->sig_expand_progress(0.0f);
+
+	if(expand_data.alg != ALG_PULLPUSH && nearest_valid(expand_data.mask_gen, in, expand_data.mask)) {
+		// same mask as last time, only the radius threshold has to be redone
+		gather_rows(expand_data.output, expand_data.input, expand_data.radius);
+	} else if(bitmask_from_img(&bmask, expand_data.mask, EXPAND_MASK_THRES) != -1) {
+		// coarsest preview first; the progress bar is split in proportion to
+		// the number of texels of each pass
+		if((long)in->width * in->height > PREVIEW_MIN_TEXELS) {
+			for(scale=PREVIEW_MAX_SCALE; scale>1; scale>>=1) {
+				if(in->width / scale < PREVIEW_MIN_SIZE || in->height / scale < PREVIEW_MIN_SIZE) {
+					continue;
+				}
+				scales[num_previews++] = scale;
+				total += 1.0f / (scale * scale);
+			}
+		}
+
+		for(i=0; i<num_previews && !expand_data.cancel; i++) {
+			expand_data.prog_len = 1.0f / (scales[i] * scales[i]) / total;
+			if(preview_pass(i, scales[i], &bmask, &prog) == -1) {
+				break;
+			}
+			expand_data.prog_start += expand_data.prog_len;
+		}
+
+		if(!expand_data.cancel) {
+			expand_data.prog_start = 1.0f - 1.0f / total;
+			expand_data.prog_len = 1.0f / total;
+			expand_pass(expand_data.output, expand_data.input, &bmask, expand_data.radius, &prog, true);
 		}
-		emit expand_data.win->sig_expand_progress((float)idx / (float)height);
-		int ysz = std::min(height - idx, BLOCKSZ);
-		expand_scanlines(expand_data.output, idx, ysz, expand_data.radius,
-				expand_data.input, expand_data.mask);
-		idx += ysz;
+		bitmask_destroy(&bmask);
 	}
 	emit expand_data.win->sig_expand_done();
 }
@@ -263,6 +436,45 @@ void MainWin::expand_progress(float p)
 	ui->progr_expand->setValue((int)(p * 100.0f));
 }
 
+void MainWin::expand_preview(int idx)
+{
+	// the view keeps its own copy of the pixels
+	if(!expand_data.cancel) {
+		QImage qimg = image_rows(expand_data.preview[idx], 0, expand_data.preview[idx]->height);
+		if(!qimg.isNull()) {
+			if(out_tiles.isEmpty()) {
+				init_output_view();
+			}
+			// stretched to full size, under the full resolution rows
+			delete out_preview;
+			out_preview = ui->gview_output->scene()->addPixmap(QPixmap::fromImage(qimg));
+			out_preview->setScale(expand_data.preview_scale[idx]);
+			out_preview->setZValue(-1);
+		}
+	}
+	img_free(expand_data.preview[idx]);
+	expand_data.preview[idx] = 0;
+}
+
+void MainWin::expand_rows(int y, int count)
+{
+	if(out_tiles.isEmpty()) {
+		init_output_view();
+	}
+
+	// the worker is done with these rows
+	QImage qimg = image_rows(out_tex, y, count);
+	if(qimg.isNull()) return;
+
+	int idx = y / VIEW_TILE_ROWS;
+	if(out_tiles[idx]) {
+		out_tiles[idx]->setPixmap(QPixmap::fromImage(qimg));
+	} else {
+		out_tiles[idx] = ui->gview_output->scene()->addPixmap(QPixmap::fromImage(qimg));
+		out_tiles[idx]->setPos(0, y);
+	}
+}
+
 void MainWin::expand_done()
 {
 	ui->progr_expand->setValue(100);
@@ -271,9 +483,16 @@ void MainWin::expand_done()
 
 	expand_data.input = 0;
 	if(!expand_data.cancel) {
-		update_image_widget(ui->gview_output, out_tex);
+		// all the rows are in by now
+		delete out_preview;
+		out_preview = 0;
 		precond_save_expanded();
 	}
+
+	if(reexpand_pending) {
+		reexpand_pending = false;
+		radius_changed();
+	}
 }
 
 void MainWin::on_bn_expand_clicked()
@@ -287,17 +506,56 @@ void MainWin::on_bn_expand_clicked()
 		expand_data.output = out_tex;
 		expand_data.mask = mask;
 		expand_data.radius = ui->chk_rad_inf->isChecked() ? -1 : ui->spin_radius->value();
+		expand_data.alg = ui->combo_alg->currentIndex();
+		expand_data.mask_gen = mask_gen;
 		expand_data.win = this;
-		expand_data.cancel = false;
+		expand_data.cancel = 0;
 
 		printf("expanding image %dx%d\n", in_tex->width, in_tex->height);
 
 		img_copy(out_tex, in_tex);
+		// the previous output stays up until the first preview or rows come in
+		out_tiles.clear();
+
 		std::thread thr{thread_func};
 		thr.detach();
 	} else {
-		expand_data.cancel = true;
+		expand_data.cancel = 1;
+	}
+}
+
+void MainWin::on_combo_alg_currentIndexChanged(int idx)
+{
+	// pull-push always fills the whole texture
+	bool radius = idx != ALG_PULLPUSH;
+	ui->chk_rad_inf->setEnabled(radius);
+	ui->spin_radius->setEnabled(radius);
+}
+
+void MainWin::on_spin_radius_valueChanged(int val)
+{
+	radius_changed();
+}
+
+void MainWin::on_chk_rad_inf_toggled(bool checked)
+{
+	radius_changed();
+}
+
+// With the nearest texel map of the current mask at hand, a new radius takes
+// just a threshold and gather pass, so the output follows the radius controls
+// right away. Changes during an expansion are picked up once it's done.
+void MainWin::radius_changed()
+{
+	if(ui->combo_alg->currentIndex() == ALG_PULLPUSH || !IMAGE_VALID(in_tex) || !IMAGE_VALID(mask) ||
+			!nearest_valid(mask_gen, in_tex, mask) || !ui->bn_save_exp->isEnabled()) {
+		return;
 	}
+	if(expand_data.input) {
+		reexpand_pending = true;
+		return;
+	}
+	on_bn_expand_clicked();
 }
 
 // --- private ---
@@ -321,52 +579,76 @@ void MainWin::precond_save_expanded()
 	ui->bn_save_exp->setEnabled(IMAGE_VALID(out_tex));
 }
 
+// start over with an empty output view of the size of the output texture
+void MainWin::init_output_view()
+{
+	QGraphicsScene *gs = ui->gview_output->scene();
+	gs->clear();
+	out_preview = 0;
+	out_tiles.fill(0, (out_tex->height + VIEW_TILE_ROWS - 1) / VIEW_TILE_ROWS);
+
+	gs->setSceneRect(0, 0, out_tex->width, out_tex->height);
+	fit_view(ui->gview_output);
+}
+
 // --- static ---
 static bool update_image_widget(QGraphicsView *gview, struct img_pixmap *img)
 {
-	struct img_pixmap tmp;
-
 	if(!IMAGE_VALID(img)) {
 		gview->scene()->clear();
 		return false;
 	}
 
-	img_init(&tmp);
-	if(img_is_float(img)) {
-		img_copy(&tmp, img);
-		img_to_integer(&tmp);
-		img = &tmp;
+	QImage qimg = image_rows(img, 0, img->height);
+	if(qimg.isNull()) {
+		return false;
 	}
 
+	QGraphicsScene *gs = gview->scene();
+	gs->clear();
+	gs->addPixmap(QPixmap::fromImage(qimg));
+
+	fit_view(gview);
+	return true;
+}
+
+// 8 bits per channel copy of count rows of img, starting from row y
+static QImage image_rows(struct img_pixmap *img, int y, int count)
+{
 	QImage::Format qfmt;
 	switch(img->fmt) {
 	case IMG_FMT_GREY8:
+	case IMG_FMT_GREYF:
 		qfmt = QImage::Format_Grayscale8;
 		break;
 	case IMG_FMT_RGB24:
+	case IMG_FMT_RGBF:
+	case IMG_FMT_RGB565:
 		qfmt = QImage::Format_RGB888;
 		break;
 	case IMG_FMT_RGBA32:
+	case IMG_FMT_RGBAF:
 		qfmt = QImage::Format_RGBA8888;
 		break;
 	default:
-		fprintf(stderr, "update_image_widget: unsupported pixmap format!\n");
-		return false;
+		fprintf(stderr, "image_rows: unsupported pixmap format!\n");
+		return QImage();
 	}
 
-	QImage qimg((unsigned char*)img->pixels, img->width, img->height, qfmt);
+	QImage qimg(img->width, count, qfmt);
+	if(qimg.isNull() || preview_quantize(qimg.bits(), qimg.bytesPerLine(), img, y, count) == -1) {
+		return QImage();
+	}
+	return qimg;
+}
 
+// calculate a scaling factor to fit the image in the view
+static void fit_view(QGraphicsView *gview)
+{
 	QGraphicsScene *gs = gview->scene();
-	gs->clear();
-	gs->addPixmap(QPixmap::fromImage(qimg));
-
-	img_destroy(&tmp);
-
-	// calculate a scaling factor to fit the image in the view
 	float sx = (float)gview->rect().width() / gs->sceneRect().width();
 	float sy = (float)gview->rect().height() / gs->sceneRect().height();
 	float s = sx < sy ? sx : sy;
 	gview->resetTransform();
 	gview->scale(s, s);
-	return true;
 }
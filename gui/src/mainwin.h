@@ -20,8 +20,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QMainWindow>
 #include <QSocketNotifier>
+#include <QVector>
 #include "genmask.h"
 
+class QGraphicsPixmapItem;
+
 namespace Ui {
 	class MainWin;
 }
@@ -33,15 +36,24 @@ class MainWin : public QMainWindow
 private:
 	Ui::MainWin *ui;
 	QSocketNotifier *sock_notifier;
-	aiScene *scn;
+	uvscene *scn;
 	struct img_pixmap *mask;
 	struct img_pixmap *in_tex;
 	struct img_pixmap *out_tex;
+	int mask_gen;	// incremented on every mask change
+	bool reexpand_pending;
+
+	// output view: latest low resolution preview, and the full resolution
+	// pixmaps of every VIEW_TILE_ROWS rows done so far
+	QGraphicsPixmapItem *out_preview;
+	QVector<QGraphicsPixmapItem*> out_tiles;
 
 	void precond_genmask();
 	void precond_savemask();
 	void precond_expand();
 	void precond_save_expanded();
+	void init_output_view();
+	void radius_changed();
 
 public:
 	explicit MainWin(QWidget *parent = 0);
@@ -49,10 +61,14 @@ public:
 
 signals:
 	void sig_expand_progress(float p);
+	void sig_expand_preview(int idx);
+	void sig_expand_rows(int y, int count);
 	void sig_expand_done();
 
 private slots:
 	void expand_progress(float p);
+	void expand_preview(int idx);
+	void expand_rows(int y, int count);
 	void expand_done();
 
 	void socket_readable(int s);
@@ -63,6 +79,9 @@ private slots:
 	void on_bn_expand_clicked();
 	void on_bn_save_exp_clicked();
 	void on_bn_selmask_clicked();
+	void on_combo_alg_currentIndexChanged(int idx);
+	void on_spin_radius_valueChanged(int val);
+	void on_chk_rad_inf_toggled(bool checked);
 };
 
 #endif // MAINWIN_H
@@ -14,7 +14,8 @@ FORMS += ui/mainwin.ui
 
 # backend
 QMAKE_CFLAGS += -fopenmp
-SOURCES += ../src/genmask.c ../src/expand.c
+SOURCES += ../src/genmask.c ../src/uvscene.c ../src/hash.c ../src/expand.c ../src/bitmask.c \
+    ../src/pullpush.c ../src/swrast.c ../src/preview.c
 INCLUDEPATH += /usr/local/include
 LIBS += -L/usr/local/lib -lassimp -limago -lgomp -lz -lpng -ljpeg
 
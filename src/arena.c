@@ -0,0 +1,65 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+void arena_init(struct arena *a)
+{
+	a->mem = a->base = 0;
+	a->size = a->top = 0;
+}
+
+void arena_destroy(struct arena *a)
+{
+	free(a->mem);
+	arena_init(a);
+}
+
+int arena_reset(struct arena *a, size_t size)
+{
+	a->top = 0;
+	if(size <= a->size) {
+		return 0;
+	}
+
+	/* malloc only aligns to the largest scalar type, so round the base up */
+	free(a->mem);
+	if(!(a->mem = malloc(size + ARENA_ALIGN - 1))) {
+		fprintf(stderr, "failed to allocate %lu byte arena\n", (unsigned long)size);
+		a->base = 0;
+		a->size = 0;
+		return -1;
+	}
+	a->base = a->mem + (ARENA_SIZE(a->mem) - (size_t)a->mem);
+	a->size = size;
+	return 0;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	void *ptr;
+
+	size = ARENA_SIZE(size);
+	if(size > a->size - a->top) {
+		return 0;
+	}
+	ptr = a->base + a->top;
+	a->top += size;
+	return ptr;
+}
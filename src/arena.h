@@ -0,0 +1,59 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+/* The block starts on an ARENA_ALIGN byte boundary, and so does every
+ * allocation, which keeps the buffers of different threads on separate cache
+ * lines. ARENA_SIZE is the space an allocation of sz bytes takes.
+ */
+#define ARENA_ALIGN		64
+#define ARENA_SIZE(sz)	(((size_t)(sz) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* Bump allocator over a single block, which is only ever grown, and reused
+ * for as long as it's large enough. Once the largest set of buffers has been
+ * seen, resetting and allocating from the arena never calls malloc.
+ */
+struct arena {
+	char *mem;			/* the malloc block, base rounded up to ARENA_ALIGN */
+	char *base;
+	size_t size, top;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void arena_init(struct arena *a);
+void arena_destroy(struct arena *a);
+
+/* Free all the allocations at once, and make sure there's room for size
+ * bytes of them (the sum of their ARENA_SIZE). The contents are not kept.
+ */
+int arena_reset(struct arena *a, size_t size);
+
+/* returns null if the arena is exhausted */
+void *arena_alloc(struct arena *a, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* ARENA_H_ */
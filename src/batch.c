@@ -0,0 +1,638 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <omp.h>
+#include <imago2.h>
+#include "batch.h"
+#include "genmask.h"
+#include "expand.h"
+#include "bitmask.h"
+#include "pullpush.h"
+#include "stats.h"
+#include "rawimg.h"
+#include "rescache.h"
+
+/* textures up to this many texels are expanded concurrently, one per thread */
+#define SMALL_TEX	(512 * 512)
+
+struct job {
+	struct batch_job cfg;
+	int line, order;
+
+	/* loaded by the prefetch thread */
+	struct img_pixmap img, mask;
+	int load_res;
+
+	struct bitmask bmask;
+	int failed;
+
+	uint64_t key;		/* result cache key, if has_key */
+	int has_key;
+};
+
+/* background loading of the next job's texture and mask file */
+struct loader {
+	pthread_t thread;
+	int running;
+};
+
+static int read_manifest(const char *fname, const struct batch_opt *defopt, struct job **jobptr);
+static int fetch_cached(struct job *jobs, int num_jobs);
+static int init_job(struct job *job, const struct batch_opt *defopt);
+static void destroy_job(struct job *job);
+static int next_pair(char **strp, char **key, char **val);
+static int set_str(char **dest, const char *src);
+static int job_cmp(const void *a, const void *b);
+static void start_load(struct loader *ld, struct job *job);
+static void finish_load(struct loader *ld);
+static void *load_func(void *arg);
+static int prepare_job(struct job *job);
+static int use_scene(const char *fname);
+static void run_jobs(struct job **jobs, int count);
+static int expand_job(struct job *job);
+static int save_job(struct job *job);
+static void free_job_data(struct job *job);
+static const char *basename_of(const char *path);
+
+static struct uvscene *scn;		/* the scene of the current group of mesh jobs */
+static const char *scn_fname;
+static int ctx_xsz, ctx_ysz;	/* size of the shared mask rendering context */
+static int silent;
+static const char *cache_dir;
+
+int batch_run(const char *fname, const struct batch_opt *defopt)
+{
+	int i, num_jobs, num_small = 0, max_small, num_failed = 0, levels;
+	struct job *jobs, **small;
+	struct loader ld;
+
+	if((num_jobs = read_manifest(fname, defopt, &jobs)) == -1) {
+		return -1;
+	}
+	silent = defopt->silent;
+	if((cache_dir = defopt->cache_dir)) {
+		num_jobs = fetch_cached(jobs, num_jobs);
+	}
+
+	max_small = omp_get_max_threads() * 2;
+	if(!(small = malloc(max_small * sizeof *small))) {
+		fprintf(stderr, "batch: failed to allocate memory\n");
+		for(i=0; i<num_jobs; i++) {
+			destroy_job(jobs + i);
+		}
+		free(jobs);
+		return -1;
+	}
+
+	/* group the jobs by mesh, so that every scene is imported once */
+	qsort(jobs, num_jobs, sizeof *jobs, job_cmp);
+
+	/* the concurrent small jobs must not spawn threads of their own */
+	levels = omp_get_max_active_levels();
+	omp_set_max_active_levels(1);
+
+	ld.running = 0;
+	if(num_jobs) {
+		start_load(&ld, jobs);
+	}
+
+	for(i=0; i<num_jobs; i++) {
+		struct job *job = jobs + i;
+
+		stats_begin("load", job->cfg.tex_fname);
+		finish_load(&ld);
+		stats_end();
+		if(i + 1 < num_jobs) {
+			start_load(&ld, job + 1);
+		}
+
+		if(job->load_res == -1 || prepare_job(job) == -1) {
+			job->failed = 1;
+			free_job_data(job);
+		} else if((long)job->img.width * job->img.height <= SMALL_TEX) {
+			small[num_small++] = job;
+		} else {
+			run_jobs(&job, 1);
+		}
+
+		if(num_small >= max_small || (num_small && i + 1 >= num_jobs)) {
+			run_jobs(small, num_small);
+			num_small = 0;
+		}
+	}
+	omp_set_max_active_levels(levels);
+
+	for(i=0; i<num_jobs; i++) {
+		if(jobs[i].failed) {
+			fprintf(stderr, "%s:%d: job failed: %s\n", fname, jobs[i].line, jobs[i].cfg.tex_fname);
+			num_failed++;
+		}
+		destroy_job(jobs + i);
+	}
+	free(jobs);
+	free(small);
+
+	if(scn) {
+		free_scene(scn);
+		scn = 0;
+	}
+	scn_fname = 0;
+	if(ctx_xsz) {
+		end_gen_mask();
+		ctx_xsz = ctx_ysz = 0;
+	}
+	return num_failed;
+}
+
+static int read_manifest(const char *fname, const struct batch_opt *defopt, struct job **jobptr)
+{
+	int i, num_jobs = 0, max_jobs = 0, lineno = 0;
+	struct job *jobs = 0;
+	char buf[4096], *ptr;
+	FILE *fp;
+
+	if(!(fp = fopen(fname, "r"))) {
+		fprintf(stderr, "failed to open batch manifest: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+
+	while(fgets(buf, sizeof buf, fp)) {
+		lineno++;
+		if(!strchr(buf, '\n') && !feof(fp)) {
+			fprintf(stderr, "%s:%d: line too long\n", fname, lineno);
+			goto err;
+		}
+
+		ptr = buf;
+		while(isspace((unsigned char)*ptr)) ptr++;
+		if(!*ptr || *ptr == '#') continue;
+
+		if(num_jobs >= max_jobs) {
+			void *tmp;
+			max_jobs = max_jobs ? max_jobs * 2 : 64;
+			if(!(tmp = realloc(jobs, max_jobs * sizeof *jobs))) {
+				fprintf(stderr, "batch: failed to allocate memory\n");
+				goto err;
+			}
+			jobs = tmp;
+		}
+
+		if(init_job(jobs + num_jobs, defopt) == -1) {
+			goto err;
+		}
+		jobs[num_jobs].line = lineno;
+		jobs[num_jobs].order = num_jobs;
+		if(batch_parse_job(&jobs[num_jobs++].cfg, ptr, fname, lineno) == -1) {
+			goto err;
+		}
+	}
+	fclose(fp);
+
+	*jobptr = jobs;
+	return num_jobs;
+
+err:
+	fclose(fp);
+	for(i=0; i<num_jobs; i++) {
+		destroy_job(jobs + i);
+	}
+	free(jobs);
+	return -1;
+}
+
+static int init_job(struct job *job, const struct batch_opt *defopt)
+{
+	memset(job, 0, sizeof *job);
+	img_init(&job->img);
+	img_init(&job->mask);
+	return batch_init_job(&job->cfg, defopt);
+}
+
+static void destroy_job(struct job *job)
+{
+	free_job_data(job);
+	batch_destroy_job(&job->cfg);
+}
+
+int batch_init_job(struct batch_job *job, const struct batch_opt *defopt)
+{
+	memset(job, 0, sizeof *job);
+	job->uvset = defopt->uvset;
+	job->radius = defopt->radius;
+	job->alg = defopt->alg;
+	job->force = defopt->force;
+
+	if(set_str(&job->scene_fname, defopt->scene_fname) == -1 ||
+			set_str(&job->mask_fname, defopt->mask_fname) == -1) {
+		batch_destroy_job(job);
+		return -1;
+	}
+	return 0;
+}
+
+void batch_destroy_job(struct batch_job *job)
+{
+	free(job->tex_fname);
+	free(job->out_fname);
+	free(job->scene_fname);
+	free(job->mask_fname);
+	memset(job, 0, sizeof *job);
+}
+
+int batch_parse_job(struct batch_job *job, char *line, const char *fname, int lineno)
+{
+	int res, mesh_set = 0, mask_set = 0;
+	char *key, *val, *endp;
+
+	while((res = next_pair(&line, &key, &val)) > 0) {
+		if(strcmp(key, "tex") == 0) {
+			if(set_str(&job->tex_fname, val) == -1) return -1;
+
+		} else if(strcmp(key, "out") == 0) {
+			if(set_str(&job->out_fname, val) == -1) return -1;
+
+		} else if(strcmp(key, "mesh") == 0) {
+			if(set_str(&job->scene_fname, val) == -1) return -1;
+			mesh_set = 1;
+
+		} else if(strcmp(key, "mask") == 0) {
+			if(set_str(&job->mask_fname, val) == -1) return -1;
+			mask_set = 1;
+
+		} else if(strcmp(key, "uvset") == 0) {
+			job->uvset = strtol(val, &endp, 10);
+			if(!*val || *endp || job->uvset < 0) goto inval;
+
+		} else if(strcmp(key, "radius") == 0) {
+			job->radius = strtol(val, &endp, 10);
+			if(!*val || *endp) goto inval;
+
+		} else if(strcmp(key, "alg") == 0) {
+			if(strcmp(val, "edt") == 0) {
+				job->alg = ALG_EDT;
+			} else if(strcmp(val, "search") == 0) {
+				job->alg = ALG_SEARCH;
+			} else if(strcmp(val, "pullpush") == 0) {
+				job->alg = ALG_PULLPUSH;
+			} else {
+				goto inval;
+			}
+
+		} else if(strcmp(key, "force") == 0) {
+			job->force = strtol(val, &endp, 10);
+			if(!*val || *endp) goto inval;
+
+		} else {
+			fprintf(stderr, "%s:%d: unknown key: %s\n", fname, lineno, key);
+			return -1;
+		}
+	}
+	if(res == -1) {
+		fprintf(stderr, "%s:%d: expected key=value pairs\n", fname, lineno);
+		return -1;
+	}
+
+	if(!job->tex_fname || !job->out_fname) {
+		fprintf(stderr, "%s:%d: every job needs a tex and an out file\n", fname, lineno);
+		return -1;
+	}
+
+	/* a mesh or mask given in the manifest overrides both defaults */
+	if(mesh_set && !mask_set) {
+		free(job->mask_fname);
+		job->mask_fname = 0;
+	}
+	if(mask_set && !mesh_set) {
+		free(job->scene_fname);
+		job->scene_fname = 0;
+	}
+	if(!job->scene_fname == !job->mask_fname) {
+		fprintf(stderr, "%s:%d: exactly one of mesh or mask must be specified\n", fname, lineno);
+		return -1;
+	}
+	return 0;
+
+inval:
+	fprintf(stderr, "%s:%d: invalid %s: %s\n", fname, lineno, key, val);
+	return -1;
+}
+
+/* split the next key=value pair off the line, in place. Returns 0 at the end
+ * of the line, and -1 on syntax errors
+ */
+static int next_pair(char **strp, char **key, char **val)
+{
+	char *ptr = *strp;
+
+	while(isspace((unsigned char)*ptr)) ptr++;
+	if(!*ptr) return 0;
+
+	*key = ptr;
+	while(*ptr && *ptr != '=' && !isspace((unsigned char)*ptr)) ptr++;
+	if(*ptr != '=' || ptr == *key) return -1;
+	*ptr++ = 0;
+
+	if(*ptr == '"') {
+		*val = ++ptr;
+		while(*ptr && *ptr != '"') ptr++;
+		if(!*ptr) return -1;
+	} else {
+		*val = ptr;
+		while(*ptr && !isspace((unsigned char)*ptr)) ptr++;
+	}
+	if(*ptr) *ptr++ = 0;
+
+	*strp = ptr;
+	return 1;
+}
+
+static int set_str(char **dest, const char *src)
+{
+	char *str = 0;
+
+	if(src) {
+		if(!(str = malloc(strlen(src) + 1))) {
+			fprintf(stderr, "batch: failed to allocate memory\n");
+			return -1;
+		}
+		strcpy(str, src);
+	}
+	free(*dest);
+	*dest = str;
+	return 0;
+}
+
+/* Look up the output of every job in the result cache, and drop the jobs
+ * which hit. Returns the number of jobs left.
+ */
+static int fetch_cached(struct job *jobs, int num_jobs)
+{
+	int i, count = 0;
+	struct rescache_src src;
+
+	stats_begin("cache", 0);
+	for(i=0; i<num_jobs; i++) {
+		struct job *job = jobs + i;
+
+		memset(&src, 0, sizeof src);
+		src.tex_fname = job->cfg.tex_fname;
+		src.out_fname = job->cfg.out_fname;
+		src.scene_fname = job->cfg.scene_fname;
+		src.mask_fname = job->cfg.mask_fname;
+		src.uvset = job->cfg.uvset;
+		src.filter = job->cfg.force ? 0 : basename_of(job->cfg.tex_fname);
+		src.radius = job->cfg.radius;
+		src.alg = job->cfg.alg;
+
+		/* inputs which can't be read fail later, when they're loaded */
+		job->has_key = rescache_key(&job->key, &src) != -1;
+
+		if(job->has_key && rescache_fetch(cache_dir, job->key, job->cfg.out_fname)) {
+			if(!silent) {
+				printf("%s -> %s (cached)\n", job->cfg.tex_fname, job->cfg.out_fname);
+			}
+			destroy_job(job);
+		} else {
+			jobs[count++] = *job;
+		}
+	}
+	stats_end();
+	return count;
+}
+
+/* by scene, then in manifest order */
+static int job_cmp(const void *a, const void *b)
+{
+	const struct job *ja = a;
+	const struct job *jb = b;
+	int res;
+
+	if(ja->cfg.scene_fname && jb->cfg.scene_fname) {
+		if((res = strcmp(ja->cfg.scene_fname, jb->cfg.scene_fname))) {
+			return res;
+		}
+	} else if(ja->cfg.scene_fname || jb->cfg.scene_fname) {
+		return ja->cfg.scene_fname ? 1 : -1;
+	}
+	return ja->order - jb->order;
+}
+
+static void start_load(struct loader *ld, struct job *job)
+{
+	if(pthread_create(&ld->thread, 0, load_func, job) != 0) {
+		/* no prefetching then */
+		load_func(job);
+		ld->running = 0;
+		return;
+	}
+	ld->running = 1;
+}
+
+static void finish_load(struct loader *ld)
+{
+	if(ld->running) {
+		pthread_join(ld->thread, 0);
+		ld->running = 0;
+	}
+}
+
+static void *load_func(void *arg)
+{
+	struct job *job = arg;
+
+	job->load_res = -1;
+	if(load_image(&job->img, job->cfg.tex_fname) == -1) {
+		fprintf(stderr, "failed to load image: %s\n", job->cfg.tex_fname);
+		return 0;
+	}
+	if(job->cfg.mask_fname) {
+		if(load_image(&job->mask, job->cfg.mask_fname) == -1 || img_convert(&job->mask, IMG_FMT_GREY8) == -1) {
+			fprintf(stderr, "failed to load mask file: %s\n", job->cfg.mask_fname);
+			return 0;
+		}
+	}
+	job->load_res = 0;
+	return 0;
+}
+
+/* generate or check the mask, and pack it. Mask rendering must stay on the
+ * main thread, which owns the rendering context
+ */
+static int prepare_job(struct job *job)
+{
+	int res;
+
+	if(job->cfg.scene_fname) {
+		if(use_scene(job->cfg.scene_fname) == -1) {
+			return -1;
+		}
+
+		/* grow the shared rendering context as needed */
+		if(job->img.width > ctx_xsz || job->img.height > ctx_ysz) {
+			int xsz = job->img.width > ctx_xsz ? job->img.width : ctx_xsz;
+			int ysz = job->img.height > ctx_ysz ? job->img.height : ctx_ysz;
+
+			if(ctx_xsz) {
+				end_gen_mask();
+			}
+			ctx_xsz = ctx_ysz = 0;
+			if(begin_gen_mask(xsz, ysz) == -1) {
+				return -1;
+			}
+			ctx_xsz = xsz;
+			ctx_ysz = ysz;
+		}
+
+		stats_begin("rasterize", job->cfg.tex_fname);
+		res = gen_mask(&job->mask, job->img.width, job->img.height, scn, job->cfg.uvset,
+				job->cfg.force ? 0 : basename_of(job->cfg.tex_fname));
+		stats_end();
+		if(res == -1) {
+			return -1;
+		}
+
+	} else if(job->mask.width != job->img.width || job->mask.height != job->img.height) {
+		fprintf(stderr, "texture (%s) and mask (%s) dimensions differ\n", job->cfg.tex_fname, job->cfg.mask_fname);
+		return -1;
+	}
+
+	res = bitmask_from_img(&job->bmask, &job->mask, EXPAND_MASK_THRES);
+	img_destroy(&job->mask);
+	img_init(&job->mask);
+	return res;
+}
+
+/* make the scene of fname current, importing it if it's not already */
+static int use_scene(const char *fname)
+{
+	if(scn_fname && strcmp(scn_fname, fname) == 0) {
+		return scn ? 0 : -1;	/* don't retry failed imports */
+	}
+
+	if(scn) {
+		free_scene(scn);
+	}
+	stats_begin("import", fname);
+	scn = load_scene(fname);
+	stats_end();
+	scn_fname = fname;
+	return scn ? 0 : -1;
+}
+
+/* a single job is expanded with all threads, while multiple jobs are
+ * distributed to the threads, one job per thread at a time
+ */
+static void run_jobs(struct job **jobs, int count)
+{
+	int i;
+
+	if(count == 1) {
+		stats_begin("expand", jobs[0]->cfg.tex_fname);
+		jobs[0]->failed = expand_job(jobs[0]) == -1;
+		stats_end();
+
+		if(!jobs[0]->failed) {
+			stats_begin("save", jobs[0]->cfg.out_fname);
+			jobs[0]->failed = save_job(jobs[0]) == -1;
+			stats_end();
+		}
+	} else {
+		stats_begin("expand_small", 0);
+#pragma omp parallel for schedule(dynamic)
+		for(i=0; i<count; i++) {
+			jobs[i]->failed = expand_job(jobs[i]) == -1 || save_job(jobs[i]) == -1;
+		}
+		stats_end();
+	}
+
+	for(i=0; i<count; i++) {
+		free_job_data(jobs[i]);
+	}
+}
+
+static int expand_job(struct job *job)
+{
+	int res;
+	int *nearest;
+	struct bitmask_tiles tiles;
+
+	switch(job->cfg.alg) {
+	case ALG_SEARCH:
+		if(bitmask_tiles_init(&tiles, &job->bmask) == -1) {
+			return -1;
+		}
+		res = expand_search_tiled(&job->img, job->cfg.radius, &job->img, &job->bmask, &tiles, 0);
+		bitmask_tiles_destroy(&tiles);
+		return res;
+
+	case ALG_PULLPUSH:
+		return expand_pullpush(&job->img, &job->bmask);
+
+	default:
+		break;
+	}
+
+	if(!(nearest = malloc(job->img.width * job->img.height * sizeof *nearest))) {
+		fprintf(stderr, "failed to allocate nearest texel map\n");
+		return -1;
+	}
+	if((res = calc_nearest(nearest, job->cfg.radius, &job->bmask)) != -1) {
+		res = expand_nearest(&job->img, &job->img, nearest);
+	}
+	free(nearest);
+	return res;
+}
+
+static int save_job(struct job *job)
+{
+	int res;
+
+	if(cache_dir && job->has_key) {
+		res = rescache_save(cache_dir, job->key, &job->img, job->cfg.out_fname);
+	} else {
+		res = save_image(&job->img, job->cfg.out_fname);
+	}
+	if(res == -1) {
+		fprintf(stderr, "failed to write output file: %s\n", job->cfg.out_fname);
+		return -1;
+	}
+	if(!silent) {
+		printf("%s -> %s\n", job->cfg.tex_fname, job->cfg.out_fname);
+	}
+	return 0;
+}
+
+static void free_job_data(struct job *job)
+{
+	img_destroy(&job->img);
+	img_init(&job->img);
+	img_destroy(&job->mask);
+	img_init(&job->mask);
+	bitmask_destroy(&job->bmask);
+}
+
+static const char *basename_of(const char *path)
+{
+	const char *ptr = strrchr(path, '/');
+	return ptr ? ptr + 1 : path;
+}
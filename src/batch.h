@@ -0,0 +1,80 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/* expansion algorithms (-alg, and alg= in batch manifests) */
+enum {
+	ALG_EDT,		/* euclidean distance transform */
+	ALG_SEARCH,		/* reference per-texel nearest search */
+	ALG_PULLPUSH	/* hierarchical pull-push fill */
+};
+
+/* settings of the jobs which don't override them in the manifest */
+struct batch_opt {
+	const char *scene_fname;
+	const char *mask_fname;
+	int uvset;
+	int radius;
+	int alg;
+	int force;
+	int silent;
+	const char *cache_dir;	/* result cache directory (see rescache.h), or null */
+};
+
+/* the settings of a single job, from a manifest line */
+struct batch_job {
+	char *tex_fname, *out_fname;
+	char *scene_fname, *mask_fname;		/* exactly one of them is set */
+	int uvset, radius, alg, force;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Run every job of a batch manifest in one process. Each line of the manifest
+ * is one job, as whitespace separated key=value pairs:
+ *
+ *   tex=<fname> out=<fname> [mesh=<fname> | mask=<fname>] [uvset=<n>]
+ *   [radius=<n>] [alg=edt|search|pullpush] [force=0|1]
+ *
+ * Values containing spaces can be double-quoted. Empty lines and lines
+ * starting with # are skipped. Jobs using the same mesh share a single scene
+ * import, and all masks are rasterized with one rendering context. The next
+ * texture is loaded in the background while the current one is expanded.
+ * Large textures are expanded with all threads, while runs of small ones are
+ * expanded concurrently, one per thread.
+ *
+ * Failed jobs don't stop the batch. Returns the number of failed jobs, or -1
+ * if the manifest itself can't be read.
+ */
+int batch_run(const char *fname, const struct batch_opt *defopt);
+
+/* Parse a single job line (see above) into job, which batch_init_job first
+ * fills with the defaults. Errors are reported as fname:lineno.
+ */
+int batch_init_job(struct batch_job *job, const struct batch_opt *defopt);
+int batch_parse_job(struct batch_job *job, char *line, const char *fname, int lineno);
+void batch_destroy_job(struct batch_job *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* BATCH_H_ */
@@ -0,0 +1,214 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <imago2.h>
+#include "bitmask.h"
+
+int bitmask_init(struct bitmask *bm, int width, int height)
+{
+	bm->width = width;
+	bm->height = height;
+	bm->pitch = (width + 63) >> 6;
+
+	if(!(bm->bits = calloc((size_t)bm->pitch * height, sizeof *bm->bits))) {
+		fprintf(stderr, "failed to allocate %dx%d bitmask\n", width, height);
+		return -1;
+	}
+	return 0;
+}
+
+void bitmask_destroy(struct bitmask *bm)
+{
+	free(bm->bits);
+	bm->bits = 0;
+}
+
+void bitmask_init_buf(struct bitmask *bm, int width, int height, uint64_t *bits)
+{
+	bm->width = width;
+	bm->height = height;
+	bm->pitch = (width + 63) >> 6;
+	bm->bits = bits;
+	memset(bits, 0, bitmask_size(width, height));
+}
+
+size_t bitmask_size(int width, int height)
+{
+	return (size_t)((width + 63) >> 6) * height * sizeof(uint64_t);
+}
+
+void bitmask_rows(struct bitmask *view, const struct bitmask *bm, int y, int count)
+{
+	view->width = bm->width;
+	view->height = count;
+	view->pitch = bm->pitch;
+	view->bits = BITMASK_ROW(bm, y);
+}
+
+int bitmask_from_img(struct bitmask *bm, struct img_pixmap *img, int thres)
+{
+	if(bitmask_init(bm, img->width, img->height) == -1) {
+		return -1;
+	}
+	bitmask_pack(bm, img, thres);
+	return 0;
+}
+
+void bitmask_pack(struct bitmask *bm, struct img_pixmap *img, int thres)
+{
+	int i;
+
+	assert(img->fmt == IMG_FMT_GREY8);
+	assert(img->width == bm->width && img->height == bm->height);
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<img->height; i++) {
+		bitmask_pack_row(bm, i, (unsigned char*)img->pixels + i * img->width, thres);
+	}
+}
+
+void bitmask_pack_row(struct bitmask *bm, int y, const unsigned char *pixels, int thres)
+{
+	int i, j, x = 0;
+	uint64_t *row = BITMASK_ROW(bm, y);
+
+	for(i=0; i<bm->pitch; i++) {
+		uint64_t word = 0;
+		int count = bm->width - x < 64 ? bm->width - x : 64;
+
+		for(j=0; j<count; j++) {
+			if(*pixels++ >= thres) {
+				word |= (uint64_t)1 << j;
+			}
+		}
+		row[i] = word;
+		x += 64;
+	}
+}
+
+long bitmask_count(const struct bitmask *bm)
+{
+	long i, count = 0, num_words = (long)bm->pitch * bm->height;
+
+#pragma omp parallel for reduction(+:count) schedule(static)
+	for(i=0; i<num_words; i++) {
+		count += __builtin_popcountll(bm->bits[i]);
+	}
+	return count;
+}
+
+int bitmask_tiles_init(struct bitmask_tiles *tiles, const struct bitmask *bm)
+{
+	unsigned char *state;
+
+	if(!(state = malloc(bitmask_tiles_size(bm->width, bm->height)))) {
+		fprintf(stderr, "failed to allocate %dx%d tile index\n", bm->pitch,
+				(bm->height + TILE_SIZE - 1) >> TILE_SHIFT);
+		return -1;
+	}
+	bitmask_tiles_init_buf(tiles, bm, state);
+	return 0;
+}
+
+size_t bitmask_tiles_size(int width, int height)
+{
+	return (size_t)((width + 63) >> 6) * ((height + TILE_SIZE - 1) >> TILE_SHIFT);
+}
+
+void bitmask_tiles_init_buf(struct bitmask_tiles *tiles, const struct bitmask *bm, unsigned char *state)
+{
+	int i;
+
+	tiles->xtiles = bm->pitch;
+	tiles->ytiles = (bm->height + TILE_SIZE - 1) >> TILE_SHIFT;
+	tiles->state = state;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<tiles->ytiles; i++) {
+		int j, k, y0 = i << TILE_SHIFT;
+		int y1 = y0 + TILE_SIZE < bm->height ? y0 + TILE_SIZE : bm->height;
+
+		for(j=0; j<tiles->xtiles; j++) {
+			/* bits past the end of the last word of a row are never set */
+			int count = bm->width - (j << 6) < 64 ? bm->width - (j << 6) : 64;
+			uint64_t full = count < 64 ? ((uint64_t)1 << count) - 1 : ~(uint64_t)0;
+			uint64_t any = 0, all = full;
+
+			for(k=y0; k<y1; k++) {
+				uint64_t word = BITMASK_ROW(bm, k)[j];
+				any |= word;
+				all &= word;
+			}
+
+			if(!any) {
+				BITMASK_TILE(tiles, j, i) = TILE_EMPTY;
+			} else if(all == full) {
+				BITMASK_TILE(tiles, j, i) = TILE_FULL;
+			} else {
+				BITMASK_TILE(tiles, j, i) = TILE_MIXED;
+			}
+		}
+	}
+}
+
+void bitmask_tiles_destroy(struct bitmask_tiles *tiles)
+{
+	free(tiles->state);
+	tiles->state = 0;
+}
+
+int bitmask_next(const struct bitmask *bm, int x, int y)
+{
+	int w;
+	uint64_t word;
+	const uint64_t *row;
+
+	if(x < 0) x = 0;
+	if(x >= bm->width) return -1;
+
+	row = BITMASK_ROW(bm, y);
+	w = x >> 6;
+	word = row[w] & (~(uint64_t)0 << (x & 63));
+	while(!word) {
+		if(++w >= bm->pitch) return -1;
+		word = row[w];
+	}
+	return (w << 6) + __builtin_ctzll(word);
+}
+
+int bitmask_prev(const struct bitmask *bm, int x, int y)
+{
+	int w;
+	uint64_t word;
+	const uint64_t *row;
+
+	if(x < 0) return -1;
+	if(x >= bm->width) x = bm->width - 1;
+
+	row = BITMASK_ROW(bm, y);
+	w = x >> 6;
+	word = row[w] & (~(uint64_t)0 >> (63 - (x & 63)));
+	while(!word) {
+		if(--w < 0) return -1;
+		word = row[w];
+	}
+	return (w << 6) + 63 - __builtin_clzll(word);
+}
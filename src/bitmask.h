@@ -0,0 +1,97 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BITMASK_H_
+#define BITMASK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct img_pixmap;
+
+/* 1 bit per texel usage mask. Each row starts at a 64bit word boundary, with
+ * bit i of a word corresponding to texel (word * 64 + i) of the row.
+ */
+struct bitmask {
+	int width, height;
+	int pitch;			/* 64bit words per row */
+	uint64_t *bits;
+};
+
+#define BITMASK_ROW(bm, y)		((bm)->bits + (long)(y) * (bm)->pitch)
+#define BITMASK_GET(bm, x, y)	((BITMASK_ROW(bm, y)[(x) >> 6] >> ((x) & 63)) & 1)
+#define BITMASK_SET(bm, x, y)	(BITMASK_ROW(bm, y)[(x) >> 6] |= (uint64_t)1 << ((x) & 63))
+
+/* Coarse occupancy index over a bitmask, one state per square tile. Tiles are
+ * exactly one bitmask word wide, so tile column tx of a row is word tx.
+ */
+#define TILE_SHIFT	6
+#define TILE_SIZE	(1 << TILE_SHIFT)
+
+enum { TILE_EMPTY, TILE_MIXED, TILE_FULL };
+
+struct bitmask_tiles {
+	int xtiles, ytiles;
+	unsigned char *state;
+};
+
+#define BITMASK_TILE(t, tx, ty)	((t)->state[(ty) * (t)->xtiles + (tx)])
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* allocates a cleared bitmask */
+int bitmask_init(struct bitmask *bm, int width, int height);
+void bitmask_destroy(struct bitmask *bm);
+/* Cleared bitmask in caller-owned memory of at least bitmask_size bytes,
+ * suitably aligned for 64bit words. Don't call bitmask_destroy on it.
+ */
+void bitmask_init_buf(struct bitmask *bm, int width, int height, uint64_t *bits);
+size_t bitmask_size(int width, int height);
+
+/* rows of another bitmask, sharing its bits */
+void bitmask_rows(struct bitmask *view, const struct bitmask *bm, int y, int count);
+
+/* set the bit of every texel of the GREY8 image which is >= thres */
+int bitmask_from_img(struct bitmask *bm, struct img_pixmap *img, int thres);
+/* the same, into an initialized bitmask of the same dimensions */
+void bitmask_pack(struct bitmask *bm, struct img_pixmap *img, int thres);
+void bitmask_pack_row(struct bitmask *bm, int y, const unsigned char *pixels, int thres);
+
+/* number of set texels */
+long bitmask_count(const struct bitmask *bm);
+
+/* classify every tile of the bitmask as empty, full, or mixed */
+int bitmask_tiles_init(struct bitmask_tiles *tiles, const struct bitmask *bm);
+void bitmask_tiles_destroy(struct bitmask_tiles *tiles);
+/* the same, with the tile states in caller-owned memory of bitmask_tiles_size
+ * bytes. Don't call bitmask_tiles_destroy on it.
+ */
+void bitmask_tiles_init_buf(struct bitmask_tiles *tiles, const struct bitmask *bm, unsigned char *state);
+size_t bitmask_tiles_size(int width, int height);
+
+/* first set texel at or after x in row y, or -1 */
+int bitmask_next(const struct bitmask *bm, int x, int y);
+/* last set texel at or before x in row y, or -1 */
+int bitmask_prev(const struct bitmask *bm, int x, int y);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* BITMASK_H_ */
@@ -18,141 +18,598 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <float.h>
+#include <math.h>
 #include <assert.h>
+#include <omp.h>
 #include <imago2.h>
 #include "expand.h"
+#include "bitmask.h"
 
-static int find_nearest(int x, int y, struct img_pixmap *mask, int max_dist, int *resx, int *resy);
+typedef void (*gather_func)(void *dest, const void *src, const int *nearest, int start, int count);
+
+static gather_func gather_kernel(enum img_fmt fmt);
+static int find_nearest(int x, int y, const struct bitmask *mask, const struct bitmask_tiles *tiles,
+		int max_dist, int *resx, int *resy, long *num_cand);
+static void search_tile(int tx, int ty, int x, int y, const struct bitmask *mask,
+		long long *min_distsq, int *min_px, int *min_py, long *num_cand);
+static void step_progress(const struct expand_progress *prog, long *done, long total,
+		float start, float end);
+
+static double busy_start(void);
+static void busy_end(double start);
+static void add_counters(long texels, long candidates);
+
+#define CANCELLED(prog)	((prog) && (prog)->cancel && *(prog)->cancel)
+
+#define LIMIT_CHUNK	256	/* texels thresholded at a time by expand_nearest_limit */
+
+struct expand_stats *expand_stats;
 
 int expand(struct img_pixmap *res, int max_dist, struct img_pixmap *img, struct img_pixmap *mask)
 {
-	return expand_scanlines(res, 0, img->height, max_dist, img, mask);
+	int res_code;
+	int *nearest;
+	struct bitmask bmask;
+
+	if(bitmask_from_img(&bmask, mask, EXPAND_MASK_THRES) == -1) {
+		return -1;
+	}
+	if(!(nearest = malloc(mask->width * mask->height * sizeof *nearest))) {
+		fprintf(stderr, "expand: failed to allocate nearest texel map\n");
+		bitmask_destroy(&bmask);
+		return -1;
+	}
+	if((res_code = calc_nearest(nearest, max_dist, &bmask)) != -1) {
+		res_code = expand_nearest(res, img, nearest);
+	}
+	free(nearest);
+	bitmask_destroy(&bmask);
+	return res_code;
 }
 
+int expand_nearest(struct img_pixmap *res, struct img_pixmap *img, const int *nearest)
+{
+	return expand_nearest_scanlines(res, 0, img->height, img, nearest);
+}
 
-int expand_scanlines(struct img_pixmap *res, int ystart, int ycount, int max_dist, struct img_pixmap *img, struct img_pixmap *mask)
+int expand_nearest_scanlines(struct img_pixmap *res, int ystart, int ycount,
+		struct img_pixmap *img, const int *nearest)
 {
-	int i, width = res->width;
+	int i, width = img->width;
+	gather_func gather;
 
-	assert(img->fmt == IMG_FMT_RGBAF);
-	assert(res->fmt == IMG_FMT_RGBAF);
-	assert(mask->fmt == IMG_FMT_GREY8);
+	assert(res->fmt == img->fmt);
+	assert(res->width == img->width && res->height == img->height);
 
-#pragma omp parallel for schedule(dynamic)
+	if(!(gather = gather_kernel(img->fmt))) {
+		fprintf(stderr, "expand: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+
+#pragma omp parallel for schedule(static)
 	for(i=0; i<ycount; i++) {
-		int j, y = i + ystart;
-		unsigned char *maskptr = (unsigned char*)mask->pixels + y * width;
-		float *dest = (float*)res->pixels + y * width * 4;
+		int offs = (i + ystart) * width;
+		double start = busy_start();
+		gather(res->pixels, img->pixels, nearest + offs, offs, width);
+		busy_end(start);
+	}
+	return 0;
+}
 
-		for(j=0; j<res->width; j++) {
-			if(*maskptr != 0xff) {
-				int nx, ny;
-				float *src;
+int expand_nearest_limit(struct img_pixmap *res, int ystart, int ycount, int max_dist,
+		struct img_pixmap *img, const int *nearest)
+{
+	int i, width = img->width;
+	long long max_distsq = (long long)max_dist * max_dist;
+	gather_func gather;
 
-				if(!find_nearest(j, y, mask, max_dist, &nx, &ny)) {
-					break;
-				}
+	if(max_dist <= 0) {
+		return expand_nearest_scanlines(res, ystart, ycount, img, nearest);
+	}
 
-				src = (float*)img->pixels + (ny * width + nx) * 4;
-				dest[0] = src[0];
-				dest[1] = src[1];
-				dest[2] = src[2];
+	assert(res->fmt == img->fmt);
+	assert(res->width == img->width && res->height == img->height);
+
+	if(!(gather = gather_kernel(img->fmt))) {
+		fprintf(stderr, "expand: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+
+	/* threshold the map a chunk of each row at a time, into a small buffer
+	 * for the gather kernel
+	 */
+#pragma omp parallel for schedule(static)
+	for(i=0; i<ycount; i++) {
+		int j, k, y = i + ystart;
+		int buf[LIMIT_CHUNK];
+		double start = busy_start();
+
+		for(j=0; j<width; j+=LIMIT_CHUNK) {
+			int offs = y * width + j;
+			int count = width - j < LIMIT_CHUNK ? width - j : LIMIT_CHUNK;
+
+			for(k=0; k<count; k++) {
+				int n = nearest[offs + k];
+				if(n >= 0) {
+					long long dx = n % width - (j + k);
+					long long dy = n / width - y;
+					if(dx * dx + dy * dy > max_distsq) n = -1;
+				}
+				buf[k] = n;
 			}
-			dest += 4;
-			++maskptr;
+			gather(res->pixels, img->pixels, buf, offs, count);
 		}
+		busy_end(start);
 	}
 	return 0;
 }
 
-#define GET_PIXEL(mask, x, y) (((unsigned char*)(mask)->pixels)[(y) * (mask)->width + (x)])
+int expand_nearest_span(struct img_pixmap *res, struct img_pixmap *img, const int *nearest,
+		int start, int count)
+{
+	gather_func gather;
+
+	assert(res->fmt == img->fmt);
+
+	if(!(gather = gather_kernel(img->fmt))) {
+		fprintf(stderr, "expand: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+	gather(res->pixels, img->pixels, nearest, start, count);
+	return 0;
+}
 
-static int find_nearest(int x, int y, struct img_pixmap *mask, int max_dist, int *resx, int *resy)
+int expand_search(struct img_pixmap *res, int max_dist, struct img_pixmap *img, struct img_pixmap *mask)
 {
-	int i, j, startx, starty, endx, endy, px, py, min_px = -1, min_py;
-	int min_distsq = INT_MAX;
-	int bwidth, bheight;
+	int res_code = -1;
+	struct bitmask bmask;
+	struct bitmask_tiles tiles;
 
-	if(max_dist <= 0) {
-		max_dist = mask->width > mask->height ? mask->width : mask->height;
+	if(bitmask_from_img(&bmask, mask, EXPAND_MASK_THRES) == -1) {
+		return -1;
+	}
+	if(bitmask_tiles_init(&tiles, &bmask) != -1) {
+		res_code = expand_search_tiled(res, max_dist, img, &bmask, &tiles, 0);
+		bitmask_tiles_destroy(&tiles);
 	}
+	bitmask_destroy(&bmask);
+	return res_code;
+}
 
-	startx = x >= max_dist ? x - max_dist : 0;
-	starty = y >= max_dist ? y - max_dist : 0;
-	endx = x + max_dist < mask->width ? x + max_dist : mask->width - 1;
-	endy = y + max_dist < mask->height ? y + max_dist : mask->height - 1;
 
-	/* try the cardinal directions first to find the search bounding box */
-	max_dist = x - startx;
-	for(i=0; i<max_dist; i++) {
-		if(GET_PIXEL(mask, x - i, y) == 0xff) {
-			startx = x - i;
-			break;
-		}
+int expand_scanlines(struct img_pixmap *res, int ystart, int ycount, int max_dist,
+		struct img_pixmap *img, const struct bitmask *mask, const struct bitmask_tiles *tiles)
+{
+	int i, width = res->width, fail = 0;
+	gather_func gather;
+
+	assert(res->fmt == img->fmt);
+
+	if(!(gather = gather_kernel(img->fmt))) {
+		fprintf(stderr, "expand: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
 	}
-	max_dist = endx + 1 - x;
-	for(i=0; i<max_dist; i++) {
-		if(GET_PIXEL(mask, x + i, y) == 0xff) {
-			endx = x + i;
-			break;
+
+#pragma omp parallel
+	{
+		int *rowbuf = malloc(width * sizeof *rowbuf);
+		long texels = 0, num_cand = 0;
+
+		if(!rowbuf) {
+#pragma omp atomic write
+			fail = 1;
 		}
-	}
-	max_dist = y - starty;
-	for(i=0; i<max_dist; i++) {
-		if(GET_PIXEL(mask, x, y - i) == 0xff) {
-			starty = y - i;
-			break;
+
+#pragma omp for schedule(dynamic)
+		for(i=0; i<ycount; i++) {
+			int j, tx, y = i + ystart;
+			double start;
+
+			if(fail) continue;
+			start = busy_start();
+
+			for(tx=0; tx<tiles->xtiles; tx++) {
+				int x0 = tx << TILE_SHIFT;
+				int x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+
+				/* fully covered tiles have nothing to expand */
+				if(BITMASK_TILE(tiles, tx, y >> TILE_SHIFT) == TILE_FULL) {
+					for(j=x0; j<x1; j++) {
+						rowbuf[j] = -1;
+					}
+					continue;
+				}
+
+				for(j=x0; j<x1; j++) {
+					int nx, ny;
+					rowbuf[j] = -1;
+					if(!BITMASK_GET(mask, j, y)) {
+						texels++;
+						if(find_nearest(j, y, mask, tiles, max_dist, &nx, &ny, &num_cand)) {
+							rowbuf[j] = ny * width + nx;
+						}
+					}
+				}
+			}
+			gather(res->pixels, img->pixels, rowbuf, y * width, width);
+			busy_end(start);
 		}
+		free(rowbuf);
+		add_counters(texels, num_cand);
 	}
-	max_dist = endy + 1 - y;
-	for(i=0; i<max_dist; i++) {
-		if(GET_PIXEL(mask, x, y + i) == 0xff) {
-			endy = y + i;
-			break;
-		}
+
+	if(fail) {
+		fprintf(stderr, "expand: failed to allocate row buffers\n");
+		return -1;
 	}
-	/* then try the main diagonal */
-	max_dist = x - startx < y - starty ? x - startx : y - starty;
-	for(i=0; i<max_dist; i++) {
-		int xoffs = x - i;
-		int yoffs = y - i;
-		if(GET_PIXEL(mask, xoffs, yoffs) == 0xff) {
-			if(startx < xoffs) startx = xoffs;
-			if(starty < yoffs) starty = yoffs;
+	return 0;
+}
+
+int expand_search_tiled(struct img_pixmap *res, int max_dist, struct img_pixmap *img,
+		const struct bitmask *mask, const struct bitmask_tiles *tiles,
+		const struct expand_progress *prog)
+{
+	int i, num_tiles, width = res->width;
+	long done = 0;
+	gather_func gather;
+
+	assert(res->fmt == img->fmt);
+
+	if(!(gather = gather_kernel(img->fmt))) {
+		fprintf(stderr, "expand: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+	num_tiles = tiles->xtiles * tiles->ytiles;
+
+	/* a single parallel region for the whole image: threads grab the next
+	 * tile as soon as they're done with the previous one
+	 */
+#pragma omp parallel
+	{
+		int rowbuf[TILE_SIZE];
+		long texels = 0, num_cand = 0;
+
+#pragma omp for schedule(dynamic)
+		for(i=0; i<num_tiles; i++) {
+			int j, k, x0, y0, x1, y1, tx, ty;
+			double start;
+
+			if(CANCELLED(prog)) continue;
+			start = busy_start();
+
+			tx = i % tiles->xtiles;
+			ty = i / tiles->xtiles;
+
+			/* fully covered tiles have nothing to expand */
+			if(BITMASK_TILE(tiles, tx, ty) != TILE_FULL) {
+				x0 = tx << TILE_SHIFT;
+				y0 = ty << TILE_SHIFT;
+				x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+				y1 = y0 + TILE_SIZE < res->height ? y0 + TILE_SIZE : res->height;
+
+				for(j=y0; j<y1; j++) {
+					for(k=x0; k<x1; k++) {
+						int nx, ny;
+						rowbuf[k - x0] = -1;
+						if(!BITMASK_GET(mask, k, j)) {
+							texels++;
+							if(find_nearest(k, j, mask, tiles, max_dist, &nx, &ny, &num_cand)) {
+								rowbuf[k - x0] = ny * width + nx;
+							}
+						}
+					}
+					gather(res->pixels, img->pixels, rowbuf, j * width + x0, x1 - x0);
+				}
+			}
+			busy_end(start);
+
+			if(prog) {
+				step_progress(prog, &done, num_tiles, 0.0f, 1.0f);
+			}
 		}
+		add_counters(texels, num_cand);
 	}
-	max_dist = (endx - x < endy - y ? endx - x : endy - y) + 1;
-	for(i=0; i<max_dist; i++) {
-		int xoffs = x + i;
-		int yoffs = y + i;
-		if(GET_PIXEL(mask, xoffs, yoffs == 0xff)) {
-			if(endx > xoffs) endx = xoffs;
-			if(endy > yoffs) endy = yoffs;
+	return CANCELLED(prog) ? -1 : 0;
+}
+
+/* Gather kernels, specialised for each pixel format: for count texels starting
+ * at texel index start, copy the color channels of the texel they map to in
+ * the nearest array. Alpha is left untouched.
+ */
+#define DEF_GATHER(name, type, nchan, ncolor) \
+	static void name(void *dest, const void *src, const int *nearest, int start, int count) \
+	{ \
+		int i, c; \
+		for(i=0; i<count; i++) { \
+			const type *sptr; \
+			type *dptr; \
+			int idx = nearest[i]; \
+			if(idx < 0 || idx == start + i) continue; \
+			sptr = (const type*)src + (size_t)idx * nchan; \
+			dptr = (type*)dest + (size_t)(start + i) * nchan; \
+			for(c=0; c<ncolor; c++) { \
+				dptr[c] = sptr[c]; \
+			} \
+		} \
+	}
+
+DEF_GATHER(gather_grey8, unsigned char, 1, 1)
+DEF_GATHER(gather_rgb24, unsigned char, 3, 3)
+DEF_GATHER(gather_rgba32, unsigned char, 4, 3)
+DEF_GATHER(gather_rgb565, unsigned short, 1, 1)
+DEF_GATHER(gather_greyf, float, 1, 1)
+DEF_GATHER(gather_rgbf, float, 3, 3)
+DEF_GATHER(gather_rgbaf, float, 4, 3)
+
+static gather_func gather_kernel(enum img_fmt fmt)
+{
+	switch(fmt) {
+	case IMG_FMT_GREY8:
+		return gather_grey8;
+	case IMG_FMT_RGB24:
+		return gather_rgb24;
+	case IMG_FMT_RGBA32:
+		return gather_rgba32;
+	case IMG_FMT_RGB565:
+		return gather_rgb565;
+	case IMG_FMT_GREYF:
+		return gather_greyf;
+	case IMG_FMT_RGBF:
+		return gather_rgbf;
+	case IMG_FMT_RGBAF:
+		return gather_rgbaf;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* Exact euclidean distance transform with nearest texel tracking, in two
+ * separable passes (Felzenszwalb & Huttenlocher, "Distance Transforms of
+ * Sampled Functions"). The first pass finds the nearest masked texel along
+ * each row, the second computes the lower envelope of the parabolas formed by
+ * those row distances, down each column. Both are linear in the number of
+ * texels, regardless of how sparse the mask is.
+ */
+int calc_nearest(int *nearest, int max_dist, const struct bitmask *mask)
+{
+	return calc_nearest_progress(nearest, max_dist, mask, 0);
+}
+
+int calc_nearest_progress(int *nearest, int max_dist, const struct bitmask *mask,
+		const struct expand_progress *prog)
+{
+	return calc_nearest_buf(nearest, max_dist, mask, prog, 0);
+}
+
+/* per thread: the parabola sites (y, x, f), the envelope, and its bounds */
+#define SCRATCH_ALIGN	64
+#define SCRATCH_ROUND(sz)	(((sz) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+size_t calc_nearest_scratch_size(int height)
+{
+	return SCRATCH_ROUND(height * sizeof(long long)) + SCRATCH_ROUND((height + 1) * sizeof(double)) +
+		3 * SCRATCH_ROUND(height * sizeof(int));
+}
+
+int calc_nearest_buf(int *nearest, int max_dist, const struct bitmask *mask,
+		const struct expand_progress *prog, void *scratch)
+{
+	int i, width = mask->width, height = mask->height;
+	long long max_distsq = max_dist > 0 ? (long long)max_dist * max_dist : LLONG_MAX;
+	int fail = 0;
+	long done = 0;
+
+	/* pass 1: nearest masked column within each row, or -1. Runs of unused
+	 * texels are skipped a word at a time, and split down the middle between
+	 * the masked texels on either side.
+	 */
+#pragma omp parallel for schedule(static)
+	for(i=0; i<height; i++) {
+		int j, x = 0, prev = -1, next;
+		int *row = nearest + i * width;
+		double start;
+
+		if(CANCELLED(prog)) continue;
+		start = busy_start();
+
+		while((next = bitmask_next(mask, x, i)) >= 0) {
+			int mid = prev >= 0 ? (prev + next) / 2 : -1;
+			for(j=x; j<=mid; j++) {
+				row[j] = prev;
+			}
+			for(j=mid >= x ? mid + 1 : x; j<=next; j++) {
+				row[j] = next;
+			}
+			prev = next;
+			x = next + 1;
+		}
+		for(j=x; j<width; j++) {
+			row[j] = prev;
+		}
+		busy_end(start);
+
+		if(prog) {
+			step_progress(prog, &done, height, 0.0f, 0.5f);
 		}
 	}
+	done = 0;
 
-	/* find the nearest */
-	bwidth = endx + 1 - startx;
-	bheight = endy + 1 - starty;
+	/* pass 2: lower envelope of the row distance parabolas down each column */
+#pragma omp parallel
+	{
+		int *site_y, *site_x, *env;
+		long long *site_f;
+		double *bound;
+		long texels = 0, num_cand = 0;
 
-	py = starty;
-	for(i=0; i<bheight; i++) {
-		px = startx;
-		for(j=0; j<bwidth; j++) {
-			if(GET_PIXEL(mask, px, py) == 0xff) {
-				int dx = px - x;
-				int dy = py - y;
-				int distsq = dx * dx + dy * dy;
+		if(scratch) {
+			char *ptr = (char*)scratch + omp_get_thread_num() * calc_nearest_scratch_size(height);
+			site_f = (long long*)ptr;
+			ptr += SCRATCH_ROUND(height * sizeof *site_f);
+			bound = (double*)ptr;
+			ptr += SCRATCH_ROUND((height + 1) * sizeof *bound);
+			site_y = (int*)ptr;
+			ptr += SCRATCH_ROUND(height * sizeof *site_y);
+			site_x = (int*)ptr;
+			ptr += SCRATCH_ROUND(height * sizeof *site_x);
+			env = (int*)ptr;
+		} else {
+			site_y = malloc(height * sizeof *site_y);
+			site_x = malloc(height * sizeof *site_x);
+			env = malloc(height * sizeof *env);
+			site_f = malloc(height * sizeof *site_f);
+			bound = malloc((height + 1) * sizeof *bound);
+		}
+
+		if(!site_y || !site_x || !env || !site_f || !bound) {
+#pragma omp atomic write
+			fail = 1;
+		}
 
-				if(distsq < min_distsq) {
-					min_distsq = distsq;
-					min_px = px;
-					min_py = py;
+#pragma omp for schedule(static)
+		for(i=0; i<width; i++) {
+			int j, k, num_sites = 0;
+			int *col = nearest + i;
+			double start;
+
+			if(fail || CANCELLED(prog)) continue;
+			start = busy_start();
+
+			/* gather the rows which have a masked texel as parabola sites */
+			for(j=0; j<height; j++) {
+				int sx = col[j * width];
+				if(sx >= 0) {
+					site_y[num_sites] = j;
+					site_x[num_sites] = sx;
+					site_f[num_sites] = (long long)(sx - i) * (sx - i) + (long long)j * j;
+					num_sites++;
 				}
 			}
-			++px;
+
+			if(!num_sites) {
+				for(j=0; j<height; j++) {
+					col[j * width] = -1;
+				}
+			} else {
+				/* build the lower envelope */
+				k = 0;
+				env[0] = 0;
+				bound[0] = -DBL_MAX;
+				bound[1] = DBL_MAX;
+				for(j=1; j<num_sites; j++) {
+					double s;
+					for(;;) {
+						int p = env[k];
+						s = (double)(site_f[j] - site_f[p]) / (double)(2 * (site_y[j] - site_y[p]));
+						if(s > bound[k]) break;
+						k--;
+					}
+					k++;
+					env[k] = j;
+					bound[k] = s;
+					bound[k + 1] = DBL_MAX;
+				}
+
+				/* walk down the column, picking the lowest parabola at each row */
+				k = 0;
+				for(j=0; j<height; j++) {
+					int p, dx, dy;
+
+					while(bound[k + 1] < (double)j) k++;
+					p = env[k];
+
+					dx = site_x[p] - i;
+					dy = site_y[p] - j;
+					if((long long)dx * dx + (long long)dy * dy > max_distsq) {
+						col[j * width] = -1;
+					} else {
+						col[j * width] = site_y[p] * width + site_x[p];
+					}
+				}
+			}
+			texels += height;
+			num_cand += num_sites;
+			busy_end(start);
+
+			if(prog) {
+				step_progress(prog, &done, width, 0.5f, 1.0f);
+			}
+		}
+
+		if(!scratch) {
+			free(site_y);
+			free(site_x);
+			free(env);
+			free(site_f);
+			free(bound);
+		}
+		add_counters(texels, num_cand);
+	}
+
+	if(fail) {
+		fprintf(stderr, "expand: failed to allocate distance transform buffers\n");
+		return -1;
+	}
+	return CANCELLED(prog) ? -1 : 0;
+}
+
+/* Visit the tiles in rings of increasing distance around the tile of x,y,
+ * skipping empty tiles and tiles which are entirely further away than the
+ * nearest texel found so far. The search stops at the first ring which can't
+ * possibly contain anything nearer.
+ */
+static int find_nearest(int x, int y, const struct bitmask *mask, const struct bitmask_tiles *tiles,
+		int max_dist, int *resx, int *resy, long *num_cand)
+{
+	int ring, max_ring, tx, ty, qtx, qty, min_px = -1, min_py = -1;
+	long long min_distsq = LLONG_MAX;
+
+	if(max_dist > 0) {
+		min_distsq = (long long)max_dist * max_dist + 1;
+	}
+
+	qtx = x >> TILE_SHIFT;
+	qty = y >> TILE_SHIFT;
+
+	max_ring = qtx;
+	if(tiles->xtiles - 1 - qtx > max_ring) max_ring = tiles->xtiles - 1 - qtx;
+	if(qty > max_ring) max_ring = qty;
+	if(tiles->ytiles - 1 - qty > max_ring) max_ring = tiles->ytiles - 1 - qty;
+
+	for(ring=0; ring<=max_ring; ring++) {
+		if(ring > 0) {
+			/* every texel of ring n is more than n - 1 whole tiles away */
+			long long d = (long long)(ring - 1) * TILE_SIZE + 1;
+			if(d * d >= min_distsq) break;
+		}
+
+		for(ty=qty-ring; ty<=qty+ring; ty++) {
+			int step;
+
+			if(ty < 0 || ty >= tiles->ytiles) continue;
+
+			/* the top and bottom rows of the ring are whole, the rest just
+			 * have the left and right tiles
+			 */
+			step = (ty == qty - ring || ty == qty + ring) ? 1 : 2 * ring;
+
+			for(tx=qtx-ring; tx<=qtx+ring; tx+=step) {
+				int x0, y0, dx, dy;
+
+				if(tx < 0 || tx >= tiles->xtiles) continue;
+				if(BITMASK_TILE(tiles, tx, ty) == TILE_EMPTY) continue;
+
+				x0 = tx << TILE_SHIFT;
+				y0 = ty << TILE_SHIFT;
+				dx = x < x0 ? x0 - x : (x >= x0 + TILE_SIZE ? x - (x0 + TILE_SIZE - 1) : 0);
+				dy = y < y0 ? y0 - y : (y >= y0 + TILE_SIZE ? y - (y0 + TILE_SIZE - 1) : 0);
+				if((long long)dx * dx + (long long)dy * dy >= min_distsq) continue;
+
+				search_tile(tx, ty, x, y, mask, &min_distsq, &min_px, &min_py, num_cand);
+			}
 		}
-		++py;
 	}
 
 	if(min_px != -1) {
@@ -162,3 +619,107 @@ static int find_nearest(int x, int y, struct img_pixmap *mask, int max_dist, int
 	}
 	return 0;
 }
+
+/* nearest masked texel to x,y in tile tx,ty. Each row of the tile is a single
+ * bitmask word, and only the set bits closest to x on either side of it can be
+ * the nearest in that row.
+ */
+static void search_tile(int tx, int ty, int x, int y, const struct bitmask *mask,
+		long long *min_distsq, int *min_px, int *min_py, long *num_cand)
+{
+	int i, py, y0, y1, x0, bit;
+
+	x0 = tx << TILE_SHIFT;
+	y0 = ty << TILE_SHIFT;
+	y1 = y0 + TILE_SIZE < mask->height ? y0 + TILE_SIZE : mask->height;
+	bit = x - x0;
+
+	for(py=y0; py<y1; py++) {
+		int cand[2];
+		long long dy = py - y;
+		uint64_t word;
+
+		if(dy * dy >= *min_distsq) continue;
+		if(!(word = BITMASK_ROW(mask, py)[tx])) continue;
+
+		if(bit <= 0) {
+			cand[0] = __builtin_ctzll(word);
+			cand[1] = -1;
+		} else if(bit >= 63) {
+			cand[0] = 63 - __builtin_clzll(word);
+			cand[1] = -1;
+		} else {
+			uint64_t right = word & (~(uint64_t)0 << bit);
+			uint64_t left = word & (~(uint64_t)0 >> (63 - bit));
+			cand[0] = right ? __builtin_ctzll(right) : -1;
+			cand[1] = left ? 63 - __builtin_clzll(left) : -1;
+		}
+
+		for(i=0; i<2; i++) {
+			long long dx, distsq;
+
+			if(cand[i] < 0) continue;
+			(*num_cand)++;
+
+			dx = x0 + cand[i] - x;
+			distsq = dx * dx + dy * dy;
+			if(distsq < *min_distsq) {
+				*min_distsq = distsq;
+				*min_px = x0 + cand[i];
+				*min_py = py;
+			}
+		}
+	}
+}
+
+/* count one finished work item out of total, and call the progress callback
+ * every time another percent of them is done
+ */
+static void step_progress(const struct expand_progress *prog, long *done, long total,
+		float start, float end)
+{
+	long n;
+
+#pragma omp atomic capture
+	n = ++*done;
+
+	if(prog->func && n * 100 / total != (n - 1) * 100 / total) {
+#pragma omp critical(expand_progress)
+		prog->func(start + (end - start) * (float)n / (float)total, prog->cls);
+	}
+}
+
+static double busy_start(void)
+{
+	return expand_stats ? omp_get_wtime() : 0.0;
+}
+
+/* Add the time since start to the busy time of the calling thread. Inside the
+ * concurrent jobs of batch and UDIM runs, the expansion's own parallel region
+ * is nested and inactive, so the time goes to the outermost thread instead;
+ * the update is atomic all the same, in case of any other nesting.
+ */
+static void busy_end(double start)
+{
+	int tid;
+	double t;
+
+	if(!expand_stats) return;
+
+	tid = omp_get_level() > 1 ? omp_get_ancestor_thread_num(1) : omp_get_thread_num();
+	if(tid >= 0 && tid < expand_stats->num_threads) {
+		t = omp_get_wtime() - start;
+#pragma omp atomic
+		expand_stats->busy[tid] += t;
+	}
+}
+
+static void add_counters(long texels, long candidates)
+{
+	if(!expand_stats) return;
+
+#pragma omp atomic
+	expand_stats->texels += texels;
+#pragma omp atomic
+	expand_stats->candidates += candidates;
+}
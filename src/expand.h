@@ -18,17 +18,104 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef EXPAND_H_
 #define EXPAND_H_
 
+#include <stddef.h>
+
 struct img_pixmap;
+struct bitmask;
+struct bitmask_tiles;
+
+/* mask texels at or above this value are used texels, to be expanded */
+#define EXPAND_MASK_THRES	0xff
+
+/* version of the expanded output, part of the result cache keys (see
+ * rescache.h). Bump it with any change to the mask rasterization or the
+ * expansion algorithms which changes their output, or cached results of
+ * the old code would be served in place of the new ones.
+ */
+#define EXPAND_OUTPUT_VERSION	1
+
+/* Progress reporting and cancellation, for the long running expansion calls.
+ * func is called with the fraction of the work done so far, from whichever
+ * worker thread finished the work, but never concurrently. Setting *cancel to
+ * non-zero from another thread stops the expansion as soon as possible, and
+ * makes it return -1. Any of the fields may be null.
+ */
+struct expand_progress {
+	void (*func)(float done, void *cls);
+	void *cls;
+	volatile int *cancel;
+};
+
+/* Expansion counters, accumulated by all expansion calls while expand_stats
+ * points to one of these (see stats.h). For the distance transform, the
+ * candidates are the parabola sites of each column; for the search, the
+ * masked texels it had to measure the distance to.
+ */
+struct expand_stats {
+	long texels;		/* texels which went through the nearest texel search */
+	long candidates;	/* candidate texels examined */
+	int num_threads;
+	double *busy;		/* seconds each worker thread spent working */
+};
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+extern struct expand_stats *expand_stats;
+
+/* expand using an exact euclidean distance transform, in linear time */
 int expand(struct img_pixmap *res, int max_dist, struct img_pixmap *img,
 		struct img_pixmap *mask);
 
+/* The two halves of expand, for expanding multiple textures sharing the same
+ * mask (packed with bitmask_from_img(..., EXPAND_MASK_THRES)): calc_nearest
+ * fills the nearest array (width * height ints) with the index (y * width + x)
+ * of the nearest masked texel to each texel, or -1 if there isn't one within
+ * max_dist (max_dist <= 0 means unlimited). Masked texels map to themselves.
+ * expand_nearest then copies the nearest texels over. res and img may be the
+ * same image.
+ */
+int calc_nearest(int *nearest, int max_dist, const struct bitmask *mask);
+int calc_nearest_progress(int *nearest, int max_dist, const struct bitmask *mask,
+		const struct expand_progress *prog);
+/* the same, with the per-thread buffers of the distance transform in scratch
+ * instead of allocated by every call: calc_nearest_scratch_size(mask height)
+ * bytes for each of the omp_get_max_threads() threads of the calling thread.
+ */
+int calc_nearest_buf(int *nearest, int max_dist, const struct bitmask *mask,
+		const struct expand_progress *prog, void *scratch);
+size_t calc_nearest_scratch_size(int height);
+int expand_nearest(struct img_pixmap *res, struct img_pixmap *img, const int *nearest);
+int expand_nearest_scanlines(struct img_pixmap *res, int ystart, int ycount,
+		struct img_pixmap *img, const int *nearest);
+/* expand_nearest_scanlines with a map calculated for an unlimited max_dist,
+ * leaving out the texels further than max_dist from their nearest masked
+ * texel. The result is the same as with a map calculated for max_dist, so a
+ * single map serves any radius.
+ */
+int expand_nearest_limit(struct img_pixmap *res, int ystart, int ycount, int max_dist,
+		struct img_pixmap *img, const int *nearest);
+/* expand count texels starting at texel index start, with nearest pointing to
+ * their count entries of the nearest texel map (-1 entries are skipped)
+ */
+int expand_nearest_span(struct img_pixmap *res, struct img_pixmap *img, const int *nearest,
+		int start, int count);
+
+/* reference implementation: per-texel search for the nearest masked texel.
+ * The tile index (see bitmask_tiles_init) lets the search skip fully covered
+ * tiles outright, and only visit the non-empty tiles nearest to each texel.
+ */
+int expand_search(struct img_pixmap *res, int max_dist, struct img_pixmap *img,
+		struct img_pixmap *mask);
 int expand_scanlines(struct img_pixmap *res, int y, int ycount, int max_dist,
-		struct img_pixmap *img, struct img_pixmap *mask);
+		struct img_pixmap *img, const struct bitmask *mask, const struct bitmask_tiles *tiles);
+/* the whole image in one go, distributing the tiles dynamically among the
+ * worker threads, with progress reported as tiles are finished
+ */
+int expand_search_tiled(struct img_pixmap *res, int max_dist, struct img_pixmap *img,
+		const struct bitmask *mask, const struct bitmask_tiles *tiles,
+		const struct expand_progress *prog);
 
 #ifdef __cplusplus
 }
@@ -15,25 +15,63 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <imago2.h>
 #include <GL/gl.h>
-#include <assimp/cimport.h>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-#include <assimp/mesh.h>
-#include <assimp/material.h>
-#include <assimp/vector3.h>
+#include <GL/glext.h>
 #include "genmask.h"
+#include "uvscene.h"
+#include "swrast.h"
 #include "glctx.h"
 
-static int uses_texture(const struct aiScene *scn, const struct aiMesh *mesh, const char *texname);
-static void draw_uvmesh(const struct aiMesh *mesh, int uvset);
+static int render_mask(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const char *filter, const int *meshes, int num_meshes, int async);
+static int rasterize(struct img_pixmap *mask, int xsz, int ysz, const struct swrast_batch *batches,
+		int num_batches, int async);
+static int udim_cmp(const void *a, const void *b);
+static int uses_texture(const struct uvscene *scn, const struct uvmesh *mesh, const char *texname);
+static int add_mesh(struct scene_texture *tex, int mesh_idx);
+static const float *mesh_uv(const struct uvmesh *mesh, int uvset);
+static int draw_gl(struct img_pixmap *mask, const struct swrast_batch *batches, int num_batches,
+		int async);
+static unsigned int upload_batches(const struct swrast_batch *batches, int num_batches);
+static int read_mask(struct img_pixmap *mask);
+static int start_readback(struct img_pixmap *mask);
+static int finish_readback(int idx);
+static int load_buffer_funcs(void);
+static int use_gl(void);
+static int init_gl_auto(int xsz, int ysz);
+
+static int ctx_xsz, ctx_ysz;	/* size of the persistent rendering context, if any */
+static const char *cache_dir;	/* scene cache directory, if any */
+static int rast_mode = MASK_RAST_AUTO;
+static int gl_avail = -1;		/* auto mode: OpenGL found usable, or -1 if not checked yet */
+
+/* masks drawn by gen_mask_*_begin, with their readback still in flight */
+#define MAX_PENDING	4
+static struct pending {
+	struct img_pixmap *mask;
+	unsigned int pbo;
+} pending[MAX_PENDING];
+static int num_pending;
+
+/* buffer object entry points, not exported by every OpenGL library */
+static PFNGLGENBUFFERSPROC gl_gen_buffers;
+static PFNGLDELETEBUFFERSPROC gl_delete_buffers;
+static PFNGLBINDBUFFERPROC gl_bind_buffer;
+static PFNGLBUFFERDATAPROC gl_buffer_data;
+static PFNGLBUFFERSUBDATAPROC gl_buffer_sub_data;
+static PFNGLMAPBUFFERPROC gl_map_buffer;
+static PFNGLUNMAPBUFFERPROC gl_unmap_buffer;
 
 int mask_from_scene(struct img_pixmap *mask, int xsz, int ysz, const char *fname,
 		int uvset, const char *filter)
 {
 	int res;
-	struct aiScene *scn = load_scene(fname);
+	struct uvscene *scn = load_scene(fname);
 	if(!scn) {
 		return -1;
 	}
@@ -43,111 +81,642 @@ int mask_from_scene(struct img_pixmap *mask, int xsz, int ysz, const char *fname
 	return res;
 }
 
-struct aiScene *load_scene(const char *fname)
+struct uvscene *load_scene(const char *fname)
 {
-	static const unsigned int ppflags = aiProcess_Triangulate | aiProcess_SortByPType |
-		aiProcess_GenUVCoords | aiProcess_TransformUVCoords | aiProcess_FlipUVs;
-	struct aiScene *scn;
+	return uvscene_load(fname, cache_dir);
+}
 
-	if(!(scn = (struct aiScene*)aiImportFile(fname, ppflags))) {
-		fprintf(stderr, "failed to load scene file: %s\n", fname);
-		return 0;
-	}
-	return scn;
+void free_scene(struct uvscene *scn)
+{
+	uvscene_free(scn);
 }
 
-void free_scene(struct aiScene *scn)
+void set_scene_cache(const char *dir)
 {
-	aiReleaseImport(scn);
+	cache_dir = dir;
 }
 
-int gen_mask(struct img_pixmap *mask, int xsz, int ysz, struct aiScene *scn,
+void set_mask_rasterizer(int rast)
+{
+	rast_mode = rast;
+}
+
+int gen_mask(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
 		int uvset, const char *filter)
+{
+	return render_mask(mask, xsz, ysz, scn, uvset, filter, 0, 0, 0);
+}
+
+int gen_mask_meshes(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const int *meshes, int num_meshes)
+{
+	return render_mask(mask, xsz, ysz, scn, uvset, 0, meshes, num_meshes, 0);
+}
+
+int gen_mask_meshes_begin(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const int *meshes, int num_meshes)
+{
+	return render_mask(mask, xsz, ysz, scn, uvset, 0, meshes, num_meshes, 1);
+}
+
+int gen_mask_tris(struct img_pixmap *mask, int xsz, int ysz, const float *uv, int num_tri)
+{
+	struct swrast_batch batch;
+
+	batch.uv = uv;
+	batch.num_tri = num_tri;
+	return rasterize(mask, xsz, ysz, &batch, 1, 0);
+}
+
+int gen_mask_tris_begin(struct img_pixmap *mask, int xsz, int ysz, const float *uv, int num_tri)
+{
+	struct swrast_batch batch;
+
+	batch.uv = uv;
+	batch.num_tri = num_tri;
+	return rasterize(mask, xsz, ysz, &batch, 1, 1);
+}
+
+int gen_mask_end(struct img_pixmap *mask)
 {
 	int i;
 
-	if(img_set_pixels(mask, xsz, ysz, IMG_FMT_GREY8, 0) == -1) {
-		fprintf(stderr, "failed to allocate mask image\n");
-		return -1;
+	for(i=0; i<num_pending; i++) {
+		if(pending[i].mask == mask) {
+			return finish_readback(i);
+		}
 	}
+	return 0;	/* drawn synchronously */
+}
 
-	if(init_gl(xsz, ysz) == -1) {
-		fprintf(stderr, "failed to initialize OpenGL\n");
+int scene_udim_tiles(struct uvscene *scn, int uvset, const char *filter, struct udim_tile **tilesptr)
+{
+	int i, j, k, num_tiles = 0, max_tiles = 0, num_outside = 0;
+	int slot[UDIM_ROWS * 10];	/* tile array index of each UDIM, or -1 */
+	int *max_tri = 0;
+	struct udim_tile *tiles = 0;
+	void *tmp;
+
+	if(uvset < 0 || uvset >= UV_MAX_SETS) {
+		fprintf(stderr, "invalid UV set: %d\n", uvset);
 		return -1;
 	}
+	for(i=0; i<UDIM_ROWS * 10; i++) {
+		slot[i] = -1;
+	}
 
-	glClear(GL_COLOR_BUFFER_BIT);
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	glOrtho(0, 1, 0, 1, -1, 1);
+	/* a single pass over all triangles, appending each one to every tile its
+	 * UV bounding box overlaps, translated into the unit square of that tile.
+	 * The rasterizer clips away the parts outside of each tile. The scene V
+	 * coordinates are flipped on import (v' = 1 - v), so the tile rows come
+	 * from 1 - v', and tile row tv spans v' in [-tv, 1 - tv].
+	 */
+	for(i=0; i<scn->num_meshes; i++) {
+		const struct uvmesh *mesh = scn->meshes + i;
+		const float *uv;
 
-	for(i=0; i<(int)scn->mNumMeshes; i++) {
-		const struct aiMesh *mesh = scn->mMeshes[i];
 		if(filter && !uses_texture(scn, mesh, filter)) {
 			continue;
 		}
-		draw_uvmesh(mesh, uvset);
+		if(!(uv = mesh_uv(mesh, uvset))) {
+			continue;
+		}
+
+		for(j=0; j<mesh->num_tri; j++, uv+=6) {
+			int tu, tv, tu0, tu1, tv0, tv1, idx;
+			float umin = uv[0], umax = uv[0], vmin = uv[1], vmax = uv[1];
+			float *dest;
+			struct udim_tile *tile;
+
+			for(k=1; k<3; k++) {
+				if(uv[k * 2] < umin) umin = uv[k * 2];
+				if(uv[k * 2] > umax) umax = uv[k * 2];
+				if(uv[k * 2 + 1] < vmin) vmin = uv[k * 2 + 1];
+				if(uv[k * 2 + 1] > vmax) vmax = uv[k * 2 + 1];
+			}
+			/* a bounding box ending exactly on a tile border doesn't enter the next */
+			tu0 = (int)floor(umin);
+			tv0 = (int)floor(1.0f - vmax);
+			if((tu1 = (int)ceil(umax) - 1) < tu0) tu1 = tu0;
+			if((tv1 = (int)ceil(1.0f - vmin) - 1) < tv0) tv1 = tv0;
+
+			if(tu0 < 0) tu0 = 0;
+			if(tv0 < 0) tv0 = 0;
+			if(tu1 >= 10) tu1 = 9;
+			if(tv1 >= UDIM_ROWS) tv1 = UDIM_ROWS - 1;
+			if(tu0 > tu1 || tv0 > tv1) {
+				num_outside++;
+				continue;
+			}
+
+			for(tv=tv0; tv<=tv1; tv++) {
+				for(tu=tu0; tu<=tu1; tu++) {
+					if((idx = slot[tv * 10 + tu]) == -1) {
+						if(num_tiles >= max_tiles) {
+							max_tiles = max_tiles ? max_tiles * 2 : 8;
+							if(!(tmp = realloc(tiles, max_tiles * sizeof *tiles))) {
+								goto nomem;
+							}
+							tiles = tmp;
+							if(!(tmp = realloc(max_tri, max_tiles * sizeof *max_tri))) {
+								goto nomem;
+							}
+							max_tri = tmp;
+						}
+						idx = slot[tv * 10 + tu] = num_tiles++;
+						tiles[idx].udim = 1001 + tv * 10 + tu;
+						tiles[idx].num_tri = 0;
+						tiles[idx].uv = 0;
+						max_tri[idx] = 0;
+					}
+
+					tile = tiles + idx;
+					if(tile->num_tri >= max_tri[idx]) {
+						int newsz = max_tri[idx] ? max_tri[idx] * 2 : 1024;
+						if(!(tmp = realloc(tile->uv, newsz * 6 * sizeof *tile->uv))) {
+							goto nomem;
+						}
+						tile->uv = tmp;
+						max_tri[idx] = newsz;
+					}
+
+					dest = tile->uv + tile->num_tri++ * 6;
+					for(k=0; k<3; k++) {
+						dest[k * 2] = uv[k * 2] - tu;
+						dest[k * 2 + 1] = uv[k * 2 + 1] + tv;
+					}
+				}
+			}
+		}
 	}
+	free(max_tri);
+
+	if(num_outside) {
+		fprintf(stderr, "warning: %d triangles outside of the UDIM range 1001-%d skipped\n",
+				num_outside, 1000 + UDIM_ROWS * 10);
+	}
+
+	qsort(tiles, num_tiles, sizeof *tiles, udim_cmp);
+	*tilesptr = tiles;
+	return num_tiles;
+
+nomem:
+	fprintf(stderr, "scene_udim_tiles: failed to allocate memory\n");
+	free(max_tri);
+	free_udim_tiles(tiles, num_tiles);
+	return -1;
+}
 
-	glReadPixels(0, 0, xsz, ysz, GL_LUMINANCE, GL_UNSIGNED_BYTE, mask->pixels);
+void free_udim_tiles(struct udim_tile *tiles, int count)
+{
+	int i;
+	for(i=0; i<count; i++) {
+		free(tiles[i].uv);
+	}
+	free(tiles);
+}
 
-	destroy_gl();
+int begin_gen_mask(int max_xsz, int max_ysz)
+{
+	if(!use_gl()) {
+		return 0;	/* the software rasterizer has no context to keep */
+	}
+	if(init_gl_auto(max_xsz, max_ysz) == -1) {
+		return use_gl() ? -1 : 0;
+	}
+	ctx_xsz = max_xsz;
+	ctx_ysz = max_ysz;
 	return 0;
 }
 
-static const enum aiTextureType types[] = {
-	aiTextureType_NONE,
-	aiTextureType_DIFFUSE,
-	aiTextureType_SPECULAR,
-	aiTextureType_AMBIENT,
-	aiTextureType_EMISSIVE,
-	aiTextureType_HEIGHT,
-	aiTextureType_NORMALS,
-	aiTextureType_SHININESS,
-	aiTextureType_OPACITY,
-	aiTextureType_DISPLACEMENT,
-	aiTextureType_LIGHTMAP,
-	aiTextureType_REFLECTION,
-	aiTextureType_UNKNOWN
-};
-
-static int uses_texture(const struct aiScene *scn, const struct aiMesh *mesh, const char *texname)
-{
-	int i, j;
-	const struct aiMaterial *mtl;
-	struct aiString name;
-
-	mtl = scn->mMaterials[mesh->mMaterialIndex];
-
-	for(i=0; i<(int)(sizeof(types) / sizeof(types[0])); i++) {
-		for(j=0; aiGetMaterialString(mtl, AI_MATKEY_TEXTURE(types[i], j), &name) == AI_SUCCESS; j++) {
-			if(strstr(name.data, texname)) {
-				return 1;
+void end_gen_mask(void)
+{
+	while(num_pending) {
+		finish_readback(0);
+	}
+	if(ctx_xsz) {
+		destroy_gl();
+		ctx_xsz = ctx_ysz = 0;
+	}
+}
+
+int scene_textures(struct uvscene *scn, struct scene_texture **texptr)
+{
+	int i, j, num_tex = 0, max_tex = 0;
+	struct scene_texture *tex = 0;
+	int **mtltex;		/* per material: texture indices, terminated by -1 */
+
+	if(!(mtltex = calloc(scn->num_mtl + 1, sizeof *mtltex))) {
+		goto nomem;
+	}
+
+	/* material -> texture index, with every texture name listed once */
+	for(i=0; i<scn->num_mtl; i++) {
+		const struct uvmaterial *mtl = scn->mtl + i;
+		int num_mtltex = 0;
+
+		for(j=0; j<mtl->num_tex; j++) {
+			int tidx;
+			void *tmp;
+			const char *name = mtl->tex[j];
+
+			for(tidx=0; tidx<num_tex; tidx++) {
+				if(strcmp(tex[tidx].name, name) == 0) break;
+			}
+			if(tidx >= num_tex) {
+				if(num_tex >= max_tex) {
+					max_tex = max_tex ? max_tex * 2 : 16;
+					if(!(tmp = realloc(tex, max_tex * sizeof *tex))) {
+						goto nomem;
+					}
+					tex = tmp;
+				}
+				tex[num_tex].meshes = 0;
+				tex[num_tex].num_meshes = 0;
+				if(!(tex[num_tex].name = malloc(strlen(name) + 1))) {
+					goto nomem;
+				}
+				strcpy(tex[num_tex++].name, name);
+			}
+
+			if(!(tmp = realloc(mtltex[i], (num_mtltex + 2) * sizeof *mtltex[i]))) {
+				goto nomem;
+			}
+			mtltex[i] = tmp;
+			mtltex[i][num_mtltex++] = tidx;
+			mtltex[i][num_mtltex] = -1;
+		}
+	}
+
+	/* then each mesh is added to the textures of its material */
+	for(i=0; i<scn->num_meshes; i++) {
+		int *tptr = mtltex[scn->meshes[i].mtl];
+		while(tptr && *tptr >= 0) {
+			if(add_mesh(tex + *tptr++, i) == -1) {
+				goto nomem;
+			}
+		}
+	}
+
+	for(i=0; i<scn->num_mtl; i++) {
+		free(mtltex[i]);
+	}
+	free(mtltex);
+
+	*texptr = tex;
+	return num_tex;
+
+nomem:
+	fprintf(stderr, "scene_textures: failed to allocate memory\n");
+	if(mtltex) {
+		for(i=0; i<scn->num_mtl; i++) {
+			free(mtltex[i]);
+		}
+		free(mtltex);
+	}
+	free_scene_textures(tex, num_tex);
+	return -1;
+}
+
+int scene_num_uvsets(struct uvscene *scn)
+{
+	int i, j, num = 0;
+
+	for(i=0; i<scn->num_meshes; i++) {
+		for(j=num; j<UV_MAX_SETS; j++) {
+			if(scn->meshes[i].uv[j]) {
+				num = j + 1;
 			}
 		}
 	}
+	return num;
+}
+
+void free_scene_textures(struct scene_texture *tex, int count)
+{
+	int i;
+	for(i=0; i<count; i++) {
+		free(tex[i].name);
+		free(tex[i].meshes);
+	}
+	free(tex);
+}
+
+static int render_mask(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const char *filter, const int *meshes, int num_meshes, int async)
+{
+	int i, num_batches = 0, res;
+	struct swrast_batch *batches;
+
+	if(uvset < 0 || uvset >= UV_MAX_SETS) {
+		fprintf(stderr, "invalid UV set: %d\n", uvset);
+		return -1;
+	}
+
+	/* the triangle arrays to draw, which both rasterizers take as is */
+	if(!(batches = malloc(scn->num_meshes * sizeof *batches + 1))) {
+		fprintf(stderr, "failed to allocate mask draw list\n");
+		return -1;
+	}
+	if(meshes) {
+		for(i=0; i<num_meshes; i++) {
+			const struct uvmesh *mesh = scn->meshes + meshes[i];
+			if(mesh->uv[uvset]) {
+				batches[num_batches].uv = mesh->uv[uvset];
+				batches[num_batches++].num_tri = mesh->num_tri;
+			}
+		}
+	} else {
+		for(i=0; i<scn->num_meshes; i++) {
+			const struct uvmesh *mesh = scn->meshes + i;
+			if(filter && !uses_texture(scn, mesh, filter)) {
+				continue;
+			}
+			if((batches[num_batches].uv = mesh_uv(mesh, uvset))) {
+				batches[num_batches++].num_tri = mesh->num_tri;
+			}
+		}
+	}
+
+	res = rasterize(mask, xsz, ysz, batches, num_batches, async);
+	free(batches);
+	return res;
+}
+
+static int rasterize(struct img_pixmap *mask, int xsz, int ysz, const struct swrast_batch *batches,
+		int num_batches, int async)
+{
+	if(img_set_pixels(mask, xsz, ysz, IMG_FMT_GREY8, 0) == -1) {
+		fprintf(stderr, "failed to allocate mask image\n");
+		return -1;
+	}
+
+	if(use_gl()) {
+		int res = draw_gl(mask, batches, num_batches, async);
+		/* unless auto mode just gave up on OpenGL */
+		if(res != -1 || use_gl()) {
+			return res;
+		}
+	}
+	return swrast_draw(mask->pixels, xsz, ysz, batches, num_batches);
+}
+
+static int udim_cmp(const void *a, const void *b)
+{
+	return ((const struct udim_tile*)a)->udim - ((const struct udim_tile*)b)->udim;
+}
+
+static int uses_texture(const struct uvscene *scn, const struct uvmesh *mesh, const char *texname)
+{
+	int i;
+	const struct uvmaterial *mtl = scn->mtl + mesh->mtl;
+
+	for(i=0; i<mtl->num_tex; i++) {
+		if(strstr(mtl->tex[i], texname)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int add_mesh(struct scene_texture *tex, int mesh_idx)
+{
+	void *tmp;
+
+	/* a material may list the same texture more than once */
+	if(tex->num_meshes && tex->meshes[tex->num_meshes - 1] == mesh_idx) {
+		return 0;
+	}
+	if(!(tmp = realloc(tex->meshes, (tex->num_meshes + 1) * sizeof *tex->meshes))) {
+		return -1;
+	}
+	tex->meshes = tmp;
+	tex->meshes[tex->num_meshes++] = mesh_idx;
 	return 0;
 }
 
-static void draw_uvmesh(const struct aiMesh *mesh, int uvset)
+static const float *mesh_uv(const struct uvmesh *mesh, int uvset)
 {
-	int i, j;
-	const struct aiVector3D *uv = mesh->mTextureCoords[uvset];
+	const float *uv = mesh->uv[uvset];
 	if(!uv) {
 		fprintf(stderr, "warning: mesh %s doesn't have UV set %d. Falling back to 0\n",
-				mesh->mName.data, uvset);
-		uv = mesh->mTextureCoords[0];
-		assert(uv);
+				mesh->name, uvset);
+		if(!(uv = mesh->uv[0])) {
+			fprintf(stderr, "warning: mesh %s doesn't have texture coordinates\n", mesh->name);
+		}
+	}
+	return uv;
+}
+
+static int draw_gl(struct img_pixmap *mask, const struct swrast_batch *batches, int num_batches,
+		int async)
+{
+	int i, own_ctx, res;
+	unsigned int vbo = 0;
+	size_t offs = 0;
+	int xsz = mask->width;
+	int ysz = mask->height;
+
+	/* draw with the persistent context if there is one, the window system
+	 * state of the backends only holds a single context at a time
+	 */
+	if(ctx_xsz && (xsz > ctx_xsz || ysz > ctx_ysz)) {
+		fprintf(stderr, "mask (%dx%d) larger than the rendering context (%dx%d)\n",
+				xsz, ysz, ctx_xsz, ctx_ysz);
+		return -1;
+	}
+	own_ctx = !ctx_xsz;
+	if(own_ctx && init_gl_auto(xsz, ysz) == -1) {
+		return -1;
+	}
+
+	glViewport(0, 0, xsz, ysz);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, 1, 0, 1, -1, 1);
+
+	/* one draw call per mesh, sourcing the triangles from a vertex buffer if
+	 * possible, or straight from the scene arrays otherwise
+	 */
+	if(load_buffer_funcs() != -1) {
+		vbo = upload_batches(batches, num_batches);
 	}
 
-	glBegin(GL_TRIANGLES);
+	glEnableClientState(GL_VERTEX_ARRAY);
 	glColor3f(1, 1, 1);
+	for(i=0; i<num_batches; i++) {
+		if(vbo) {
+			glVertexPointer(2, GL_FLOAT, 0, (void*)offs);
+			offs += batches[i].num_tri * 6 * sizeof(float);
+		} else {
+			glVertexPointer(2, GL_FLOAT, 0, batches[i].uv);
+		}
+		glDrawArrays(GL_TRIANGLES, 0, batches[i].num_tri * 3);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
 
-	for(i=0; i<(int)mesh->mNumFaces; i++) {
-		for(j=0; j<3; j++) {
-			int idx = mesh->mFaces[i].mIndices[j];
-			glVertex2f(uv[idx].x, uv[idx].y);
+	/* only a persistent context outlives this call, to read the mask back later */
+	if(!async || own_ctx || !gl_gen_buffers || start_readback(mask) == -1) {
+		res = read_mask(mask);
+	} else {
+		res = 0;
+	}
+
+	if(vbo) {
+		gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+		gl_delete_buffers(1, &vbo);
+	}
+	if(own_ctx) {
+		destroy_gl();
+	}
+	return res;
+}
+
+/* copy all the triangles into a single vertex buffer, and leave it bound.
+ * returns 0 if it can't be allocated.
+ */
+static unsigned int upload_batches(const struct swrast_batch *batches, int num_batches)
+{
+	int i;
+	unsigned int vbo;
+	size_t size = 0, offs = 0;
+
+	for(i=0; i<num_batches; i++) {
+		size += batches[i].num_tri * 6 * sizeof(float);
+	}
+	if(!size) return 0;
+
+	while(glGetError() != GL_NO_ERROR);
+
+	gl_gen_buffers(1, &vbo);
+	gl_bind_buffer(GL_ARRAY_BUFFER, vbo);
+	gl_buffer_data(GL_ARRAY_BUFFER, size, 0, GL_STATIC_DRAW);
+	if(glGetError() != GL_NO_ERROR) {
+		gl_bind_buffer(GL_ARRAY_BUFFER, 0);
+		gl_delete_buffers(1, &vbo);
+		return 0;
+	}
+
+	for(i=0; i<num_batches; i++) {
+		size_t bsize = batches[i].num_tri * 6 * sizeof(float);
+		gl_buffer_sub_data(GL_ARRAY_BUFFER, offs, bsize, batches[i].uv);
+		offs += bsize;
+	}
+	return vbo;
+}
+
+/* read back the single-channel coverage, waiting for the draw calls */
+static int read_mask(struct img_pixmap *mask)
+{
+	while(glGetError() != GL_NO_ERROR);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, mask->width, mask->height, GL_RED, GL_UNSIGNED_BYTE, mask->pixels);
+	return glGetError() == GL_NO_ERROR ? 0 : -1;
+}
+
+/* Queue the readback of the mask just drawn into a pixel buffer object, for
+ * finish_readback to map later. The copy runs behind the draw calls, and the
+ * next mask can be drawn into the framebuffer right away: the readback was
+ * issued first. If too many are pending, the oldest one is finished first.
+ */
+static int start_readback(struct img_pixmap *mask)
+{
+	unsigned int pbo;
+
+	if(num_pending >= MAX_PENDING && finish_readback(0) == -1) {
+		return -1;
+	}
+
+	while(glGetError() != GL_NO_ERROR);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	gl_gen_buffers(1, &pbo);
+	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, pbo);
+	gl_buffer_data(GL_PIXEL_PACK_BUFFER, (long)mask->width * mask->height, 0, GL_STREAM_READ);
+	glReadPixels(0, 0, mask->width, mask->height, GL_RED, GL_UNSIGNED_BYTE, 0);
+	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if(glGetError() != GL_NO_ERROR) {
+		gl_delete_buffers(1, &pbo);
+		return -1;
+	}
+	pending[num_pending].mask = mask;
+	pending[num_pending++].pbo = pbo;
+	return 0;
+}
+
+/* wait for pending readback idx, and copy it into its mask */
+static int finish_readback(int idx)
+{
+	int res = -1;
+	void *ptr;
+	struct pending *p = pending + idx;
+
+	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, p->pbo);
+	if((ptr = gl_map_buffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY))) {
+		memcpy(p->mask->pixels, ptr, (size_t)p->mask->width * p->mask->height);
+		gl_unmap_buffer(GL_PIXEL_PACK_BUFFER);
+		res = 0;
+	} else {
+		fprintf(stderr, "failed to read back the mask\n");
+	}
+	gl_bind_buffer(GL_PIXEL_PACK_BUFFER, 0);
+	gl_delete_buffers(1, &p->pbo);
+
+	memmove(p, p + 1, (--num_pending - idx) * sizeof *p);
+	return res;
+}
+
+/* the entry points are looked up again for every context */
+static int load_buffer_funcs(void)
+{
+	gl_gen_buffers = (PFNGLGENBUFFERSPROC)gl_proc_address("glGenBuffers");
+	gl_delete_buffers = (PFNGLDELETEBUFFERSPROC)gl_proc_address("glDeleteBuffers");
+	gl_bind_buffer = (PFNGLBINDBUFFERPROC)gl_proc_address("glBindBuffer");
+	gl_buffer_data = (PFNGLBUFFERDATAPROC)gl_proc_address("glBufferData");
+	gl_buffer_sub_data = (PFNGLBUFFERSUBDATAPROC)gl_proc_address("glBufferSubData");
+	gl_map_buffer = (PFNGLMAPBUFFERPROC)gl_proc_address("glMapBuffer");
+	gl_unmap_buffer = (PFNGLUNMAPBUFFERPROC)gl_proc_address("glUnmapBuffer");
+
+	if(!gl_gen_buffers || !gl_delete_buffers || !gl_bind_buffer || !gl_buffer_data ||
+			!gl_buffer_sub_data || !gl_map_buffer || !gl_unmap_buffer) {
+		gl_gen_buffers = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int use_gl(void)
+{
+	switch(rast_mode) {
+	case MASK_RAST_GL:
+		return 1;
+	case MASK_RAST_SOFT:
+		return 0;
+	default:
+		break;
+	}
+
+	if(gl_avail == -1) {
+		gl_avail = gl_available();
+	}
+	return gl_avail;
+}
+
+/* init_gl, which in auto mode falls back to the software rasterizer for good
+ * if the context can't be created after all
+ */
+static int init_gl_auto(int xsz, int ysz)
+{
+	if(init_gl(xsz, ysz) == -1) {
+		if(rast_mode == MASK_RAST_AUTO) {
+			fprintf(stderr, "failed to initialize OpenGL, falling back to the software rasterizer\n");
+			gl_avail = 0;
+		} else {
+			fprintf(stderr, "failed to initialize OpenGL\n");
 		}
+		return -1;
 	}
-	glEnd();
+	return 0;
 }
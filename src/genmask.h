@@ -18,9 +18,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef GENMASK_H_
 #define GENMASK_H_
 
-struct aiScene;
+struct uvscene;
 struct img_pixmap;
 
+/* mask rasterizers */
+enum {
+	MASK_RAST_AUTO,		/* OpenGL if there's a display, software otherwise */
+	MASK_RAST_GL,
+	MASK_RAST_SOFT
+};
+
+/* UDIM tiles 1001 + u + 10 * v: u in [0, 10), and v in [0, UDIM_ROWS) */
+#define UDIM_ROWS	100
+
+/* the triangles of one UDIM tile, translated into the [0, 1] square, with V
+ * flipped like the rest of the imported scene
+ */
+struct udim_tile {
+	int udim;
+	int num_tri;
+	float *uv;			/* 3 vertices * 2 floats per triangle */
+};
+
+struct scene_texture {
+	char *name;			/* texture filename as it appears in the material */
+	int *meshes;		/* indices of the meshes using it */
+	int num_meshes;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,10 +55,69 @@ int mask_from_scene(struct img_pixmap *mask, int xsz, int ysz, const char *fname
 		int uvset, const char *filter);
 
 /* sub-parts of the mask generation routine */
-struct aiScene *load_scene(const char *fname);
-void free_scene(struct aiScene *scn);
-int gen_mask(struct img_pixmap *mask, int xsz, int ysz, struct aiScene *scn,
+struct uvscene *load_scene(const char *fname);
+void free_scene(struct uvscene *scn);
+/* cache the UV geometry of the scenes loaded from now on in dir, and use the
+ * cached copy when the same scene file is loaded again (see uvscene.h).
+ * Null disables the cache, which is the default.
+ */
+void set_scene_cache(const char *dir);
+int gen_mask(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
 		int uvset, const char *filter);
+/* like gen_mask, for an explicit list of mesh indices. Meshes without the
+ * requested UV set are skipped, instead of falling back to UV set 0.
+ */
+int gen_mask_meshes(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const int *meshes, int num_meshes);
+
+/* mask of an arbitrary array of triangles in [0, 1] (6 floats per triangle) */
+int gen_mask_tris(struct img_pixmap *mask, int xsz, int ysz, const float *uv, int num_tri);
+
+/* Bin the triangles of all meshes using filter (see gen_mask) by UDIM tile,
+ * in a single pass over the scene. Each triangle goes to every tile its UV
+ * bounding box overlaps, and the rasterizer clips it to each of them, so
+ * triangles straddling tiles cover their part of all of them. Returns the
+ * number of non-empty tiles, in ascending UDIM order, or -1 on failure.
+ */
+int scene_udim_tiles(struct uvscene *scn, int uvset, const char *filter, struct udim_tile **tilesptr);
+void free_udim_tiles(struct udim_tile *tiles, int count);
+
+/* select the mask rasterizer (see enum above). The software rasterizer uses
+ * the same top-left fill rule and texel center sample positions as OpenGL,
+ * but texels on chart edges which aren't shared by another triangle may still
+ * differ from a given driver. It needs neither a display nor OpenGL.
+ */
+void set_mask_rasterizer(int rast);
+
+/* keep a single rendering context alive across multiple gen_mask calls, for
+ * masks up to max_xsz x max_ysz; larger masks fail until it's recreated
+ * larger. Without it, every call creates its own. The context is current on
+ * the calling thread, and all the calls up to end_gen_mask must come from it.
+ */
+int begin_gen_mask(int max_xsz, int max_ysz);
+void end_gen_mask(void);
+
+/* Pipelined gen_mask_tris and gen_mask_meshes, for generating many masks
+ * between begin_gen_mask and end_gen_mask: the mask is drawn, and its readback
+ * is queued behind the draw calls, but its pixels are only there once
+ * gen_mask_end(mask) returns. Drawing the next mask before ending the previous
+ * one overlaps the readback of one with the drawing of the other. With the
+ * software rasterizer, or without a persistent context, the mask is done
+ * right away, and gen_mask_end does nothing.
+ */
+int gen_mask_tris_begin(struct img_pixmap *mask, int xsz, int ysz, const float *uv, int num_tri);
+int gen_mask_meshes_begin(struct img_pixmap *mask, int xsz, int ysz, struct uvscene *scn,
+		int uvset, const int *meshes, int num_meshes);
+int gen_mask_end(struct img_pixmap *mask);
+
+/* scene texture index: every texture referenced by the scene materials, and
+ * the meshes using it. Returns the number of textures, or -1 on failure.
+ */
+int scene_textures(struct uvscene *scn, struct scene_texture **texptr);
+void free_scene_textures(struct scene_texture *tex, int count);
+
+/* number of UV sets of the mesh with the most */
+int scene_num_uvsets(struct uvscene *scn);
 
 #ifdef __cplusplus
 }
@@ -18,7 +18,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef GLCTX_H_
 #define GLCTX_H_
 
+typedef void (*gl_proc_func)(void);
+
 int init_gl(int xsz, int ysz);
 void destroy_gl(void);
 
+/* non-zero if init_gl has a chance to succeed (there's a display to connect to) */
+int gl_available(void);
+
+/* OpenGL extension entry point lookup, valid while the context is current */
+gl_proc_func gl_proc_address(const char *name);
+
 #endif	/* GLCTX_H_ */
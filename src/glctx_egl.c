@@ -0,0 +1,149 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef USE_EGL
+#include <stdio.h>
+#include <string.h>
+#define GL_GLEXT_PROTOTYPES 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include "glctx.h"
+
+/* Headless OpenGL through EGL, without any window system. Prefers Mesa's
+ * surfaceless platform, which also works with the llvmpipe software driver on
+ * machines without a GPU, and renders into a single-channel renderbuffer.
+ */
+
+static EGLDisplay open_display(void);
+
+static EGLDisplay dpy = EGL_NO_DISPLAY;
+static EGLContext ctx = EGL_NO_CONTEXT;
+static unsigned int fbo, rbuf;
+
+int init_gl(int xsz, int ysz)
+{
+	EGLConfig cfg;
+	EGLint num_cfg;
+	static const EGLint cfgattr[] = {
+		EGL_SURFACE_TYPE, 0,	/* the default would ask for window surfaces */
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	if((dpy = open_display()) == EGL_NO_DISPLAY) {
+		fprintf(stderr, "init_gl: failed to initialize EGL\n");
+		return -1;
+	}
+
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "init_gl: EGL implementation doesn't support desktop OpenGL\n");
+		goto err;
+	}
+	if(!eglChooseConfig(dpy, cfgattr, &cfg, 1, &num_cfg) || num_cfg < 1) {
+		fprintf(stderr, "init_gl: no matching EGL config\n");
+		goto err;
+	}
+	if((ctx = eglCreateContext(dpy, cfg, EGL_NO_CONTEXT, 0)) == EGL_NO_CONTEXT) {
+		fprintf(stderr, "init_gl: failed to create OpenGL context\n");
+		goto err;
+	}
+	/* no surface at all, everything is drawn into the framebuffer object */
+	if(!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+		fprintf(stderr, "init_gl: surfaceless contexts not supported\n");
+		goto err;
+	}
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	glGenRenderbuffers(1, &rbuf);
+	glBindRenderbuffer(GL_RENDERBUFFER, rbuf);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_R8, xsz, ysz);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbuf);
+
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "init_gl: incomplete %dx%d framebuffer\n", xsz, ysz);
+		goto err;
+	}
+
+	glViewport(0, 0, xsz, ysz);
+	return 0;
+
+err:
+	destroy_gl();
+	return -1;
+}
+
+void destroy_gl(void)
+{
+	if(dpy == EGL_NO_DISPLAY) return;
+
+	if(ctx != EGL_NO_CONTEXT) {
+		if(fbo) {
+			glDeleteFramebuffers(1, &fbo);
+			glDeleteRenderbuffers(1, &rbuf);
+			fbo = rbuf = 0;
+		}
+		eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(dpy, ctx);
+		ctx = EGL_NO_CONTEXT;
+	}
+	eglTerminate(dpy);
+	dpy = EGL_NO_DISPLAY;
+}
+
+int gl_available(void)
+{
+	EGLDisplay tmp;
+
+	if((tmp = open_display()) == EGL_NO_DISPLAY) {
+		return 0;
+	}
+	eglTerminate(tmp);
+	return 1;
+}
+
+gl_proc_func gl_proc_address(const char *name)
+{
+	return (gl_proc_func)eglGetProcAddress(name);
+}
+
+static EGLDisplay open_display(void)
+{
+	EGLDisplay res = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+	if(ext && strstr(ext, "EGL_MESA_platform_surfaceless")) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+		get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(get_platform_display) {
+			res = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+		}
+	}
+#endif
+	if(res == EGL_NO_DISPLAY) {
+		res = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	if(res == EGL_NO_DISPLAY || !eglInitialize(res, 0, 0)) {
+		return EGL_NO_DISPLAY;
+	}
+	return res;
+}
+#endif	/* USE_EGL */
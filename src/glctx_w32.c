@@ -119,6 +119,16 @@ void destroy_gl(void)
 	}
 }
 
+int gl_available(void)
+{
+	return 1;
+}
+
+gl_proc_func gl_proc_address(const char *name)
+{
+	return (gl_proc_func)wglGetProcAddress(name);
+}
+
 static LRESULT CALLBACK handle_event(HWND win, unsigned int msg, WPARAM wparam, LPARAM lparam)
 {
 	return DefWindowProc(win, msg, wparam, lparam);
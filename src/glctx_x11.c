@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include <GL/glext.h>
+#include "glctx.h"
 
 static Display *dpy;
 static Window win;
@@ -102,4 +103,23 @@ void destroy_gl(void)
 		dpy = 0;
 	}
 }
+
+/* a display, which also has the GLX extension */
+int gl_available(void)
+{
+	Display *tmp;
+	int glx, evbase, errbase;
+
+	if(!(tmp = XOpenDisplay(0))) {
+		return 0;
+	}
+	glx = glXQueryExtension(tmp, &errbase, &evbase);
+	XCloseDisplay(tmp);
+	return glx ? 1 : 0;
+}
+
+gl_proc_func gl_proc_address(const char *name)
+{
+	return (gl_proc_func)glXGetProcAddress((const GLubyte*)name);
+}
 #endif	/* USE_GLX */
@@ -0,0 +1,108 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+#define FILE_BUF_SIZE	65536
+
+static uint64_t mix_word(uint64_t hash, uint64_t word);
+static uint64_t fmix64(uint64_t x);
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *ptr = data;
+	uint64_t word;
+	size_t i;
+
+	while(size >= sizeof word) {
+		memcpy(&word, ptr, sizeof word);
+		hash = mix_word(hash, word);
+		ptr += sizeof word;
+		size -= sizeof word;
+	}
+	if(size > 0) {
+		/* the tail bytes, with their count in the top byte, which they never reach */
+		word = (uint64_t)size << 56;
+		for(i=0; i<size; i++) {
+			word |= (uint64_t)ptr[i] << (i * 8);
+		}
+		hash = mix_word(hash, word);
+	}
+	return hash;
+}
+
+int hash_file(uint64_t *hash, const char *fname)
+{
+	FILE *fp;
+	size_t sz;
+	char *buf;
+	int err;
+	struct stat st;
+	uint64_t fsize;
+
+	if(!(fp = fopen(fname, "rb"))) {
+		return -1;
+	}
+	/* the size goes first, so that consecutive files can't hash the same as
+	 * another pair, split at a different point
+	 */
+	if(fstat(fileno(fp), &st) == -1) {
+		fclose(fp);
+		return -1;
+	}
+	fsize = (uint64_t)st.st_size;
+	*hash = hash_bytes(*hash, &fsize, sizeof fsize);
+
+	if(!(buf = malloc(FILE_BUF_SIZE))) {
+		fclose(fp);
+		return -1;
+	}
+	while((sz = fread(buf, 1, FILE_BUF_SIZE, fp)) > 0) {
+		*hash = hash_bytes(*hash, buf, sz);
+	}
+	err = ferror(fp);
+	fclose(fp);
+	free(buf);
+	return err ? -1 : 0;
+}
+
+/* every word goes through the full 64bit finalizer before it's combined, so
+ * that flipping a few bits of one word can't be cancelled by flipping a fixed
+ * pattern of bits in the next one
+ */
+static uint64_t mix_word(uint64_t hash, uint64_t word)
+{
+	hash ^= fmix64(word);
+	hash = (hash << 27) | (hash >> 37);
+	return hash * 5 + 0x52dce729;
+}
+
+/* the 64bit finalizer of MurmurHash3 */
+static uint64_t fmix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
@@ -0,0 +1,47 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HASH_INIT	0xcbf29ce484222325ull
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 64bit non-cryptographic hash, in the style of MurmurHash3: every 64bit word
+ * is mixed by the MurmurHash3 finalizer, and then folded into the hash (the
+ * tail is packed into a last word, along with its length). Not for
+ * cryptographic use. Pass HASH_INIT, or the result of a previous call to
+ * continue hashing more data.
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+
+/* continue hashing with the size and contents of a file, returns -1 if it
+ * can't be read
+ */
+int hash_file(uint64_t *hash, const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* HASH_H_ */
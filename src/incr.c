@@ -0,0 +1,204 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <imago2.h>
+#include "incr.h"
+#include "expand.h"
+#include "bitmask.h"
+#include "hash.h"
+
+static void hash_tiles(uint64_t *hash, struct img_pixmap *img);
+
+int incr_deps_init(struct incr_deps *deps, const int *nearest, int width, int height)
+{
+	int i, j, num_tiles;
+
+	deps->width = width;
+	deps->height = height;
+	deps->xtiles = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+	deps->ytiles = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+	num_tiles = deps->xtiles * deps->ytiles;
+
+	if(!(deps->rect = malloc(num_tiles * 4 * sizeof *deps->rect))) {
+		fprintf(stderr, "failed to allocate tile dependency rectangles\n");
+		return -1;
+	}
+	for(i=0; i<num_tiles; i++) {
+		int *rect = deps->rect + i * 4;
+		rect[0] = rect[1] = INT_MAX;
+		rect[2] = rect[3] = -1;
+	}
+
+	for(i=0; i<height; i++) {
+		for(j=0; j<width; j++) {
+			int *rect, idx = nearest[i * width + j];
+
+			if(idx < 0 || idx == i * width + j) continue;
+
+			rect = deps->rect + (((idx / width) >> TILE_SHIFT) * deps->xtiles +
+					((idx % width) >> TILE_SHIFT)) * 4;
+			if(j < rect[0]) rect[0] = j;
+			if(i < rect[1]) rect[1] = i;
+			if(j > rect[2]) rect[2] = j;
+			if(i > rect[3]) rect[3] = i;
+		}
+	}
+	return 0;
+}
+
+void incr_deps_destroy(struct incr_deps *deps)
+{
+	free(deps->rect);
+	deps->rect = 0;
+}
+
+int incr_hash_tiles(uint64_t **hash, struct img_pixmap *img)
+{
+	int xtiles = (img->width + TILE_SIZE - 1) >> TILE_SHIFT;
+	int ytiles = (img->height + TILE_SIZE - 1) >> TILE_SHIFT;
+
+	if(!*hash && !(*hash = malloc(xtiles * ytiles * sizeof **hash))) {
+		fprintf(stderr, "failed to allocate tile hashes\n");
+		return -1;
+	}
+	hash_tiles(*hash, img);
+	return 0;
+}
+
+int incr_update(struct img_pixmap *res, struct img_pixmap *img, const int *nearest,
+		const struct incr_deps *deps, uint64_t *hash)
+{
+	int i, num_dirty = 0, fail = 0;
+	int width = img->width, num_tiles = deps->xtiles * deps->ytiles;
+	int *dirty_list = 0;
+	unsigned char *dirty = 0;
+	uint64_t *newhash = 0;
+
+	if(res->fmt != img->fmt || res->width != deps->width || res->height != deps->height ||
+			img->width != deps->width || img->height != deps->height) {
+		fprintf(stderr, "incr_update: texture format or dimensions changed\n");
+		return -1;
+	}
+
+	if(!(newhash = malloc(num_tiles * sizeof *newhash)) || !(dirty = malloc(num_tiles)) ||
+			!(dirty_list = malloc(num_tiles * sizeof *dirty_list))) {
+		fprintf(stderr, "incr_update: failed to allocate memory\n");
+		free(newhash);
+		free(dirty);
+		return -1;
+	}
+
+	hash_tiles(newhash, img);
+	for(i=0; i<num_tiles; i++) {
+		if((dirty[i] = newhash[i] != hash[i])) {
+			dirty_list[num_dirty++] = i;
+			hash[i] = newhash[i];
+		}
+	}
+
+#pragma omp parallel
+	{
+		int *rowbuf = malloc(width * sizeof *rowbuf);
+
+		if(!rowbuf) {
+#pragma omp atomic write
+			fail = 1;
+		}
+
+		/* changed tiles are replaced by the new texels, and re-expanded */
+#pragma omp for schedule(dynamic)
+		for(i=0; i<num_dirty; i++) {
+			int j, x0, y0, x1, y1;
+
+			x0 = (dirty_list[i] % deps->xtiles) << TILE_SHIFT;
+			y0 = (dirty_list[i] / deps->xtiles) << TILE_SHIFT;
+			x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+			y1 = y0 + TILE_SIZE < img->height ? y0 + TILE_SIZE : img->height;
+
+			for(j=y0; j<y1; j++) {
+				int offs = j * width + x0;
+				memcpy((char*)res->pixels + (size_t)offs * img->pixelsz,
+						(char*)img->pixels + (size_t)offs * img->pixelsz, (x1 - x0) * img->pixelsz);
+				expand_nearest_span(res, img, nearest + offs, offs, x1 - x0);
+			}
+		}
+
+		/* texels of unchanged tiles, expanded from a changed one. Every texel
+		 * has a single source tile, so no two iterations write the same texel.
+		 */
+#pragma omp for schedule(dynamic)
+		for(i=0; i<num_dirty; i++) {
+			int j, k, tile = dirty_list[i];
+			const int *rect = deps->rect + tile * 4;
+
+			if(!rowbuf || rect[0] > rect[2]) continue;
+
+			for(j=rect[1]; j<=rect[3]; j++) {
+				for(k=rect[0]; k<=rect[2]; k++) {
+					int idx = nearest[j * width + k];
+
+					rowbuf[k - rect[0]] = -1;
+					if(idx < 0 || dirty[(j >> TILE_SHIFT) * deps->xtiles + (k >> TILE_SHIFT)]) {
+						continue;
+					}
+					if(((idx / width) >> TILE_SHIFT) * deps->xtiles + ((idx % width) >> TILE_SHIFT) == tile) {
+						rowbuf[k - rect[0]] = idx;
+					}
+				}
+				expand_nearest_span(res, img, rowbuf, j * width + rect[0], rect[2] - rect[0] + 1);
+			}
+		}
+		free(rowbuf);
+	}
+
+	free(newhash);
+	free(dirty);
+	free(dirty_list);
+
+	if(fail) {
+		fprintf(stderr, "incr_update: failed to allocate row buffers\n");
+		return -1;
+	}
+	return num_dirty;
+}
+
+static void hash_tiles(uint64_t *hash, struct img_pixmap *img)
+{
+	int i, xtiles = (img->width + TILE_SIZE - 1) >> TILE_SHIFT;
+	int ytiles = (img->height + TILE_SIZE - 1) >> TILE_SHIFT;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<xtiles * ytiles; i++) {
+		int j, x0, y0, x1, y1;
+		uint64_t h = HASH_INIT;
+
+		x0 = (i % xtiles) << TILE_SHIFT;
+		y0 = (i / xtiles) << TILE_SHIFT;
+		x1 = x0 + TILE_SIZE < img->width ? x0 + TILE_SIZE : img->width;
+		y1 = y0 + TILE_SIZE < img->height ? y0 + TILE_SIZE : img->height;
+
+		for(j=y0; j<y1; j++) {
+			h = hash_bytes(h, (char*)img->pixels + ((size_t)j * img->width + x0) * img->pixelsz,
+					(x1 - x0) * img->pixelsz);
+		}
+		hash[i] = h;
+	}
+}
@@ -0,0 +1,58 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef INCR_H_
+#define INCR_H_
+
+#include <stdint.h>
+
+struct img_pixmap;
+
+/* For every tile (see TILE_SIZE in bitmask.h), the bounding rectangle of the
+ * texels expanded from masked texels in that tile. Derived from the nearest
+ * texel map, and valid for as long as the mask doesn't change.
+ */
+struct incr_deps {
+	int width, height;
+	int xtiles, ytiles;
+	int *rect;		/* x0, y0, x1, y1 (inclusive) per tile. x0 > x1 if none */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int incr_deps_init(struct incr_deps *deps, const int *nearest, int width, int height);
+void incr_deps_destroy(struct incr_deps *deps);
+
+/* hash every tile of the texture, allocating the hash array if *hash is null */
+int incr_hash_tiles(uint64_t **hash, struct img_pixmap *img);
+
+/* Incremental re-expansion: res is the expansion of the previous version of
+ * the texture, and hash its tile hashes. Only the tiles of img whose hash
+ * changed, and the texels expanded from them elsewhere, are updated in res,
+ * which ends up identical to a full expansion of img. hash is updated.
+ * Returns the number of changed tiles, or -1 on failure.
+ */
+int incr_update(struct img_pixmap *res, struct img_pixmap *img, const int *nearest,
+		const struct incr_deps *deps, uint64_t *hash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* INCR_H_ */
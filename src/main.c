@@ -21,14 +21,48 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <imago2.h>
 #include "genmask.h"
 #include "expand.h"
+#include "stream.h"
+#include "bitmask.h"
+#include "pullpush.h"
+#include "incr.h"
+#include "watch.h"
+#include "stats.h"
+#include "batch.h"
+#include "udim.h"
+#include "rawimg.h"
+#include "server.h"
+#include "rescache.h"
 
+#define USAGE_THRES		129	/* mask values counted as used by calc_usage */
+
+/* result cache state of each texture */
+enum { CACHE_NONE, CACHE_MISS, CACHE_HIT };
+
+static int load_texture(const char *fname);
+static void free_texture(void);
+static int make_mask(struct img_pixmap *mask, int width, int height);
+static int make_nearest(int **nearest, struct bitmask *bmask, struct img_pixmap *mask);
+static int watch_textures(struct img_pixmap *texout, uint64_t **hash, int *nearest, struct bitmask *bmask);
+static int expand_streaming(void);
+static int fetch_cached(void);
+static int run_batch(void);
+static int run_server(void);
+static int run_udim(void);
+static int scene_report(void);
+static const char *mask_filter(void);
 static int mask_from_alpha(struct img_pixmap *mask, struct img_pixmap *img);
+static int report_mask(struct img_pixmap *mask, const struct scene_texture *tex, int uvset,
+		const char *dir, char *path);
 static float calc_usage(struct img_pixmap *mask);
 static int parse_args(int argc, char **argv);
 static void print_progress(int percent);
+static void expand_progress_func(float done, void *cls);
+static void write_stats(void);
 
-const char *opt_out_fname = "out.png";
-const char *opt_tex_fname;
+const char **opt_out_fnames;	/* one output filename per input texture */
+int opt_num_out;
+const char **opt_tex_fnames;	/* input textures, all sharing the same mask */
+int opt_num_tex;
 const char *opt_scene_fname;
 const char *opt_mask_fname;
 int opt_uvset;		/* texture coordinate set to use */
@@ -38,56 +72,93 @@ int opt_maskalpha;	/* use alpha channel as usage mask */
 int opt_usage;		/* just print usage percentage */
 int opt_radius = -1;/* how much to expand (negative values signify infinite expansion) */
 int opt_silent;		/* don't print progress while expanding */
+int opt_alg;		/* expansion algorithm (see enum below) */
+long opt_membudget;	/* stream the expansion in bands which fit in this many bytes */
+int opt_report;		/* print the usage of every texture referenced by the scene */
+int opt_alluvsets;	/* report the usage for every UV set, instead of just opt_uvset */
+int opt_report_size = 1024;	/* mask size for textures which can't be found */
+int opt_watch;		/* keep running, and incrementally re-expand textures when they change */
+const char *opt_stats_fname;	/* write per-phase timing and memory statistics to this file */
+const char *opt_batch_fname;	/* run the jobs of this manifest */
+const char *opt_serve_path;		/* serve expansion requests on this unix socket */
+const char *opt_uvcache_dir;	/* cache the UV geometry of imported scenes in this directory */
+int opt_rast = MASK_RAST_AUTO;	/* mask rasterizer (see genmask.h) */
+int opt_udim;		/* the textures are UDIM tile sets, with <UDIM> in their filenames */
+const char *opt_cache_dir;	/* keep the expanded textures in this directory (see rescache.h) */
 
 static struct img_pixmap img;
+static struct raw_image rawtex;	/* mapping of img, if it's a raw texture */
+static uint64_t *cache_keys;	/* per texture, with -cache */
+static int *cache_state;
 
 int main(int argc, char **argv)
 {
-	struct img_pixmap mask, res;
+	int i;
+	struct img_pixmap mask;
+	struct bitmask bmask;
+	struct bitmask_tiles tiles;
+	int *nearest = 0;
+	struct img_pixmap *texout = 0;
+	uint64_t **hash = 0;
 
 	if(parse_args(argc, argv) == -1) {
 		return 1;
 	}
 
+	/* statistics are written on exit, whatever the exit path, so that a
+	 * failed run still shows where it failed
+	 */
+	if(opt_stats_fname) {
+		if(stats_init() == -1) {
+			return 1;
+		}
+		atexit(write_stats);
+	}
+	set_scene_cache(opt_uvcache_dir);
+	set_mask_rasterizer(opt_rast);
+
+	if(opt_report) {
+		return scene_report() == -1 ? 1 : 0;
+	}
+	if(opt_batch_fname) {
+		return run_batch() == 0 ? 0 : 1;
+	}
+	if(opt_serve_path) {
+		return run_server() == -1 ? 1 : 0;
+	}
+	if(opt_udim) {
+		return run_udim() == 0 ? 0 : 1;
+	}
+	if(opt_membudget > 0) {
+		return expand_streaming() == -1 ? 1 : 0;
+	}
+	if(opt_cache_dir && !opt_usage && !opt_genmask) {
+		int num_miss = fetch_cached();
+		if(num_miss <= 0) {
+			return num_miss == -1 ? 1 : 0;
+		}
+	}
+
 	img_init(&img);
 	img_init(&mask);
 
-	if(img_load(&img, opt_tex_fname) == -1 || img_convert(&img, IMG_FMT_RGBAF) == -1) {
-		fprintf(stderr, "failed to load image: %s\n", opt_tex_fname);
+	/* the first texture determines the mask dimensions, and its filename is
+	 * used for matching materials when generating the mask
+	 */
+	if(load_texture(opt_tex_fnames[0]) == -1) {
 		return 1;
 	}
 
-	if(opt_mask_fname) {
-		if(img_load(&mask, opt_mask_fname) == -1 || img_convert(&mask, IMG_FMT_GREY8)) {
-			fprintf(stderr, "failed to load mask file: %s\n", opt_mask_fname);
-			return 1;
-		}
-		if(img.width != mask.width || img.height != mask.height) {
-			fprintf(stderr, "texture (%s) and mask (%s) dimensions differ\n", opt_tex_fname, opt_mask_fname);
-			return 1;
-		}
-
-	} else if(opt_maskalpha) {
+	if(opt_maskalpha) {
 		if(!img_has_alpha(&img)) {
-			fprintf(stderr, "maskalpha requested, but %s doesn't have an alpha channel\n", opt_tex_fname);
+			fprintf(stderr, "maskalpha requested, but %s doesn't have an alpha channel\n", opt_tex_fnames[0]);
 			return 1;
 		}
 		if(mask_from_alpha(&mask, &img) == -1) {
 			return 1;
 		}
-
 	} else {
-		const char *filter = 0;
-		/* generate the mask from a mesh/scene file */
-		if(!opt_scene_fname) {
-			fprintf(stderr, "a mesh/scene file is required to generate the usage mask\n");
-			return 1;
-		}
-		if(!opt_force) {
-			char *ptr = strrchr(opt_tex_fname, '/');
-			filter = ptr ? ptr + 1 : opt_tex_fname;
-		}
-		if(mask_from_scene(&mask, img.width, img.height, opt_scene_fname, opt_uvset, filter) == -1) {
+		if(make_mask(&mask, img.width, img.height) == -1) {
 			return 1;
 		}
 	}
@@ -95,89 +166,759 @@ int main(int argc, char **argv)
 	if(opt_usage) {
 		/* calculate and print utilization */
 		float usage = calc_usage(&mask);
+		if(usage < 0.0f) {
+			return 1;
+		}
 		printf("%f\n", usage);
 		return 0;
 	}
 
 	if(opt_genmask) {
 		/* output the mask and exit */
-		if(img_save(&mask, opt_out_fname) == -1) {
-			fprintf(stderr, "failed to save mask file: %s\n", opt_out_fname);
+		if(save_image(&mask, opt_out_fnames[0]) == -1) {
+			fprintf(stderr, "failed to save mask file: %s\n", opt_out_fnames[0]);
 			return 1;
 		}
 		return 0;
 	}
 
-	img_init(&res);
-	if(img_copy(&res, &img) == -1) {
-		fprintf(stderr, "failed to allocate result image\n");
+	/* from here on only the packed 1 bit per texel mask is needed. The
+	 * nearest texel search runs once, and is then used to expand every
+	 * texture with a single gather pass
+	 */
+	if(opt_alg == ALG_EDT) {
+		if(make_nearest(&nearest, &bmask, &mask) == -1) {
+			return 1;
+		}
+	} else if(bitmask_from_img(&bmask, &mask, EXPAND_MASK_THRES) == -1) {
 		return 1;
 	}
+	img_destroy(&mask);
+
+	tiles.state = 0;
+	if(opt_alg == ALG_SEARCH) {
+		stats_begin("tiles", 0);
+		if(bitmask_tiles_init(&tiles, &bmask) == -1) {
+			return 1;
+		}
+		stats_end();
+	}
+
+	/* in watch mode, the expanded textures and the tile hashes of their
+	 * inputs are kept around, for incremental updates
+	 */
+	if(opt_watch) {
+		if(!(texout = malloc(opt_num_tex * sizeof *texout)) ||
+				!(hash = calloc(opt_num_tex, sizeof *hash))) {
+			fprintf(stderr, "failed to allocate memory\n");
+			return 1;
+		}
+	}
+
+	for(i=0; i<opt_num_tex; i++) {
+		/* the distance transform's gather finishes the rows in order, so PNG
+		 * outputs are encoded while the rest of the image is being expanded
+		 */
+		int encode = opt_alg == ALG_EDT && !opt_watch && is_png(opt_out_fnames[i]);
+		const char *outname = opt_out_fnames[i];
+		char *tmpname = 0;
+
+		if(cache_state && cache_state[i] == CACHE_HIT) {
+			continue;
+		}
+		/* cached outputs are written next to the output first (see rescache.h) */
+		if(cache_state && cache_state[i] == CACHE_MISS) {
+			if(!(tmpname = rescache_tmpname(opt_out_fnames[i]))) {
+				return 1;
+			}
+			outname = tmpname;
+		}
 
-	if(opt_silent) {
-		expand(&res, opt_radius, &img, &mask);
+		if(i > 0) {
+			if(load_texture(opt_tex_fnames[i]) == -1) {
+				return 1;
+			}
+			if(img.width != bmask.width || img.height != bmask.height) {
+				fprintf(stderr, "texture %s dimensions (%dx%d) differ from the mask (%dx%d)\n",
+						opt_tex_fnames[i], img.width, img.height, bmask.width, bmask.height);
+				return 1;
+			}
+		}
+		if(opt_watch && incr_hash_tiles(hash + i, &img) == -1) {
+			return 1;
+		}
+
+		/* expand in place: only unused texels are written, and those are
+		 * never the source of another texel
+		 */
+		stats_begin(encode ? "expand_save" : "expand", opt_tex_fnames[i]);
+		if(encode) {
+			if(expand_nearest_png(outname, &img, nearest) == -1) {
+				fprintf(stderr, "failed to write output file: %s\n", opt_out_fnames[i]);
+				if(tmpname) remove(tmpname);
+				return 1;
+			}
+		} else if(opt_alg == ALG_EDT) {
+			expand_nearest(&img, &img, nearest);
+		} else if(opt_alg == ALG_PULLPUSH) {
+			if(!opt_silent) {
+				printf("pull-push fill %dx%d ... ", img.width, img.height);
+				fflush(stdout);
+			}
+			if(expand_pullpush(&img, &bmask) == -1) {
+				return 1;
+			}
+			if(!opt_silent) {
+				printf("done\n");
+			}
+		} else {
+			struct expand_progress prog = {0};
+
+			if(!opt_silent) {
+				prog.func = expand_progress_func;
+				prog.cls = &img;
+				expand_progress_func(0.0f, &img);
+			}
+			if(expand_search_tiled(&img, opt_radius, &img, &bmask, &tiles, &prog) == -1) {
+				return 1;
+			}
+			if(!opt_silent) {
+				putchar('\n');
+			}
+		}
+		stats_end();
+
+		if(!encode) {
+			stats_begin("save", opt_out_fnames[i]);
+			if(save_image(&img, outname) == -1) {
+				fprintf(stderr, "failed to write output file: %s\n", opt_out_fnames[i]);
+				if(tmpname) remove(tmpname);
+				return 1;
+			}
+			stats_end();
+		}
+		if(tmpname) {
+			if(rescache_store(opt_cache_dir, cache_keys[i], tmpname, opt_out_fnames[i]) == -1) {
+				return 1;
+			}
+			free(tmpname);
+		}
+		if(!opt_silent && opt_num_tex > 1) {
+			printf("%s -> %s\n", opt_tex_fnames[i], opt_out_fnames[i]);
+		}
+
+		if(opt_watch) {
+			texout[i] = img;
+			img_init(&img);
+		}
+	}
+	free_texture();
+
+	if(opt_watch) {
+		return watch_textures(texout, hash, nearest, &bmask) == -1 ? 1 : 0;
+	}
+
+	free(nearest);
+	bitmask_tiles_destroy(&tiles);
+	bitmask_destroy(&bmask);
+	return 0;
+}
+
+/* Load a texture into img. Raw textures are mapped copy-on-write instead of
+ * read, so expanding them in place only copies the pages it writes to. Watch
+ * mode keeps the textures around, and reads them like any other.
+ */
+static int load_texture(const char *fname)
+{
+	free_texture();
+
+	stats_begin("load", fname);
+	if(!opt_watch && raw_is_raw(fname)) {
+		if(raw_map(&rawtex, &img, fname) == -1) {
+			return -1;
+		}
+	} else if(load_image(&img, fname) == -1) {
+		fprintf(stderr, "failed to load image: %s\n", fname);
+		return -1;
+	}
+	stats_end();
+	return 0;
+}
+
+static void free_texture(void)
+{
+	if(rawtex.data) {
+		raw_unmap(&rawtex);		/* img only points into the mapping */
 	} else {
-		int height = img.height;
-		int idx = 0;
-		while(idx < height) {
-			int ysz = height - idx;
-			if(ysz > 32) ysz = 32;
-			printf("expanding %dx%d: ", img.width, img.height);
-			print_progress(idx * 100 / height);
-			expand_scanlines(&res, idx, ysz, opt_radius, &img, &mask);
-			idx += ysz;
-		}
-		printf("expanding %dx%d: ", img.width, img.height);
-		print_progress(100);
-		putchar('\n');
-	}
-	if(img_save(&res, opt_out_fname) == -1) {
-		fprintf(stderr, "failed to write output file: %s\n", opt_out_fname);
-		return 1;
+		img_destroy(&img);
+	}
+	img_init(&img);
+}
+
+/* load the usage mask from the -mask file, or generate it from the -mesh scene */
+static int make_mask(struct img_pixmap *mask, int width, int height)
+{
+	int res;
+	struct uvscene *scn;
+
+	if(opt_mask_fname) {
+		stats_begin("load_mask", opt_mask_fname);
+		if(load_image(mask, opt_mask_fname) == -1) {
+			fprintf(stderr, "failed to load mask file: %s\n", opt_mask_fname);
+			return -1;
+		}
+		stats_end();
+		stats_begin("convert", opt_mask_fname);
+		if(img_convert(mask, IMG_FMT_GREY8) == -1) {
+			fprintf(stderr, "failed to convert mask file: %s\n", opt_mask_fname);
+			return -1;
+		}
+		stats_end();
+		if(mask->width != width || mask->height != height) {
+			fprintf(stderr, "texture (%s) and mask (%s) dimensions differ\n", opt_tex_fnames[0], opt_mask_fname);
+			return -1;
+		}
+		return 0;
+	}
+
+	if(!opt_scene_fname) {
+		fprintf(stderr, "a mesh/scene file is required to generate the usage mask\n");
+		return -1;
+	}
+
+	/* same as mask_from_scene, with the import and rasterization timed apart */
+	stats_begin("import", opt_scene_fname);
+	if(!(scn = load_scene(opt_scene_fname))) {
+		return -1;
+	}
+	stats_end();
+	stats_begin("rasterize", opt_scene_fname);
+	res = gen_mask(mask, width, height, scn, opt_uvset, mask_filter());
+	stats_end();
+	free_scene(scn);
+	return res;
+}
+
+/* pack the mask into bmask, and calculate its nearest texel map. *nearest is
+ * allocated if it's null
+ */
+static int make_nearest(int **nearest, struct bitmask *bmask, struct img_pixmap *mask)
+{
+	if(bitmask_from_img(bmask, mask, EXPAND_MASK_THRES) == -1) {
+		return -1;
+	}
+	if(!*nearest && !(*nearest = malloc(bmask->width * bmask->height * sizeof **nearest))) {
+		fprintf(stderr, "failed to allocate nearest texel map\n");
+		return -1;
+	}
+
+	if(!opt_silent) {
+		printf("calculating nearest texel map %dx%d ... ", bmask->width, bmask->height);
+		fflush(stdout);
+	}
+	stats_begin("nearest", 0);
+	if(calc_nearest(*nearest, opt_radius, bmask) == -1) {
+		return -1;
+	}
+	stats_end();
+	if(!opt_silent) {
+		printf("done\n");
+	}
+	return 0;
+}
+
+/* Watch the input textures, and the mask or scene file, for changes. Changed
+ * textures are re-expanded incrementally, only around the tiles which actually
+ * changed. A changed mask invalidates the nearest texel map, and then every
+ * texture is expanded from scratch.
+ */
+static int watch_textures(struct img_pixmap *texout, uint64_t **hash, int *nearest, struct bitmask *bmask)
+{
+	int i, j, num_changed, mask_id, res = -1;
+	int *changed = 0;
+	struct incr_deps deps;
+	struct img_pixmap tex, mask;
+
+	deps.rect = 0;
+	img_init(&tex);
+
+	if(watch_init() == -1) {
+		return -1;
+	}
+	if(!(changed = malloc((opt_num_tex + 1) * sizeof *changed))) {
+		fprintf(stderr, "failed to allocate memory\n");
+		goto end;
+	}
+	for(i=0; i<opt_num_tex; i++) {
+		if(watch_file(opt_tex_fnames[i]) == -1) {
+			goto end;
+		}
+	}
+	if((mask_id = watch_file(opt_mask_fname ? opt_mask_fname : opt_scene_fname)) == -1) {
+		goto end;
+	}
+	if(incr_deps_init(&deps, nearest, bmask->width, bmask->height) == -1) {
+		goto end;
+	}
+
+	if(!opt_silent) {
+		printf("watching for changes (interrupt to quit)\n");
+	}
+
+	while((num_changed = watch_wait(changed, opt_num_tex + 1)) != -1) {
+		int remask = 0;
+		int num_tiles = deps.xtiles * deps.ytiles;
+
+		for(i=0; i<num_changed; i++) {
+			if(changed[i] == mask_id) remask = 1;
+		}
+
+		if(remask) {
+			img_init(&mask);
+			if(make_mask(&mask, bmask->width, bmask->height) == -1) {
+				fprintf(stderr, "keeping the previous mask\n");
+				remask = 0;
+			} else {
+				bitmask_destroy(bmask);
+				incr_deps_destroy(&deps);
+				if(make_nearest(&nearest, bmask, &mask) == -1 ||
+						incr_deps_init(&deps, nearest, bmask->width, bmask->height) == -1) {
+					img_destroy(&mask);
+					goto end;
+				}
+			}
+			img_destroy(&mask);
+		}
+
+		for(i=0; i<opt_num_tex; i++) {
+			int count;
+
+			if(!remask) {
+				for(j=0; j<num_changed; j++) {
+					if(changed[j] == i) break;
+				}
+				if(j == num_changed) continue;
+			}
+
+			img_destroy(&tex);
+			img_init(&tex);
+			if(load_image(&tex, opt_tex_fnames[i]) == -1) {
+				fprintf(stderr, "failed to load image: %s\n", opt_tex_fnames[i]);
+				continue;
+			}
+			if(tex.width != bmask->width || tex.height != bmask->height) {
+				fprintf(stderr, "texture %s dimensions (%dx%d) differ from the mask (%dx%d)\n",
+						opt_tex_fnames[i], tex.width, tex.height, bmask->width, bmask->height);
+				continue;
+			}
+
+			if(remask || tex.fmt != texout[i].fmt) {
+				if(incr_hash_tiles(hash + i, &tex) == -1) {
+					goto end;
+				}
+				expand_nearest(&tex, &tex, nearest);
+				img_destroy(texout + i);
+				texout[i] = tex;
+				img_init(&tex);
+				count = num_tiles;
+			} else if((count = incr_update(texout + i, &tex, nearest, &deps, hash[i])) == -1) {
+				goto end;
+			}
+
+			if(!opt_silent) {
+				printf("%s: %d of %d tiles changed\n", opt_tex_fnames[i], count, num_tiles);
+			}
+			if(count && save_image(texout + i, opt_out_fnames[i]) == -1) {
+				fprintf(stderr, "failed to write output file: %s\n", opt_out_fnames[i]);
+			}
+		}
+	}
+
+end:
+	watch_cleanup();
+	img_destroy(&tex);
+	incr_deps_destroy(&deps);
+	free(changed);
+	return res;
+}
+
+/* out-of-core expansion: textures are never loaded whole, and only the band
+ * being expanded, plus radius rows around it, are kept in memory
+ */
+static int expand_streaming(void)
+{
+	int i, res, width, height;
+	struct img_pixmap mask;
+	struct bitmask bmask;
+
+	if(opt_alg != ALG_EDT) {
+		fprintf(stderr, "-membudget only supports the edt expansion algorithm\n");
+		return -1;
+	}
+	if(opt_radius <= 0) {
+		fprintf(stderr, "-membudget requires a finite expansion -radius\n");
+		return -1;
+	}
+	if(opt_usage || opt_genmask || opt_maskalpha) {
+		fprintf(stderr, "-membudget only applies to expansion with -mask or -mesh\n");
+		return -1;
+	}
+
+	bmask.bits = 0;
+	if(!opt_mask_fname) {
+		/* the generated mask is kept in memory packed to 1 bit per texel,
+		 * only the textures are streamed
+		 */
+		if(png_dimensions(opt_tex_fnames[0], &width, &height) == -1) {
+			return -1;
+		}
+		img_init(&mask);
+		if(make_mask(&mask, width, height) == -1) {
+			return -1;
+		}
+		res = bitmask_from_img(&bmask, &mask, EXPAND_MASK_THRES);
+		img_destroy(&mask);
+		if(res == -1) {
+			return -1;
+		}
+	}
+
+	for(i=0; i<opt_num_tex; i++) {
+		if(!opt_silent) {
+			printf("expanding %s -> %s (streaming) ... ", opt_tex_fnames[i], opt_out_fnames[i]);
+			fflush(stdout);
+		}
+		stats_begin("expand", opt_tex_fnames[i]);
+		if(expand_stream(opt_out_fnames[i], opt_tex_fnames[i], opt_mask_fname, &bmask,
+					opt_radius, opt_membudget) == -1) {
+			bitmask_destroy(&bmask);
+			return -1;
+		}
+		stats_end();
+		if(!opt_silent) {
+			printf("done\n");
+		}
 	}
+
+	bitmask_destroy(&bmask);
 	return 0;
 }
 
+/* Look up the output of every texture in the result cache. Returns the number
+ * of textures which still need to be expanded, or -1 on failure.
+ */
+static int fetch_cached(void)
+{
+	int i, num_miss = 0;
+	struct rescache_src src;
+
+	if(!(cache_keys = malloc(opt_num_tex * sizeof *cache_keys)) ||
+			!(cache_state = malloc(opt_num_tex * sizeof *cache_state))) {
+		fprintf(stderr, "failed to allocate memory\n");
+		return -1;
+	}
+
+	/* the same mask source precedence as the mask generation below */
+	memset(&src, 0, sizeof src);
+	if(opt_maskalpha) {
+		src.mask_fname = opt_tex_fnames[0];
+		src.alpha_mask = 1;
+	} else if(opt_mask_fname) {
+		src.mask_fname = opt_mask_fname;
+	} else {
+		src.scene_fname = opt_scene_fname;
+		src.uvset = opt_uvset;
+		src.filter = mask_filter();
+	}
+	src.radius = opt_radius;
+	src.alg = opt_alg;
+
+	stats_begin("cache", 0);
+	for(i=0; i<opt_num_tex; i++) {
+		src.tex_fname = opt_tex_fnames[i];
+		src.out_fname = opt_out_fnames[i];
+
+		/* inputs which can't be read fail later, when they're loaded */
+		if(rescache_key(cache_keys + i, &src) == -1) {
+			cache_state[i] = CACHE_NONE;
+			num_miss++;
+		} else if(rescache_fetch(opt_cache_dir, cache_keys[i], opt_out_fnames[i])) {
+			cache_state[i] = CACHE_HIT;
+			if(!opt_silent) {
+				printf("%s -> %s (cached)\n", opt_tex_fnames[i], opt_out_fnames[i]);
+			}
+		} else {
+			cache_state[i] = CACHE_MISS;
+			num_miss++;
+		}
+	}
+	stats_end();
+	return num_miss;
+}
+
+/* batch mode: the command line options are the defaults of every job */
+static int run_batch(void)
+{
+	struct batch_opt bopt;
+
+	bopt.scene_fname = opt_scene_fname;
+	bopt.mask_fname = opt_mask_fname;
+	bopt.uvset = opt_uvset;
+	bopt.radius = opt_radius;
+	bopt.alg = opt_alg;
+	bopt.force = opt_force;
+	bopt.silent = opt_silent;
+	bopt.cache_dir = opt_cache_dir;
+	return batch_run(opt_batch_fname, &bopt);
+}
+
+/* daemon mode: the command line options are the defaults of every request */
+static int run_server(void)
+{
+	struct batch_opt bopt;
+
+	bopt.scene_fname = opt_scene_fname;
+	bopt.mask_fname = opt_mask_fname;
+	bopt.uvset = opt_uvset;
+	bopt.radius = opt_radius;
+	bopt.alg = opt_alg;
+	bopt.force = opt_force;
+	bopt.silent = opt_silent;
+	bopt.cache_dir = opt_cache_dir;
+	return serve(opt_serve_path, &bopt);
+}
+
+static int run_udim(void)
+{
+	struct batch_opt bopt;
+
+	memset(&bopt, 0, sizeof bopt);
+	bopt.scene_fname = opt_scene_fname;
+	bopt.uvset = opt_uvset;
+	bopt.radius = opt_radius;
+	bopt.alg = opt_alg;
+	bopt.force = opt_force;
+	bopt.silent = opt_silent;
+	return udim_run(opt_tex_fnames, opt_out_fnames, opt_num_tex, &bopt);
+}
+
+/* Scene-wide coverage report: import the scene once, and rasterize the mask
+ * of every texture referenced by its materials (for one or all UV sets) with a
+ * single rendering context. Prints one line per texture and UV set:
+ * <usage> <uvset> <texture name>. With -genmask, the masks are also written
+ * to the -o directory, as <texture base name>_mask[_uv<n>].png.
+ */
+static int scene_report(void)
+{
+	int i, uvset, num_tex, num_uvsets, dirlen, max_xsz = 0, max_ysz = 0, res = -1;
+	int cur = 0, prev_tex = -1, prev_uvset = 0;
+	size_t pathlen = 0;
+	struct uvscene *scn;
+	struct scene_texture *tex = 0;
+	struct img_pixmap mask[2];
+	int *sizes = 0;
+	const char *dir = opt_num_out ? opt_out_fnames[0] : ".";
+	const char *ptr;
+	char *path = 0;
+
+	if(!(scn = load_scene(opt_scene_fname))) {
+		return -1;
+	}
+	if((num_tex = scene_textures(scn, &tex)) == -1) {
+		goto end;
+	}
+	num_uvsets = scene_num_uvsets(scn);
+
+	for(i=0; i<num_tex; i++) {
+		size_t len = strlen(tex[i].name);
+		if(len > pathlen) pathlen = len;
+	}
+	pathlen += strlen(opt_scene_fname) + strlen(dir) + 32;
+
+	if(!(path = malloc(pathlen)) || !(sizes = malloc(num_tex * 2 * sizeof *sizes))) {
+		fprintf(stderr, "failed to allocate memory\n");
+		goto end;
+	}
+
+	/* texture paths are relative to the scene file */
+	dirlen = (ptr = strrchr(opt_scene_fname, '/')) ? ptr + 1 - opt_scene_fname : 0;
+
+	for(i=0; i<num_tex; i++) {
+		int *sz = sizes + i * 2;
+		const char *name = tex[i].name;
+
+		if(name[0] == '/') {
+			strcpy(path, name);
+		} else {
+			sprintf(path, "%.*s%s", dirlen, opt_scene_fname, name);
+		}
+		if(image_size(path, sz, sz + 1) == -1) {
+			fprintf(stderr, "texture %s not found, using %dx%d for its mask\n", name,
+					opt_report_size, opt_report_size);
+			sz[0] = sz[1] = opt_report_size;
+		}
+		if(sz[0] > max_xsz) max_xsz = sz[0];
+		if(sz[1] > max_ysz) max_ysz = sz[1];
+	}
+
+	if(num_tex && begin_gen_mask(max_xsz, max_ysz) == -1) {
+		goto end;
+	}
+
+	img_init(mask);
+	img_init(mask + 1);
+
+	/* draw each mask before finishing the previous one, so that its readback
+	 * overlaps with the drawing
+	 */
+	for(i=0; i<num_tex; i++) {
+		int first_uvset = opt_alluvsets ? 0 : opt_uvset;
+		int last_uvset = opt_alluvsets ? num_uvsets - 1 : opt_uvset;
+
+		for(uvset=first_uvset; uvset<=last_uvset; uvset++) {
+			if(gen_mask_meshes_begin(mask + cur, sizes[i * 2], sizes[i * 2 + 1], scn, uvset,
+						tex[i].meshes, tex[i].num_meshes) == -1) {
+				goto end_gen;
+			}
+			if(prev_tex >= 0 && report_mask(mask + (cur ^ 1), tex + prev_tex, prev_uvset, dir, path) == -1) {
+				goto end_gen;
+			}
+			prev_tex = i;
+			prev_uvset = uvset;
+			cur ^= 1;
+		}
+	}
+	if(prev_tex >= 0 && report_mask(mask + (cur ^ 1), tex + prev_tex, prev_uvset, dir, path) == -1) {
+		goto end_gen;
+	}
+	res = 0;
+
+end_gen:
+	end_gen_mask();
+	img_destroy(mask);
+	img_destroy(mask + 1);
+end:
+	free(path);
+	free(sizes);
+	if(num_tex > 0) {
+		free_scene_textures(tex, num_tex);
+	}
+	free_scene(scn);
+	return res;
+}
+
+/* material texture filename filter for mask generation */
+static const char *mask_filter(void)
+{
+	const char *ptr;
+
+	if(opt_force) {
+		return 0;
+	}
+	ptr = strrchr(opt_tex_fnames[0], '/');
+	return ptr ? ptr + 1 : opt_tex_fnames[0];
+}
+
 static int mask_from_alpha(struct img_pixmap *mask, struct img_pixmap *img)
 {
 	return -1;	/* TODO */
 }
 
+/* wait for a mask of the scene report, and print (and optionally save) it */
+static int report_mask(struct img_pixmap *mask, const struct scene_texture *tex, int uvset,
+		const char *dir, char *path)
+{
+	float usage;
+	const char *base, *ptr;
+	char *suffix;
+
+	if(gen_mask_end(mask) == -1 || (usage = calc_usage(mask)) < 0.0f) {
+		return -1;
+	}
+	printf("%f %d %s\n", usage, uvset, tex->name);
+
+	if(opt_genmask) {
+		base = tex->name;
+		if((ptr = strrchr(base, '/'))) base = ptr + 1;
+		if((ptr = strrchr(base, '\\'))) base = ptr + 1;
+		sprintf(path, "%s/%s", dir, base);
+		if((suffix = strrchr(path, '.')) && suffix > path + strlen(dir) + 1) {
+			*suffix = 0;
+		}
+		if(opt_alluvsets) {
+			sprintf(path + strlen(path), "_mask_uv%d.png", uvset);
+		} else {
+			strcat(path, "_mask.png");
+		}
+		if(save_image(mask, path) == -1) {
+			fprintf(stderr, "failed to save mask file: %s\n", path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static float calc_usage(struct img_pixmap *mask)
 {
-	int i, area = mask->width * mask->height;
-	int count = 0;
-	unsigned char *pptr = mask->pixels;
+	long count, area = (long)mask->width * mask->height;
+	struct bitmask bmask;
 
 	if(!area) return 0.0f;
 
-	for(i=0; i<area; i++) {
-		if(*pptr++ > 128) ++count;
+	if(bitmask_from_img(&bmask, mask, USAGE_THRES) == -1) {
+		return -1.0f;
 	}
+	count = bitmask_count(&bmask);
+	bitmask_destroy(&bmask);
+
 	return (float)count / (float)area;
 }
 
 static void print_usage(const char *progname, FILE *fp)
 {
-	fprintf(fp, "Usage: %s [options] <texture file>\n", progname);
+	fprintf(fp, "Usage: %s [options] <texture file> [<texture file> ...]\n", progname);
 	fprintf(fp, "Options:\n");
-	fprintf(fp, "   -o <fname>: output filename\n");
+	fprintf(fp, "   -o <fname>: output filename (once per input texture, in the same order)\n");
 	fprintf(fp, "   -uvset <n>: which UV set to use for mask generation (default: 0)\n");
 	fprintf(fp, "   -radius <n>: maximum expansion radius in pixels\n");
+	fprintf(fp, "   -alg <edt|search|pullpush>: expansion algorithm (default: edt)\n");
+	fprintf(fp, "   -membudget <MB>: stream PNG textures through memory in bands (needs -radius)\n");
 	fprintf(fp, "   -force, -f: use all meshes in mask gen. without matching the texture filename\n");
 	fprintf(fp, "   -genmask: output the texture usage mask\n");
 	fprintf(fp, "   -mesh <fname>: use mesh/scene file for generating the texture usage mask\n");
 	fprintf(fp, "   -mask <fname>: use a mask file instead of generating it from geometry mesh\n");
 	fprintf(fp, "   -maskalpha: use alpha channel as the usage mask\n");
 	fprintf(fp, "   -usage, -u: calculate and print texture space utilization [0, 1]\n");
+	fprintf(fp, "   -report: print the utilization of every texture used by the -mesh scene\n");
+	fprintf(fp, "            (with -genmask, also write their masks to the -o directory)\n");
+	fprintf(fp, "   -alluvsets: report the utilization of every UV set, not just -uvset\n");
+	fprintf(fp, "   -size <n>: report mask size for textures which can't be found (default: 1024)\n");
+	fprintf(fp, "   -watch: keep running, and re-expand the textures incrementally when they change\n");
+	fprintf(fp, "   -rast <auto|gl|soft>: mask rasterizer (default: gl if there's a display)\n");
+	fprintf(fp, "   -uvcache <dir>: cache the UV geometry of imported scenes in dir, for later runs\n");
+	fprintf(fp, "   -udim: expand UDIM tile sets, with <UDIM> in the texture and -o filenames\n");
+	fprintf(fp, "   -cache <dir>: keep the expanded textures in dir, and reuse them while the\n");
+	fprintf(fp, "                 inputs and options stay the same\n");
+	fprintf(fp, "   -batch <fname>: run every job of a manifest (tex=, out=, mesh=, mask=, ...)\n");
+	fprintf(fp, "   -serve <socket>: run as a daemon, taking batch jobs on a unix domain socket\n");
+	fprintf(fp, "   -stats <fname>: write per-phase timing, memory and expansion statistics (JSON)\n");
 	fprintf(fp, "   -silent, -s: don't show progress, or other unnecessary info\n");
 	fprintf(fp, "   -help, -h: print usage information and exit\n");
 	fprintf(fp, " (exactly one of -mesh, -mask, or -maskalpha must be specified).\n");
+	fprintf(fp, "Multiple textures sharing the same mask can be expanded in one go. The mask is\n");
+	fprintf(fp, "generated or loaded once, matching materials against the first texture.\n");
 }
 
 static int parse_args(int argc, char **argv)
 {
 	int i;
+	static const char *def_out_fname = "out.png";
+
+	if(!(opt_tex_fnames = malloc(argc * sizeof *opt_tex_fnames)) ||
+			!(opt_out_fnames = malloc(argc * sizeof *opt_out_fnames))) {
+		perror("failed to allocate filename arrays");
+		return -1;
+	}
 
 	for(i=1; i<argc; i++) {
 		if(argv[i][0] == '-') {
@@ -186,7 +927,7 @@ static int parse_args(int argc, char **argv)
 					fprintf(stderr, "-o must be followed by the output filename\n");
 					return -1;
 				}
-				opt_out_fname = argv[i];
+				opt_out_fnames[opt_num_out++] = argv[i];
 
 			} else if(strcmp(argv[i], "-uvset") == 0) {
 				char *endp;
@@ -204,6 +945,30 @@ static int parse_args(int argc, char **argv)
 					return -1;
 				}
 
+			} else if(strcmp(argv[i], "-alg") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-alg must be followed by the algorithm name\n");
+					return -1;
+				}
+				if(strcmp(argv[i], "edt") == 0) {
+					opt_alg = ALG_EDT;
+				} else if(strcmp(argv[i], "search") == 0) {
+					opt_alg = ALG_SEARCH;
+				} else if(strcmp(argv[i], "pullpush") == 0) {
+					opt_alg = ALG_PULLPUSH;
+				} else {
+					fprintf(stderr, "invalid expansion algorithm: %s\n", argv[i]);
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-membudget") == 0) {
+				char *endp;
+				if(!argv[++i] || (opt_membudget = strtol(argv[i], &endp, 10)) <= 0 || *endp) {
+					fprintf(stderr, "-membudget must be followed by a positive size in megabytes\n");
+					return -1;
+				}
+				opt_membudget <<= 20;
+
 			} else if(strcmp(argv[i], "-force") == 0 || strcmp(argv[i], "-f") == 0) {
 				opt_force = 1;
 
@@ -230,6 +995,76 @@ static int parse_args(int argc, char **argv)
 			} else if(strcmp(argv[i], "-usage") == 0 || strcmp(argv[i], "-u") == 0) {
 				opt_usage = 1;
 
+			} else if(strcmp(argv[i], "-report") == 0) {
+				opt_report = 1;
+
+			} else if(strcmp(argv[i], "-alluvsets") == 0) {
+				opt_alluvsets = 1;
+
+			} else if(strcmp(argv[i], "-size") == 0) {
+				char *endp;
+				if(!argv[++i] || (opt_report_size = strtol(argv[i], &endp, 10)) <= 0 || *endp) {
+					fprintf(stderr, "-size must be followed by a positive number\n");
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-watch") == 0) {
+				opt_watch = 1;
+
+			} else if(strcmp(argv[i], "-rast") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-rast must be followed by auto, gl, or soft\n");
+					return -1;
+				}
+				if(strcmp(argv[i], "auto") == 0) {
+					opt_rast = MASK_RAST_AUTO;
+				} else if(strcmp(argv[i], "gl") == 0) {
+					opt_rast = MASK_RAST_GL;
+				} else if(strcmp(argv[i], "soft") == 0) {
+					opt_rast = MASK_RAST_SOFT;
+				} else {
+					fprintf(stderr, "invalid mask rasterizer: %s\n", argv[i]);
+					return -1;
+				}
+
+			} else if(strcmp(argv[i], "-uvcache") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-uvcache must be followed by a directory\n");
+					return -1;
+				}
+				opt_uvcache_dir = argv[i];
+
+			} else if(strcmp(argv[i], "-cache") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-cache must be followed by a directory\n");
+					return -1;
+				}
+				opt_cache_dir = argv[i];
+
+			} else if(strcmp(argv[i], "-udim") == 0) {
+				opt_udim = 1;
+
+			} else if(strcmp(argv[i], "-batch") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-batch must be followed by the manifest filename\n");
+					return -1;
+				}
+				opt_batch_fname = argv[i];
+
+			} else if(strcmp(argv[i], "-serve") == 0 || strcmp(argv[i], "--serve") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-serve must be followed by the socket path\n");
+					return -1;
+				}
+				opt_serve_path = argv[i];
+
+			} else if(strcmp(argv[i], "-stats") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-stats must be followed by a filename\n");
+					return -1;
+				}
+				opt_stats_fname = argv[i];
+
 			} else if(strcmp(argv[i], "-silent") == 0 || strcmp(argv[i], "-s") == 0) {
 				opt_silent = 1;
 
@@ -244,15 +1079,93 @@ static int parse_args(int argc, char **argv)
 			}
 
 		} else {
-			if(!opt_tex_fname) {
-				opt_tex_fname = argv[i];
+			opt_tex_fnames[opt_num_tex++] = argv[i];
+		}
+	}
 
-			} else {
-				fprintf(stderr, "unexpected argument: %s\n\n", argv[i]);
-				print_usage(argv[0], stderr);
+	if(opt_cache_dir && (opt_report || opt_watch || opt_membudget > 0 || opt_udim)) {
+		fprintf(stderr, "-cache doesn't apply to -report, -watch, -membudget, or -udim\n");
+		return -1;
+	}
+
+	if(opt_report) {
+		if(!opt_scene_fname) {
+			fprintf(stderr, "-report requires a -mesh scene file\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if(opt_serve_path) {
+		if(opt_num_tex || opt_num_out || opt_batch_fname || opt_udim) {
+			fprintf(stderr, "-serve takes the textures and outputs from the requests\n");
+			return -1;
+		}
+		if(opt_scene_fname && opt_mask_fname) {
+			fprintf(stderr, "-mesh and -mask are mutually exclusive\n");
+			return -1;
+		}
+		if(opt_usage || opt_genmask || opt_maskalpha || opt_watch || opt_membudget > 0) {
+			fprintf(stderr, "-serve only applies to in-memory expansion with -mask or -mesh\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if(opt_batch_fname) {
+		if(opt_num_tex || opt_num_out) {
+			fprintf(stderr, "-batch takes the textures and outputs from the manifest\n");
+			return -1;
+		}
+		if(opt_scene_fname && opt_mask_fname) {
+			fprintf(stderr, "-mesh and -mask are mutually exclusive\n");
+			return -1;
+		}
+		if(opt_usage || opt_genmask || opt_maskalpha || opt_watch || opt_membudget > 0) {
+			fprintf(stderr, "-batch only applies to in-memory expansion with -mask or -mesh\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if(!opt_num_tex) {
+		fprintf(stderr, "no input texture specified\n\n");
+		print_usage(argv[0], stderr);
+		return -1;
+	}
+
+	if(opt_udim) {
+		if(!opt_scene_fname || opt_mask_fname || opt_maskalpha) {
+			fprintf(stderr, "-udim generates the tile masks, and requires -mesh\n");
+			return -1;
+		}
+		if(opt_usage || opt_genmask || opt_watch || opt_membudget > 0) {
+			fprintf(stderr, "-udim only applies to in-memory expansion\n");
+			return -1;
+		}
+		if(opt_num_out != opt_num_tex) {
+			fprintf(stderr, "-udim requires an output filename (-o) for each input texture\n");
+			return -1;
+		}
+		for(i=0; i<opt_num_tex; i++) {
+			if(!strstr(opt_tex_fnames[i], UDIM_TOKEN) || !strstr(opt_out_fnames[i], UDIM_TOKEN)) {
+				fprintf(stderr, "-udim: %s in place of the tile number missing from: %s\n", UDIM_TOKEN,
+						strstr(opt_tex_fnames[i], UDIM_TOKEN) ? opt_out_fnames[i] : opt_tex_fnames[i]);
 				return -1;
 			}
 		}
+		return 0;
+	}
+	if(!opt_num_out) {
+		if(opt_num_tex > 1 && !opt_usage && !opt_genmask) {
+			fprintf(stderr, "an output filename (-o) is required for each input texture\n");
+			return -1;
+		}
+		opt_out_fnames[opt_num_out++] = def_out_fname;
+	}
+	if(opt_num_tex > 1 && opt_num_out != opt_num_tex && !opt_usage && !opt_genmask) {
+		fprintf(stderr, "%d input textures, but %d output filenames\n", opt_num_tex, opt_num_out);
+		return -1;
 	}
 
 	if(!opt_scene_fname && !opt_mask_fname && !opt_maskalpha) {
@@ -260,6 +1173,23 @@ static int parse_args(int argc, char **argv)
 		return -1;
 	}
 
+	if(opt_watch) {
+		if(opt_alg != ALG_EDT) {
+			fprintf(stderr, "-watch only supports the edt expansion algorithm\n");
+			return -1;
+		}
+		if(opt_usage || opt_genmask || opt_maskalpha || opt_membudget > 0) {
+			fprintf(stderr, "-watch only applies to in-memory expansion with -mask or -mesh\n");
+			return -1;
+		}
+		for(i=0; i<opt_num_tex; i++) {
+			if(strcmp(opt_tex_fnames[i], opt_out_fnames[i]) == 0) {
+				fprintf(stderr, "-watch can't overwrite its input texture: %s\n", opt_tex_fnames[i]);
+				return -1;
+			}
+		}
+	}
+
 	return 0;
 }
 
@@ -279,3 +1209,15 @@ static void print_progress(int percent)
 	printf("]\r");
 	fflush(stdout);
 }
+
+static void expand_progress_func(float done, void *cls)
+{
+	struct img_pixmap *img = cls;
+	printf("expanding %dx%d: ", img->width, img->height);
+	print_progress((int)(done * 100.0f));
+}
+
+static void write_stats(void)
+{
+	stats_write(opt_stats_fname);
+}
@@ -0,0 +1,201 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <imago2.h>
+#include "preview.h"
+#include "bitmask.h"
+
+#define MAX_CHAN	4
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static void quantize_floats(unsigned char *dest, const float *src, int count);
+
+int preview_downsample(struct img_pixmap *res, struct bitmask *resmask,
+		const struct img_pixmap *img, const struct bitmask *mask, int scale)
+{
+	int i, width, height, nchan, is_float;
+
+	switch(img->fmt) {
+	case IMG_FMT_GREY8:
+	case IMG_FMT_GREYF:
+		nchan = 1;
+		break;
+	case IMG_FMT_RGB24:
+	case IMG_FMT_RGBF:
+		nchan = 3;
+		break;
+	case IMG_FMT_RGBA32:
+	case IMG_FMT_RGBAF:
+		nchan = 4;
+		break;
+	default:
+		fprintf(stderr, "preview_downsample: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+	is_float = img->fmt == IMG_FMT_GREYF || img->fmt == IMG_FMT_RGBF || img->fmt == IMG_FMT_RGBAF;
+
+	width = (img->width + scale - 1) / scale;
+	height = (img->height + scale - 1) / scale;
+	if(img_set_pixels(res, width, height, img->fmt, 0) == -1) {
+		fprintf(stderr, "preview_downsample: failed to allocate %dx%d image\n", width, height);
+		return -1;
+	}
+	if(bitmask_init(resmask, width, height) == -1) {
+		return -1;
+	}
+
+	/* each thread writes whole rows of resmask, so the bit sets don't race */
+#pragma omp parallel for schedule(static)
+	for(i=0; i<height; i++) {
+		int j, x, y, c, x0, x1, y0, y1;
+
+		y0 = i * scale;
+		y1 = y0 + scale < img->height ? y0 + scale : img->height;
+
+		for(j=0; j<width; j++) {
+			float sum[MAX_CHAN] = {0}, sumall[MAX_CHAN] = {0};
+			float *dsum;
+			int nused = 0, nall = 0;
+
+			x0 = j * scale;
+			x1 = x0 + scale < img->width ? x0 + scale : img->width;
+
+			for(y=y0; y<y1; y++) {
+				for(x=x0; x<x1; x++) {
+					int used = BITMASK_GET(mask, x, y);
+					long offs = ((long)y * img->width + x) * nchan;
+
+					for(c=0; c<nchan; c++) {
+						float val = is_float ? ((float*)img->pixels)[offs + c] :
+							((unsigned char*)img->pixels)[offs + c];
+						sumall[c] += val;
+						if(used) sum[c] += val;
+					}
+					if(used) nused++;
+					nall++;
+				}
+			}
+
+			if(nused) {
+				BITMASK_SET(resmask, j, i);
+				dsum = sum;
+			} else {
+				dsum = sumall;
+				nused = nall;
+			}
+
+			if(is_float) {
+				float *dest = (float*)res->pixels + ((long)i * width + j) * nchan;
+				for(c=0; c<nchan; c++) dest[c] = dsum[c] / nused;
+			} else {
+				unsigned char *dest = (unsigned char*)res->pixels + ((long)i * width + j) * nchan;
+				for(c=0; c<nchan; c++) dest[c] = (unsigned char)(dsum[c] / nused + 0.5f);
+			}
+		}
+	}
+	return 0;
+}
+
+int preview_radius(int radius, int scale)
+{
+	if(radius <= 0) return radius;
+	return (radius + scale - 1) / scale;
+}
+
+int preview_quantize(unsigned char *dest, long pitch, const struct img_pixmap *img, int y, int count)
+{
+	int i, j, nchan;
+
+	switch(img->fmt) {
+	case IMG_FMT_GREY8:
+	case IMG_FMT_RGB24:
+	case IMG_FMT_RGBA32:
+		for(i=0; i<count; i++) {
+			memcpy(dest + i * pitch, (unsigned char*)img->pixels + (long)(y + i) * img->width * img->pixelsz,
+					img->width * img->pixelsz);
+		}
+		return 0;
+
+	case IMG_FMT_RGB565:
+		for(i=0; i<count; i++) {
+			unsigned char *drow = dest + i * pitch;
+			const unsigned short *src = (const unsigned short*)img->pixels + (long)(y + i) * img->width;
+			for(j=0; j<img->width; j++) {
+				unsigned int pix = *src++;
+				*drow++ = ((pix >> 11) & 0x1f) * 255 / 31;
+				*drow++ = ((pix >> 5) & 0x3f) * 255 / 63;
+				*drow++ = (pix & 0x1f) * 255 / 31;
+			}
+		}
+		return 0;
+
+	case IMG_FMT_GREYF:
+		nchan = 1;
+		break;
+	case IMG_FMT_RGBF:
+		nchan = 3;
+		break;
+	case IMG_FMT_RGBAF:
+		nchan = 4;
+		break;
+	default:
+		fprintf(stderr, "preview_quantize: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+
+	for(i=0; i<count; i++) {
+		quantize_floats(dest + i * pitch, (const float*)img->pixels + (long)(y + i) * img->width * nchan,
+				img->width * nchan);
+	}
+	return 0;
+}
+
+static void quantize_floats(unsigned char *dest, const float *src, int count)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	/* 16 values at a time: clamp, scale and round, then pack down to bytes */
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+
+	for(; i<=count - 16; i+=16) {
+		__m128i v[4], lo, hi;
+		int k;
+
+		for(k=0; k<4; k++) {
+			__m128 val = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + k * 4), zero), one);
+			v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(val, scale), half));
+		}
+		lo = _mm_packs_epi32(v[0], v[1]);
+		hi = _mm_packs_epi32(v[2], v[3]);
+		_mm_storeu_si128((__m128i*)(dest + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for(; i<count; i++) {
+		float val = src[i];
+		dest[i] = val <= 0.0f ? 0 : (val >= 1.0f ? 255 : (int)(val * 255.0f + 0.5f));
+	}
+}
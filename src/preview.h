@@ -0,0 +1,52 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PREVIEW_H_
+#define PREVIEW_H_
+
+struct img_pixmap;
+struct bitmask;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Downsample img and its mask by an integer factor, for quick low resolution
+ * previews of an expansion. Every scale x scale block of texels becomes one
+ * texel of res, which is used in resmask if any texel of the block is, and is
+ * the average of the used texels of the block, or of all of them if none are.
+ * res and resmask are (re)initialized to the ceil(width/scale) x
+ * ceil(height/scale) result.
+ */
+int preview_downsample(struct img_pixmap *res, struct bitmask *resmask,
+		const struct img_pixmap *img, const struct bitmask *mask, int scale);
+
+/* Convert count rows of img, starting at row y, to 8 bits per channel, for
+ * display: float formats are clamped to [0, 1], RGB565 is widened to RGB24,
+ * and the 8-bit formats are copied as they are. Rows are written to dest
+ * pitch bytes apart.
+ */
+int preview_quantize(unsigned char *dest, long pitch, const struct img_pixmap *img, int y, int count);
+
+/* expansion radius in texels of an image downsampled by scale */
+int preview_radius(int radius, int scale);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* PREVIEW_H_ */
@@ -0,0 +1,328 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <imago2.h>
+#include "pullpush.h"
+#include "bitmask.h"
+
+#define MAX_COLOR	3
+#define MAX_LEVELS	32	/* enough for any int image dimensions */
+
+/* pyramid level: coverage-weighted average color, and coverage clamped to 1 */
+struct level {
+	int width, height;
+	float *col;
+	float *weight;
+};
+
+/* layout of the supported pixel formats */
+struct pixfmt {
+	int nchan, ncolor;
+	int is_float;
+};
+
+static size_t pyramid_size(int width, int height, int ncolor);
+static int get_pixfmt(enum img_fmt fmt, struct pixfmt *pf);
+static void pull_image(struct level *lvl, struct img_pixmap *img, const struct bitmask *mask,
+		const struct pixfmt *pf);
+static void pull_level(struct level *lvl, const struct level *child, int ncolor);
+static void push_level(struct level *lvl, const struct level *parent, int ncolor);
+static void push_image(struct img_pixmap *img, const struct bitmask *mask,
+		const struct level *parent, const struct pixfmt *pf);
+static void sample_parent(float *res, const struct level *parent, int x, int y, int ncolor);
+
+int expand_pullpush(struct img_pixmap *img, const struct bitmask *mask)
+{
+	int res;
+	void *scratch;
+	struct pixfmt pf;
+
+	if(get_pixfmt(img->fmt, &pf) == -1) {
+		fprintf(stderr, "expand_pullpush: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+	if(!(scratch = malloc(pyramid_size(img->width, img->height, pf.ncolor) + 1))) {
+		fprintf(stderr, "expand_pullpush: failed to allocate image pyramid\n");
+		return -1;
+	}
+	res = expand_pullpush_buf(img, mask, scratch);
+	free(scratch);
+	return res;
+}
+
+size_t pullpush_scratch_size(int width, int height)
+{
+	return pyramid_size(width, height, MAX_COLOR);
+}
+
+int expand_pullpush_buf(struct img_pixmap *img, const struct bitmask *mask, void *scratch)
+{
+	int i, width, height, num_levels = 0;
+	struct level levels[MAX_LEVELS + 1];
+	float *ptr = scratch;
+	struct pixfmt pf;
+
+	if(get_pixfmt(img->fmt, &pf) == -1) {
+		fprintf(stderr, "expand_pullpush: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+
+	/* levels[0] is the image itself, the coarser levels are carved out of
+	 * the scratch space
+	 */
+	width = img->width;
+	height = img->height;
+	while(width > 1 || height > 1) {
+		struct level *lvl = levels + ++num_levels;
+		lvl->width = width = (width + 1) / 2;
+		lvl->height = height = (height + 1) / 2;
+		lvl->col = ptr;
+		ptr += width * height * pf.ncolor;
+		lvl->weight = ptr;
+		ptr += width * height;
+	}
+	if(!num_levels) return 0;
+
+	/* pull: coverage-weighted downsampling */
+	pull_image(levels + 1, img, mask, &pf);
+	for(i=2; i<=num_levels; i++) {
+		pull_level(levels + i, levels + i - 1, pf.ncolor);
+	}
+
+	/* push: fill the partially covered texels of each level from the one above */
+	for(i=num_levels-1; i>=1; i--) {
+		push_level(levels + i, levels + i + 1, pf.ncolor);
+	}
+	push_image(img, mask, levels + 1, &pf);
+	return 0;
+}
+
+/* size of the pyramid levels above a width x height image */
+static size_t pyramid_size(int width, int height, int ncolor)
+{
+	size_t size = 0;
+
+	while(width > 1 || height > 1) {
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		size += (size_t)width * height * (ncolor + 1) * sizeof(float);
+	}
+	return size;
+}
+
+static int get_pixfmt(enum img_fmt fmt, struct pixfmt *pf)
+{
+	switch(fmt) {
+	case IMG_FMT_GREY8:
+		pf->nchan = pf->ncolor = 1;
+		pf->is_float = 0;
+		break;
+	case IMG_FMT_RGB24:
+		pf->nchan = pf->ncolor = 3;
+		pf->is_float = 0;
+		break;
+	case IMG_FMT_RGBA32:
+		pf->nchan = 4;
+		pf->ncolor = 3;
+		pf->is_float = 0;
+		break;
+	case IMG_FMT_GREYF:
+		pf->nchan = pf->ncolor = 1;
+		pf->is_float = 1;
+		break;
+	case IMG_FMT_RGBF:
+		pf->nchan = pf->ncolor = 3;
+		pf->is_float = 1;
+		break;
+	case IMG_FMT_RGBAF:
+		pf->nchan = 4;
+		pf->ncolor = 3;
+		pf->is_float = 1;
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static void pull_image(struct level *lvl, struct img_pixmap *img, const struct bitmask *mask,
+		const struct pixfmt *pf)
+{
+	int i;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<lvl->height; i++) {
+		int j, k, sx, sy, c;
+		float *col = lvl->col + i * lvl->width * pf->ncolor;
+		float *weight = lvl->weight + i * lvl->width;
+
+		for(j=0; j<lvl->width; j++) {
+			float sum[MAX_COLOR] = {0};
+			float sumw = 0.0f;
+
+			for(k=0; k<4; k++) {
+				sx = j * 2 + (k & 1);
+				sy = i * 2 + (k >> 1);
+				if(sx >= img->width || sy >= img->height || !BITMASK_GET(mask, sx, sy)) {
+					continue;
+				}
+
+				if(pf->is_float) {
+					float *src = (float*)img->pixels + ((size_t)sy * img->width + sx) * pf->nchan;
+					for(c=0; c<pf->ncolor; c++) sum[c] += src[c];
+				} else {
+					unsigned char *src = (unsigned char*)img->pixels + ((size_t)sy * img->width + sx) * pf->nchan;
+					for(c=0; c<pf->ncolor; c++) sum[c] += src[c] / 255.0f;
+				}
+				sumw += 1.0f;
+			}
+
+			for(c=0; c<pf->ncolor; c++) {
+				*col++ = sumw > 0.0f ? sum[c] / sumw : 0.0f;
+			}
+			*weight++ = sumw > 1.0f ? 1.0f : sumw;
+		}
+	}
+}
+
+static void pull_level(struct level *lvl, const struct level *child, int ncolor)
+{
+	int i;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<lvl->height; i++) {
+		int j, k, sx, sy, c;
+		float *col = lvl->col + i * lvl->width * ncolor;
+		float *weight = lvl->weight + i * lvl->width;
+
+		for(j=0; j<lvl->width; j++) {
+			float sum[MAX_COLOR] = {0};
+			float sumw = 0.0f;
+
+			for(k=0; k<4; k++) {
+				int idx;
+				float w;
+
+				sx = j * 2 + (k & 1);
+				sy = i * 2 + (k >> 1);
+				if(sx >= child->width || sy >= child->height) continue;
+
+				idx = sy * child->width + sx;
+				if((w = child->weight[idx]) <= 0.0f) continue;
+
+				for(c=0; c<ncolor; c++) {
+					sum[c] += child->col[idx * ncolor + c] * w;
+				}
+				sumw += w;
+			}
+
+			for(c=0; c<ncolor; c++) {
+				*col++ = sumw > 0.0f ? sum[c] / sumw : 0.0f;
+			}
+			*weight++ = sumw > 1.0f ? 1.0f : sumw;
+		}
+	}
+}
+
+static void push_level(struct level *lvl, const struct level *parent, int ncolor)
+{
+	int i;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<lvl->height; i++) {
+		int j, c;
+		float *col = lvl->col + i * lvl->width * ncolor;
+		float *weight = lvl->weight + i * lvl->width;
+
+		for(j=0; j<lvl->width; j++) {
+			float w = weight[j];
+			if(w < 1.0f) {
+				float pcol[MAX_COLOR];
+				sample_parent(pcol, parent, j, i, ncolor);
+				for(c=0; c<ncolor; c++) {
+					col[c] = col[c] * w + pcol[c] * (1.0f - w);
+				}
+			}
+			col += ncolor;
+		}
+	}
+}
+
+static void push_image(struct img_pixmap *img, const struct bitmask *mask,
+		const struct level *parent, const struct pixfmt *pf)
+{
+	int i;
+
+#pragma omp parallel for schedule(static)
+	for(i=0; i<img->height; i++) {
+		int j, c;
+		float pcol[MAX_COLOR];
+
+		for(j=0; j<img->width; j++) {
+			if(BITMASK_GET(mask, j, i)) continue;
+
+			sample_parent(pcol, parent, j, i, pf->ncolor);
+
+			if(pf->is_float) {
+				float *dest = (float*)img->pixels + ((size_t)i * img->width + j) * pf->nchan;
+				for(c=0; c<pf->ncolor; c++) dest[c] = pcol[c];
+			} else {
+				unsigned char *dest = (unsigned char*)img->pixels + ((size_t)i * img->width + j) * pf->nchan;
+				for(c=0; c<pf->ncolor; c++) {
+					int val = (int)(pcol[c] * 255.0f + 0.5f);
+					dest[c] = val < 0 ? 0 : (val > 255 ? 255 : val);
+				}
+			}
+		}
+	}
+}
+
+/* bilinear interpolation of the parent level at the center of texel x,y of
+ * the level below it
+ */
+static void sample_parent(float *res, const struct level *parent, int x, int y, int ncolor)
+{
+	int c, x0, y0, x1, y1;
+	float fx, fy, tx, ty;
+	const float *c00, *c01, *c10, *c11;
+
+	fx = x * 0.5f - 0.25f;
+	fy = y * 0.5f - 0.25f;
+	x0 = (int)floor(fx);
+	y0 = (int)floor(fy);
+	tx = fx - x0;
+	ty = fy - y0;
+
+	x1 = x0 + 1 < parent->width ? x0 + 1 : parent->width - 1;
+	y1 = y0 + 1 < parent->height ? y0 + 1 : parent->height - 1;
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+
+	c00 = parent->col + (y0 * parent->width + x0) * ncolor;
+	c01 = parent->col + (y0 * parent->width + x1) * ncolor;
+	c10 = parent->col + (y1 * parent->width + x0) * ncolor;
+	c11 = parent->col + (y1 * parent->width + x1) * ncolor;
+
+	for(c=0; c<ncolor; c++) {
+		float top = c00[c] + (c01[c] - c00[c]) * tx;
+		float bot = c10[c] + (c11[c] - c10[c]) * tx;
+		res[c] = top + (bot - top) * ty;
+	}
+}
@@ -0,0 +1,48 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PULLPUSH_H_
+#define PULLPUSH_H_
+
+#include <stddef.h>
+
+struct img_pixmap;
+struct bitmask;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hierarchical pull-push fill, in place. Instead of copying the nearest used
+ * texel, every unused texel gets a smooth coverage-weighted average of the
+ * used texels around it: a pyramid of coverage-weighted averages is built
+ * bottom-up (pull), and the coarser levels are then interpolated back down
+ * into the empty texels of the finer ones (push). Always fills the whole
+ * image, in time linear to the number of texels. Alpha is left untouched.
+ */
+int expand_pullpush(struct img_pixmap *img, const struct bitmask *mask);
+/* the same, with the image pyramid in caller-owned scratch space of at least
+ * pullpush_scratch_size(width, height) bytes, suitably aligned for floats
+ */
+int expand_pullpush_buf(struct img_pixmap *img, const struct bitmask *mask, void *scratch);
+size_t pullpush_scratch_size(int width, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* PULLPUSH_H_ */
@@ -0,0 +1,352 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <imago2.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+#include "rawimg.h"
+
+#define RAW_MAGIC		"TXRAWIM"
+#define RAW_VERSION		1
+#define BYTE_ORDER_MARK	0x01020304
+
+struct raw_header {
+	char magic[8];
+	uint32_t version, byte_order;
+	uint32_t width, height;
+	uint32_t fmt;			/* enum img_fmt */
+	uint32_t pixel_size;
+	uint64_t data_offset;	/* RAW_HDR_SIZE */
+	uint64_t data_size;
+};
+
+static int init_header(struct raw_header *hdr, struct img_pixmap *img);
+static int check_header(const struct raw_header *hdr, uint64_t file_size, const char *fname);
+static int pixel_size(int fmt);
+
+int raw_is_raw(const char *fname)
+{
+	const char *suffix = strrchr(fname, '.');
+	return suffix && strcasecmp(suffix, ".raw") == 0;
+}
+
+int raw_map(struct raw_image *raw, struct img_pixmap *img, const char *fname)
+{
+	const struct raw_header *hdr;
+#ifdef USE_MMAP
+	int fd;
+	struct stat st;
+
+	if((fd = open(fname, O_RDONLY)) == -1) {
+		fprintf(stderr, "failed to open raw image: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size < RAW_HDR_SIZE) {
+		fprintf(stderr, "invalid raw image: %s\n", fname);
+		close(fd);
+		return -1;
+	}
+	raw->size = st.st_size;
+	raw->data = mmap(0, raw->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(raw->data == MAP_FAILED) {
+		fprintf(stderr, "failed to map raw image: %s: %s\n", fname, strerror(errno));
+		raw->data = 0;
+		return -1;
+	}
+	raw->mapped = 1;
+#else
+	FILE *fp;
+	long size;
+
+	if(!(fp = fopen(fname, "rb"))) {
+		fprintf(stderr, "failed to open raw image: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if(size < RAW_HDR_SIZE || !(raw->data = malloc(size))) {
+		fprintf(stderr, "failed to read raw image: %s\n", fname);
+		fclose(fp);
+		return -1;
+	}
+	if(fread(raw->data, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "failed to read raw image: %s\n", fname);
+		fclose(fp);
+		free(raw->data);
+		raw->data = 0;
+		return -1;
+	}
+	fclose(fp);
+	raw->size = size;
+	raw->mapped = 0;
+#endif
+
+	hdr = raw->data;
+	if(check_header(hdr, raw->size, fname) == -1) {
+		raw_unmap(raw);
+		return -1;
+	}
+
+	img_init(img);
+	img->pixels = (char*)raw->data + hdr->data_offset;
+	img->width = hdr->width;
+	img->height = hdr->height;
+	img->fmt = hdr->fmt;
+	img->pixelsz = hdr->pixel_size;
+	return 0;
+}
+
+void raw_unmap(struct raw_image *raw)
+{
+	if(!raw->data) return;
+
+#ifdef USE_MMAP
+	if(raw->mapped) {
+		munmap(raw->data, raw->size);
+		raw->data = 0;
+		return;
+	}
+#endif
+	free(raw->data);
+	raw->data = 0;
+}
+
+int raw_save(struct img_pixmap *img, const char *fname)
+{
+	struct raw_header hdr;
+#ifdef USE_MMAP
+	int fd, res = 0;
+	size_t size;
+	char *tmpname;
+	void *data;
+
+	if(init_header(&hdr, img) == -1) {
+		return -1;
+	}
+	size = hdr.data_offset + hdr.data_size;
+
+	/* written to a temporary file and renamed over fname, so that mappings of
+	 * the old file (it could be the input) stay valid
+	 */
+	if(!(tmpname = malloc(strlen(fname) + 32))) {
+		fprintf(stderr, "raw_save: failed to allocate memory\n");
+		return -1;
+	}
+	sprintf(tmpname, "%s.%d.tmp", fname, (int)getpid());
+
+	if((fd = open(tmpname, O_RDWR | O_CREAT | O_TRUNC, 0666)) == -1) {
+		fprintf(stderr, "failed to create raw image: %s: %s\n", tmpname, strerror(errno));
+		free(tmpname);
+		return -1;
+	}
+	/* allocate the blocks up front where possible, running out of space while
+	 * writing to the mapping would be fatal
+	 */
+#ifndef __APPLE__
+	if((res = posix_fallocate(fd, 0, size)) != 0 && res != EINVAL && res != EOPNOTSUPP) {
+		fprintf(stderr, "failed to allocate raw image: %s: %s\n", tmpname, strerror(res));
+		goto err;
+	}
+	if(res != 0 && ftruncate(fd, size) == -1) {
+#else
+	if(ftruncate(fd, size) == -1) {
+#endif
+		fprintf(stderr, "failed to allocate raw image: %s: %s\n", tmpname, strerror(errno));
+		goto err;
+	}
+	if((data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "failed to map raw image: %s: %s\n", tmpname, strerror(errno));
+		goto err;
+	}
+	close(fd);
+
+	memcpy(data, &hdr, sizeof hdr);
+	memcpy((char*)data + hdr.data_offset, img->pixels, hdr.data_size);
+	munmap(data, size);
+
+	if(rename(tmpname, fname) == -1) {
+		fprintf(stderr, "failed to write raw image: %s: %s\n", fname, strerror(errno));
+		remove(tmpname);
+		free(tmpname);
+		return -1;
+	}
+	free(tmpname);
+	return 0;
+
+err:
+	close(fd);
+	remove(tmpname);
+	free(tmpname);
+	return -1;
+#else
+	FILE *fp;
+	static const char zeros[RAW_HDR_SIZE];
+
+	if(init_header(&hdr, img) == -1) {
+		return -1;
+	}
+	if(!(fp = fopen(fname, "wb"))) {
+		fprintf(stderr, "failed to create raw image: %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if(fwrite(&hdr, sizeof hdr, 1, fp) != 1 ||
+			fwrite(zeros, 1, RAW_HDR_SIZE - sizeof hdr, fp) != RAW_HDR_SIZE - sizeof hdr ||
+			fwrite(img->pixels, 1, hdr.data_size, fp) != hdr.data_size) {
+		fprintf(stderr, "failed to write raw image: %s\n", fname);
+		fclose(fp);
+		remove(fname);
+		return -1;
+	}
+	fclose(fp);
+	return 0;
+#endif
+}
+
+int raw_size(const char *fname, int *width, int *height)
+{
+	FILE *fp;
+	struct raw_header hdr;
+	long size;
+
+	if(!(fp = fopen(fname, "rb"))) {
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if(fread(&hdr, sizeof hdr, 1, fp) != 1) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	if(check_header(&hdr, size, fname) == -1) {
+		return -1;
+	}
+	*width = hdr.width;
+	*height = hdr.height;
+	return 0;
+}
+
+int load_image(struct img_pixmap *img, const char *fname)
+{
+	int res;
+	struct raw_image raw;
+	struct img_pixmap view;
+
+	if(!raw_is_raw(fname)) {
+		return img_load(img, fname);
+	}
+
+	if(raw_map(&raw, &view, fname) == -1) {
+		return -1;
+	}
+	res = img_set_pixels(img, view.width, view.height, view.fmt, view.pixels);
+	raw_unmap(&raw);
+	return res;
+}
+
+int save_image(struct img_pixmap *img, const char *fname)
+{
+	if(raw_is_raw(fname)) {
+		return raw_save(img, fname);
+	}
+	return img_save(img, fname);
+}
+
+static int init_header(struct raw_header *hdr, struct img_pixmap *img)
+{
+	int pixsz;
+
+	if(!(pixsz = pixel_size(img->fmt))) {
+		fprintf(stderr, "raw_save: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+
+	memset(hdr, 0, sizeof *hdr);
+	memcpy(hdr->magic, RAW_MAGIC, sizeof hdr->magic);
+	hdr->version = RAW_VERSION;
+	hdr->byte_order = BYTE_ORDER_MARK;
+	hdr->width = img->width;
+	hdr->height = img->height;
+	hdr->fmt = img->fmt;
+	hdr->pixel_size = pixsz;
+	hdr->data_offset = RAW_HDR_SIZE;
+	hdr->data_size = (uint64_t)img->width * img->height * pixsz;
+	return 0;
+}
+
+static int check_header(const struct raw_header *hdr, uint64_t file_size, const char *fname)
+{
+	if(memcmp(hdr->magic, RAW_MAGIC, sizeof hdr->magic) != 0 || hdr->version != RAW_VERSION) {
+		fprintf(stderr, "%s: not a raw image, or unsupported version\n", fname);
+		return -1;
+	}
+	if(hdr->byte_order != BYTE_ORDER_MARK) {
+		fprintf(stderr, "%s: raw image written with a different byte order\n", fname);
+		return -1;
+	}
+	/* texel indices are ints, which also keeps the data size from wrapping, and
+	 * the pixels must be page aligned, and entirely inside the file
+	 */
+	if(!hdr->width || !hdr->height || hdr->width > INT32_MAX || hdr->height > INT32_MAX ||
+			(uint64_t)hdr->width * hdr->height > INT32_MAX ||
+			!pixel_size(hdr->fmt) || hdr->pixel_size != (uint32_t)pixel_size(hdr->fmt) ||
+			hdr->data_offset < sizeof *hdr || hdr->data_offset % RAW_HDR_SIZE != 0 ||
+			hdr->data_size != (uint64_t)hdr->width * hdr->height * hdr->pixel_size ||
+			hdr->data_size > file_size || hdr->data_offset > file_size - hdr->data_size) {
+		fprintf(stderr, "%s: corrupted raw image header\n", fname);
+		return -1;
+	}
+	return 0;
+}
+
+static int pixel_size(int fmt)
+{
+	switch(fmt) {
+	case IMG_FMT_GREY8:
+		return 1;
+	case IMG_FMT_RGB24:
+		return 3;
+	case IMG_FMT_RGBA32:
+	case IMG_FMT_GREYF:
+		return 4;
+	case IMG_FMT_RGBF:
+		return 12;
+	case IMG_FMT_RGBAF:
+		return 16;
+	case IMG_FMT_RGB565:
+		return 2;
+	default:
+		break;
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RAWIMG_H_
+#define RAWIMG_H_
+
+#include <stddef.h>
+
+struct img_pixmap;
+
+/* Uncompressed raw images (.raw files), for handing textures between the
+ * stages of a pipeline without encoding and decoding PNG files at every step.
+ * A raw file is a header padded to RAW_HDR_SIZE bytes, followed by the pixels
+ * exactly as imago keeps them in memory (rows top to bottom, in the image's
+ * own pixel format and the writer's byte order), so the pixels start on a page
+ * boundary and can be used straight from a memory mapping.
+ */
+#define RAW_HDR_SIZE	4096
+
+struct raw_image {
+	void *data;			/* the whole file: header and pixels */
+	size_t size;
+	int mapped;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* non-zero if fname has the .raw suffix */
+int raw_is_raw(const char *fname);
+
+/* Map a raw file, and point img at its pixels, without copying them. The
+ * mapping is private: the pixels can be modified in place, and only the
+ * modified pages are copied, leaving the file untouched. img must not be
+ * passed to img_destroy or reloaded; it's valid until raw_unmap.
+ */
+int raw_map(struct raw_image *raw, struct img_pixmap *img, const char *fname);
+void raw_unmap(struct raw_image *raw);
+
+/* write img as a raw file, copying its pixels straight into a mapping of the
+ * new file. fname is replaced atomically, so it may be a raw file which is
+ * currently mapped.
+ */
+int raw_save(struct img_pixmap *img, const char *fname);
+
+/* read just the dimensions from the header */
+int raw_size(const char *fname, int *width, int *height);
+
+/* img_load and img_save, which handle raw files as well. Raw files are read
+ * into memory owned by img, like any other image.
+ */
+int load_image(struct img_pixmap *img, const char *fname);
+int save_image(struct img_pixmap *img, const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* RAWIMG_H_ */
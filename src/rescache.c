@@ -0,0 +1,281 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#define HAVE_POSIX
+#endif
+#include "rescache.h"
+#include "hash.h"
+#include "rawimg.h"
+#include "batch.h"
+#include "expand.h"
+
+#define CACHE_VERSION	2
+#define COPY_BUF_SIZE	65536
+
+/* kinds of mask sources */
+enum { SRC_MESH, SRC_MASK, SRC_ALPHA };
+
+static char *cache_path(const char *cachedir, uint64_t key, const char *out_fname);
+static const char *file_suffix(const char *fname);
+static int copy_file(const char *src, const char *dest);
+static int same_contents(const char *afname, const char *bfname);
+static int get_pid(void);
+static unsigned long next_tmp_id(void);
+
+int rescache_key(uint64_t *key, const struct rescache_src *src)
+{
+	uint64_t hash = HASH_INIT;
+	int32_t params[7];
+	const char *srcfname = src->scene_fname ? src->scene_fname : src->mask_fname;
+	const char *filter = src->scene_fname && src->filter ? src->filter : "";
+	const char *suffix = file_suffix(src->out_fname);
+
+	if(hash_file(&hash, src->tex_fname) == -1 || hash_file(&hash, srcfname) == -1) {
+		return -1;
+	}
+
+	params[0] = CACHE_VERSION;
+	params[1] = src->scene_fname ? SRC_MESH : (src->alpha_mask ? SRC_ALPHA : SRC_MASK);
+	params[2] = src->scene_fname ? src->uvset : 0;
+	params[3] = src->scene_fname && src->filter;
+	params[4] = src->alg;
+	/* the pull-push fill has no radius, and all non-positive radii are unlimited */
+	params[5] = src->alg == ALG_PULLPUSH || src->radius <= 0 ? 0 : src->radius;
+	params[6] = EXPAND_OUTPUT_VERSION;
+
+	hash = hash_bytes(hash, params, sizeof params);
+	hash = hash_bytes(hash, filter, strlen(filter) + 1);
+	*key = hash_bytes(hash, suffix, strlen(suffix) + 1);
+	return 0;
+}
+
+int rescache_fetch(const char *cachedir, uint64_t key, const char *out_fname)
+{
+	int res = 0;
+	char *path, *tmpname = 0;
+	FILE *fp;
+
+	if(!(path = cache_path(cachedir, key, out_fname))) {
+		return 0;
+	}
+	if(!(fp = fopen(path, "rb"))) {
+		free(path);
+		return 0;
+	}
+	fclose(fp);
+
+	if(same_contents(path, out_fname)) {
+		res = 1;
+	} else if((tmpname = rescache_tmpname(out_fname)) && copy_file(path, tmpname) != -1) {
+		if(rename(tmpname, out_fname) == -1) {
+			fprintf(stderr, "warning: failed to replace %s with its cached copy: %s\n", out_fname,
+					strerror(errno));
+			remove(tmpname);
+		} else {
+			res = 1;
+		}
+	}
+	free(tmpname);
+	free(path);
+	return res;
+}
+
+char *rescache_tmpname(const char *out_fname)
+{
+	char *tmpname;
+	const char *base = strrchr(out_fname, '/');
+	int dirlen = base ? (int)(base - out_fname) + 1 : 0;
+
+	if(!(tmpname = malloc(strlen(out_fname) + 32))) {
+		fprintf(stderr, "rescache: failed to allocate temporary filename\n");
+		return 0;
+	}
+	sprintf(tmpname, "%.*s.texpand-%d-%lu-%s", dirlen, out_fname, get_pid(), next_tmp_id(),
+			out_fname + dirlen);
+	return tmpname;
+}
+
+int rescache_store(const char *cachedir, uint64_t key, const char *tmp_fname, const char *out_fname)
+{
+	char *path, *cachetmp;
+
+	/* write the cache file through a temporary too, so that concurrent runs
+	 * never see a partially written one
+	 */
+	if((path = cache_path(cachedir, key, out_fname))) {
+		if((cachetmp = malloc(strlen(path) + 32))) {
+#ifdef HAVE_POSIX
+			mkdir(cachedir, 0777);
+#endif
+			sprintf(cachetmp, "%s.%d-%lu.tmp", path, get_pid(), next_tmp_id());
+			if(copy_file(tmp_fname, cachetmp) == -1 || rename(cachetmp, path) == -1) {
+				fprintf(stderr, "warning: failed to write result cache file: %s\n", path);
+				remove(cachetmp);
+			}
+			free(cachetmp);
+		}
+		free(path);
+	}
+
+	if(same_contents(tmp_fname, out_fname)) {
+		remove(tmp_fname);
+		return 0;
+	}
+	if(rename(tmp_fname, out_fname) == -1) {
+		fprintf(stderr, "failed to write output file: %s: %s\n", out_fname, strerror(errno));
+		remove(tmp_fname);
+		return -1;
+	}
+	return 0;
+}
+
+int rescache_save(const char *cachedir, uint64_t key, struct img_pixmap *img, const char *out_fname)
+{
+	int res;
+	char *tmpname;
+
+	if(!(tmpname = rescache_tmpname(out_fname))) {
+		return -1;
+	}
+	if((res = save_image(img, tmpname)) == -1) {
+		remove(tmpname);
+	} else {
+		res = rescache_store(cachedir, key, tmpname, out_fname);
+	}
+	free(tmpname);
+	return res;
+}
+
+/* the suffix of the output is part of the name, to keep the cache browsable */
+static char *cache_path(const char *cachedir, uint64_t key, const char *out_fname)
+{
+	char *path;
+	const char *suffix = file_suffix(out_fname);
+
+	if(!(path = malloc(strlen(cachedir) + strlen(suffix) + 32))) {
+		fprintf(stderr, "failed to allocate result cache path\n");
+		return 0;
+	}
+	sprintf(path, "%s/%08lx%08lx%s", cachedir, (unsigned long)(key >> 32),
+			(unsigned long)(key & 0xffffffff), suffix);
+	return path;
+}
+
+/* ".png" for "dir/foo.png", or "" if there's no suffix */
+static const char *file_suffix(const char *fname)
+{
+	const char *suffix = strrchr(fname, '.');
+
+	if(!suffix || strchr(suffix, '/')) {
+		return "";
+	}
+	return suffix;
+}
+
+static int copy_file(const char *src, const char *dest)
+{
+	FILE *in, *out;
+	char *buf;
+	size_t sz;
+	int res = -1;
+
+	if(!(in = fopen(src, "rb"))) {
+		return -1;
+	}
+	if(!(out = fopen(dest, "wb"))) {
+		fclose(in);
+		return -1;
+	}
+	if((buf = malloc(COPY_BUF_SIZE))) {
+		while((sz = fread(buf, 1, COPY_BUF_SIZE, in)) > 0) {
+			if(fwrite(buf, 1, sz, out) != sz) break;
+		}
+		res = ferror(in) || ferror(out) ? -1 : 0;
+		free(buf);
+	}
+	fclose(in);
+	if(fclose(out) == EOF) {
+		res = -1;
+	}
+	if(res == -1) {
+		remove(dest);
+	}
+	return res;
+}
+
+static int same_contents(const char *afname, const char *bfname)
+{
+	FILE *fa, *fb;
+	char *buf;
+	size_t na, nb;
+	int res = 0;
+
+	if(!(fa = fopen(afname, "rb"))) {
+		return 0;
+	}
+	if(!(fb = fopen(bfname, "rb"))) {
+		fclose(fa);
+		return 0;
+	}
+	if((buf = malloc(COPY_BUF_SIZE * 2))) {
+		for(;;) {
+			na = fread(buf, 1, COPY_BUF_SIZE, fa);
+			nb = fread(buf + COPY_BUF_SIZE, 1, COPY_BUF_SIZE, fb);
+			if(na != nb || memcmp(buf, buf + COPY_BUF_SIZE, na) != 0) {
+				break;
+			}
+			if(na < COPY_BUF_SIZE) {
+				res = !ferror(fa) && !ferror(fb);
+				break;
+			}
+		}
+		free(buf);
+	}
+	fclose(fa);
+	fclose(fb);
+	return res;
+}
+
+static int get_pid(void)
+{
+#ifdef HAVE_POSIX
+	return getpid();
+#else
+	return 0;
+#endif
+}
+
+/* temporary files are named by process and call, since batch jobs with the
+ * same key may store their results from several threads at once
+ */
+static unsigned long next_tmp_id(void)
+{
+	static unsigned long count;
+	unsigned long id;
+
+#pragma omp atomic capture
+	id = ++count;
+	return id;
+}
@@ -0,0 +1,75 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RESCACHE_H_
+#define RESCACHE_H_
+
+#include <stdint.h>
+
+struct img_pixmap;
+
+/* everything an expanded texture depends on */
+struct rescache_src {
+	const char *tex_fname;
+	const char *out_fname;		/* only its suffix, which selects the output format */
+	/* the mask source: a mesh with the UV set and material filter (or null),
+	 * or a mask image, or with alpha_mask the alpha channel of mask_fname
+	 */
+	const char *scene_fname;
+	const char *mask_fname;
+	int alpha_mask;
+	int uvset;
+	const char *filter;
+	int radius, alg;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Result cache (-cache <dir>): expanded textures are stored in the cache
+ * directory, under a key hashed from the contents of the input texture and
+ * the mask source files, the expansion parameters, and the version of the
+ * expansion code (EXPAND_OUTPUT_VERSION in expand.h). No image is decoded
+ * to compute the key. Outputs are copied in and out of the cache, never
+ * linked, so writing to an output can't corrupt the cache.
+ */
+int rescache_key(uint64_t *key, const struct rescache_src *src);
+
+/* On a cache hit, bring out_fname up to date and return 1. An output which is
+ * already identical to the cached one is left untouched, timestamp and all.
+ * Returns 0 on a miss, or if the output can't be written.
+ */
+int rescache_fetch(const char *cachedir, uint64_t key, const char *out_fname);
+
+/* Outputs are first written to a temporary file next to out_fname, with the
+ * same suffix, and a name unique to the call (free it). rescache_store then
+ * copies it into the cache, and replaces out_fname with it, unless they're
+ * identical, in which case the temporary file is just removed. Failing to
+ * write the cache only warns.
+ */
+char *rescache_tmpname(const char *out_fname);
+int rescache_store(const char *cachedir, uint64_t key, const char *tmp_fname, const char *out_fname);
+
+/* save_image through the cache, with the above */
+int rescache_save(const char *cachedir, uint64_t key, struct img_pixmap *img, const char *out_fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* RESCACHE_H_ */
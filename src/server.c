@@ -0,0 +1,697 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include "server.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+#include <imago2.h>
+#include "batch.h"
+#include "genmask.h"
+#include "expand.h"
+#include "bitmask.h"
+#include "pullpush.h"
+#include "stats.h"
+#include "rawimg.h"
+#include "rescache.h"
+
+#define MAX_SCENES	4
+#define MAX_MASKS	8
+/* total size of the cached bitmasks and nearest texel maps */
+#define MASK_CACHE_BYTES	(512l << 20)
+/* seconds to wait for the request line of a connection */
+#define REQUEST_TIMEOUT	10
+
+/* files are identified by name, modification time and size */
+struct file_id {
+	char *fname;
+	time_t mtime;
+	off_t size;
+};
+
+struct scene_entry {
+	struct file_id id;
+	struct uvscene *scn;
+	unsigned long used;		/* LRU timestamp, 0 for unused slots */
+};
+
+struct mask_entry {
+	struct file_id id;		/* the mesh or mask file */
+	int uvset;
+	char *filter;			/* texture filename used for material matching, or null */
+	int width, height;
+
+	struct bitmask bmask;
+	int *nearest;			/* nearest texel map for radius, or null */
+	int radius;
+	unsigned long used;
+};
+
+struct client {
+	FILE *in, *out;
+	int lost;				/* failed to write to the client */
+	int percent;			/* last reported progress */
+};
+
+static int stale_socket(struct sockaddr_un *addr);
+static int handle_client(int fd);
+static int run_request(struct client *cl, char *line);
+static int fetch_cached(const struct batch_job *job, uint64_t *key);
+static int expand_job(struct client *cl, struct img_pixmap *img, struct mask_entry *m,
+		const struct batch_job *job);
+static struct mask_entry *get_mask(const struct batch_job *job, int width, int height);
+static int make_mask(struct mask_entry *m, const struct batch_job *job);
+static void trim_masks(struct mask_entry *keep);
+static void free_mask(struct mask_entry *m);
+static struct uvscene *get_scene(const char *fname);
+static void free_scene_entry(struct scene_entry *s);
+static int grow_context(int width, int height);
+static int get_file_id(struct file_id *id, const char *fname);
+static int same_file(const struct file_id *id, const struct file_id *cur);
+static int same_str(const char *a, const char *b);
+static char *dup_str(const char *s);
+static const char *basename_of(const char *path);
+static void reply(struct client *cl, const char *fmt, ...);
+static void progress_func(float done, void *cls);
+static void sig_handler(int s);
+
+static const char *sock_path;
+static const struct batch_opt *defaults;
+static struct scene_entry scenes[MAX_SCENES];
+static struct mask_entry masks[MAX_MASKS];
+static unsigned long lru_clock;
+static int ctx_xsz, ctx_ysz;	/* size of the mask rendering context */
+static int num_requests;
+
+static volatile sig_atomic_t quit;
+static volatile int cancel;		/* stops the expansion of the current request */
+
+int serve(const char *sockpath, const struct batch_opt *defopt)
+{
+	int i, sock, fd, res = -1;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+
+	if(strlen(sockpath) >= sizeof addr.sun_path) {
+		fprintf(stderr, "socket path too long: %s\n", sockpath);
+		return -1;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sockpath);
+
+	if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("failed to create socket");
+		return -1;
+	}
+	if(bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+		if(errno == EADDRINUSE && !stale_socket(&addr)) {
+			fprintf(stderr, "another server is already listening on %s\n", sockpath);
+			close(sock);
+			return -1;
+		}
+		/* a socket file left behind by a server which didn't exit cleanly */
+		if(errno != EADDRINUSE || unlink(sockpath) == -1 ||
+				bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+			fprintf(stderr, "failed to bind socket: %s: %s\n", sockpath, strerror(errno));
+			close(sock);
+			return -1;
+		}
+	}
+	if(listen(sock, 16) == -1) {
+		perror("failed to listen on socket");
+		close(sock);
+		unlink(sockpath);
+		return -1;
+	}
+	sock_path = sockpath;
+	defaults = defopt;
+
+	/* no SA_RESTART: a signal interrupts accept and the client reads */
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	/* start the worker threads now, instead of in the first request */
+#pragma omp parallel
+	{
+	}
+
+	if(!defopt->silent) {
+		printf("listening on %s (%d threads)\n", sockpath, omp_get_max_threads());
+		fflush(stdout);
+	}
+
+	while(!quit) {
+		if((fd = accept(sock, 0, 0)) == -1) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			perror("failed to accept connection");
+			goto end;
+		}
+		if(handle_client(fd) == -1) {
+			quit = 1;
+		}
+	}
+	res = 0;
+
+end:
+	close(sock);
+	unlink(sockpath);
+
+	for(i=0; i<MAX_MASKS; i++) {
+		free_mask(masks + i);
+	}
+	for(i=0; i<MAX_SCENES; i++) {
+		free_scene_entry(scenes + i);
+	}
+	if(ctx_xsz) {
+		end_gen_mask();
+		ctx_xsz = ctx_ysz = 0;
+	}
+	return res;
+}
+
+/* non-zero if nothing is listening on the socket file of addr. Preserves errno */
+static int stale_socket(struct sockaddr_un *addr)
+{
+	int s, res, err = errno;
+
+	if((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		errno = err;
+		return 0;
+	}
+	res = connect(s, (struct sockaddr*)addr, sizeof *addr) == -1 && errno == ECONNREFUSED;
+	close(s);
+	errno = err;
+	return res;
+}
+
+/* serve the single request of a connection, returns -1 on shutdown requests.
+ * A client which doesn't send its request in time is dropped, so that it
+ * can't hold up the clients queued behind it.
+ */
+static int handle_client(int fd)
+{
+	int fd2, res = 0;
+	char buf[4096], *ptr, *end;
+	struct client cl;
+	struct timeval tv;
+
+	tv.tv_sec = REQUEST_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+	memset(&cl, 0, sizeof cl);
+	if((fd2 = dup(fd)) == -1 || !(cl.in = fdopen(fd, "r")) || !(cl.out = fdopen(fd2, "w"))) {
+		perror("failed to open client connection");
+		if(cl.in) {
+			fclose(cl.in);
+		} else {
+			close(fd);
+		}
+		if(fd2 != -1) close(fd2);
+		return 0;
+	}
+
+	while(!quit && fgets(buf, sizeof buf, cl.in)) {
+		if(!strchr(buf, '\n') && !feof(cl.in)) {
+			reply(&cl, "error request too long\n");
+			break;
+		}
+
+		ptr = buf;
+		while(*ptr && isspace((unsigned char)*ptr)) ptr++;
+		end = ptr + strlen(ptr);
+		while(end > ptr && isspace((unsigned char)end[-1])) *--end = 0;
+		if(!*ptr || *ptr == '#') continue;
+
+		if(strcmp(ptr, "shutdown") == 0) {
+			reply(&cl, "ok\n");
+			res = -1;
+		} else {
+			run_request(&cl, ptr);
+		}
+		break;
+	}
+
+	fclose(cl.in);
+	fclose(cl.out);
+	return res;
+}
+
+static int run_request(struct client *cl, char *line)
+{
+	int res = -1, cached;
+	uint64_t key;
+	struct batch_job job;
+	struct img_pixmap img;
+	struct mask_entry *m;
+
+	img_init(&img);
+	if(batch_init_job(&job, defaults) == -1) {
+		reply(cl, "error out of memory\n");
+		return -1;
+	}
+	if(batch_parse_job(&job, line, sock_path, ++num_requests) == -1) {
+		reply(cl, "error invalid request\n");
+		goto end;
+	}
+
+	if((cached = fetch_cached(&job, &key)) == 1) {
+		if(!defaults->silent) {
+			printf("%s -> %s (cached)\n", job.tex_fname, job.out_fname);
+			fflush(stdout);
+		}
+		reply(cl, "ok\n");
+		res = 0;
+		goto end;
+	}
+
+	stats_begin("load", job.tex_fname);
+	res = load_image(&img, job.tex_fname);
+	stats_end();
+	if(res == -1) {
+		reply(cl, "error failed to load texture: %s\n", job.tex_fname);
+		goto end;
+	}
+	res = -1;
+
+	if(!(m = get_mask(&job, img.width, img.height))) {
+		reply(cl, "error failed to %s mask: %s\n", job.scene_fname ? "generate" : "load",
+				job.scene_fname ? job.scene_fname : job.mask_fname);
+		goto end;
+	}
+
+	stats_begin("expand", job.tex_fname);
+	res = expand_job(cl, &img, m, &job);
+	stats_end();
+	if(res == -1) {
+		reply(cl, cancel ? "error cancelled\n" : "error expansion failed\n");
+		goto end;
+	}
+	trim_masks(m);
+
+	stats_begin("save", job.out_fname);
+	if(cached == 0) {
+		res = rescache_save(defaults->cache_dir, key, &img, job.out_fname);
+	} else {
+		res = save_image(&img, job.out_fname);
+	}
+	stats_end();
+	if(res == -1) {
+		reply(cl, "error failed to write output file: %s\n", job.out_fname);
+		goto end;
+	}
+
+	if(!defaults->silent) {
+		printf("%s -> %s\n", job.tex_fname, job.out_fname);
+		fflush(stdout);
+	}
+	reply(cl, "ok\n");
+
+end:
+	img_destroy(&img);
+	batch_destroy_job(&job);
+	return res;
+}
+
+/* look up the output of a job in the result cache: 1 on a hit, 0 on a miss,
+ * and -1 if the job can't be cached
+ */
+static int fetch_cached(const struct batch_job *job, uint64_t *key)
+{
+	struct rescache_src src;
+
+	if(!defaults->cache_dir) {
+		return -1;
+	}
+
+	memset(&src, 0, sizeof src);
+	src.tex_fname = job->tex_fname;
+	src.out_fname = job->out_fname;
+	src.scene_fname = job->scene_fname;
+	src.mask_fname = job->mask_fname;
+	src.uvset = job->uvset;
+	src.filter = job->force ? 0 : basename_of(job->tex_fname);
+	src.radius = job->radius;
+	src.alg = job->alg;
+
+	if(rescache_key(key, &src) == -1) {
+		return -1;
+	}
+	return rescache_fetch(defaults->cache_dir, *key, job->out_fname);
+}
+
+static int expand_job(struct client *cl, struct img_pixmap *img, struct mask_entry *m,
+		const struct batch_job *job)
+{
+	int res;
+	struct bitmask_tiles tiles;
+	struct expand_progress prog;
+
+	cancel = 0;
+	cl->percent = -1;
+	prog.func = progress_func;
+	prog.cls = cl;
+	prog.cancel = &cancel;
+
+	switch(job->alg) {
+	case ALG_SEARCH:
+		if(bitmask_tiles_init(&tiles, &m->bmask) == -1) {
+			return -1;
+		}
+		res = expand_search_tiled(img, job->radius, img, &m->bmask, &tiles, &prog);
+		bitmask_tiles_destroy(&tiles);
+		return res;
+
+	case ALG_PULLPUSH:
+		if((res = expand_pullpush(img, &m->bmask)) != -1) {
+			progress_func(1.0f, cl);
+		}
+		return res;
+
+	default:
+		break;
+	}
+
+	/* the nearest texel map of the last radius is kept with the mask */
+	if(!m->nearest || m->radius != job->radius) {
+		if(!m->nearest && !(m->nearest = malloc(img->width * img->height * sizeof *m->nearest))) {
+			fprintf(stderr, "failed to allocate nearest texel map\n");
+			return -1;
+		}
+		if(calc_nearest_progress(m->nearest, job->radius, &m->bmask, &prog) == -1) {
+			free(m->nearest);
+			m->nearest = 0;
+			return -1;
+		}
+		m->radius = job->radius;
+	} else {
+		progress_func(1.0f, cl);
+	}
+	return expand_nearest(img, img, m->nearest);
+}
+
+/* the cached mask of a job, generating or loading it if necessary */
+static struct mask_entry *get_mask(const struct batch_job *job, int width, int height)
+{
+	int i;
+	struct file_id id;
+	struct mask_entry *m, *lru = masks;
+	const char *filter = 0;
+	int uvset = 0;
+
+	if(job->scene_fname) {
+		uvset = job->uvset;
+		filter = job->force ? 0 : basename_of(job->tex_fname);
+	}
+	if(get_file_id(&id, job->scene_fname ? job->scene_fname : job->mask_fname) == -1) {
+		return 0;
+	}
+
+	for(i=0; i<MAX_MASKS; i++) {
+		m = masks + i;
+		if(m->used && same_file(&m->id, &id) && m->uvset == uvset && same_str(m->filter, filter) &&
+				m->width == width && m->height == height) {
+			m->used = ++lru_clock;
+			return m;
+		}
+		if(m->used < lru->used) lru = m;
+	}
+
+	free_mask(lru);
+	m = lru;
+	if(!(m->id.fname = dup_str(id.fname)) || (filter && !(m->filter = dup_str(filter)))) {
+		free_mask(m);
+		return 0;
+	}
+	m->id.mtime = id.mtime;
+	m->id.size = id.size;
+	m->uvset = uvset;
+	m->width = width;
+	m->height = height;
+
+	if(make_mask(m, job) == -1) {
+		free_mask(m);
+		return 0;
+	}
+	m->used = ++lru_clock;
+	return m;
+}
+
+static int make_mask(struct mask_entry *m, const struct batch_job *job)
+{
+	int res;
+	struct img_pixmap mask;
+	struct uvscene *scn;
+
+	img_init(&mask);
+	if(job->scene_fname) {
+		if(!(scn = get_scene(job->scene_fname)) || grow_context(m->width, m->height) == -1) {
+			return -1;
+		}
+		stats_begin("rasterize", job->tex_fname);
+		res = gen_mask(&mask, m->width, m->height, scn, m->uvset, m->filter);
+		stats_end();
+
+	} else {
+		if((res = load_image(&mask, job->mask_fname)) != -1) {
+			res = img_convert(&mask, IMG_FMT_GREY8);
+		}
+		if(res != -1 && (mask.width != m->width || mask.height != m->height)) {
+			fprintf(stderr, "texture (%s) and mask (%s) dimensions differ\n", job->tex_fname, job->mask_fname);
+			res = -1;
+		}
+	}
+
+	if(res != -1) {
+		res = bitmask_from_img(&m->bmask, &mask, EXPAND_MASK_THRES);
+	}
+	img_destroy(&mask);
+	return res;
+}
+
+/* evict least recently used masks, other than keep, until the cache fits in
+ * MASK_CACHE_BYTES
+ */
+static void trim_masks(struct mask_entry *keep)
+{
+	int i;
+	long total;
+	struct mask_entry *m, *lru;
+
+	for(;;) {
+		total = 0;
+		lru = 0;
+		for(i=0; i<MAX_MASKS; i++) {
+			m = masks + i;
+			if(!m->used) continue;
+
+			total += (long)m->bmask.pitch * m->bmask.height * sizeof *m->bmask.bits;
+			if(m->nearest) {
+				total += (long)m->width * m->height * sizeof *m->nearest;
+			}
+			if(m != keep && (!lru || m->used < lru->used)) {
+				lru = m;
+			}
+		}
+		if(total <= MASK_CACHE_BYTES || !lru) break;
+		free_mask(lru);
+	}
+}
+
+static void free_mask(struct mask_entry *m)
+{
+	free(m->id.fname);
+	free(m->filter);
+	bitmask_destroy(&m->bmask);
+	free(m->nearest);
+	memset(m, 0, sizeof *m);
+}
+
+/* the cached scene of fname, importing it if it's not cached or has changed */
+static struct uvscene *get_scene(const char *fname)
+{
+	int i;
+	struct file_id id;
+	struct scene_entry *s, *lru = scenes;
+
+	if(get_file_id(&id, fname) == -1) {
+		return 0;
+	}
+
+	for(i=0; i<MAX_SCENES; i++) {
+		s = scenes + i;
+		if(s->used && same_file(&s->id, &id)) {
+			s->used = ++lru_clock;
+			return s->scn;
+		}
+		if(s->used < lru->used) lru = s;
+	}
+
+	free_scene_entry(lru);
+	s = lru;
+	if(!(s->id.fname = dup_str(fname))) {
+		return 0;
+	}
+	stats_begin("import", fname);
+	s->scn = load_scene(fname);
+	stats_end();
+	if(!s->scn) {
+		free_scene_entry(s);
+		return 0;
+	}
+	s->id.mtime = id.mtime;
+	s->id.size = id.size;
+	s->used = ++lru_clock;
+	return s->scn;
+}
+
+static void free_scene_entry(struct scene_entry *s)
+{
+	if(s->scn) {
+		free_scene(s->scn);
+	}
+	free(s->id.fname);
+	memset(s, 0, sizeof *s);
+}
+
+/* grow the shared rendering context as needed */
+static int grow_context(int width, int height)
+{
+	int xsz, ysz;
+
+	if(width <= ctx_xsz && height <= ctx_ysz) {
+		return 0;
+	}
+	xsz = width > ctx_xsz ? width : ctx_xsz;
+	ysz = height > ctx_ysz ? height : ctx_ysz;
+
+	if(ctx_xsz) {
+		end_gen_mask();
+	}
+	ctx_xsz = ctx_ysz = 0;
+	if(begin_gen_mask(xsz, ysz) == -1) {
+		return -1;
+	}
+	ctx_xsz = xsz;
+	ctx_ysz = ysz;
+	return 0;
+}
+
+/* id->fname points to fname, it's not a copy */
+static int get_file_id(struct file_id *id, const char *fname)
+{
+	struct stat st;
+
+	if(stat(fname, &st) == -1) {
+		fprintf(stderr, "failed to access %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	id->fname = (char*)fname;
+	id->mtime = st.st_mtime;
+	id->size = st.st_size;
+	return 0;
+}
+
+static int same_file(const struct file_id *id, const struct file_id *cur)
+{
+	return strcmp(id->fname, cur->fname) == 0 && id->mtime == cur->mtime && id->size == cur->size;
+}
+
+static int same_str(const char *a, const char *b)
+{
+	if(!a || !b) return a == b;
+	return strcmp(a, b) == 0;
+}
+
+static char *dup_str(const char *s)
+{
+	char *str;
+
+	if(!(str = malloc(strlen(s) + 1))) {
+		fprintf(stderr, "serve: failed to allocate memory\n");
+		return 0;
+	}
+	strcpy(str, s);
+	return str;
+}
+
+static const char *basename_of(const char *path)
+{
+	const char *ptr = strrchr(path, '/');
+	return ptr ? ptr + 1 : path;
+}
+
+/* a client which went away cancels its request */
+static void reply(struct client *cl, const char *fmt, ...)
+{
+	va_list ap;
+
+	if(cl->lost) return;
+
+	va_start(ap, fmt);
+	vfprintf(cl->out, fmt, ap);
+	va_end(ap);
+	if(fflush(cl->out) == EOF) {
+		cl->lost = 1;
+		cancel = 1;
+	}
+}
+
+static void progress_func(float done, void *cls)
+{
+	struct client *cl = cls;
+	int percent = (int)(done * 100.0f);
+
+	if(percent != cl->percent) {
+		cl->percent = percent;
+		reply(cl, "progress %d\n", percent);
+	}
+}
+
+static void sig_handler(int s)
+{
+	quit = 1;
+	cancel = 1;
+}
+
+#else	/* !unix */
+
+int serve(const char *sockpath, const struct batch_opt *defopt)
+{
+	fprintf(stderr, "daemon mode is not supported on this platform\n");
+	return -1;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SERVER_H_
+#define SERVER_H_
+
+struct batch_opt;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Daemon mode: accept expansion requests on the unix domain socket sockpath,
+ * until a shutdown request, or SIGINT/SIGTERM. Each request is a single line
+ * with the syntax of a batch manifest job (see batch.h), with defopt as the
+ * defaults. The reply is any number of "progress <percent>" lines, followed by
+ * "ok" or "error <message>". A "shutdown" line stops the server.
+ *
+ * Each connection carries a single request, and clients are served one at a
+ * time, in the order they connect; a connection which doesn't send its
+ * request within a few seconds is dropped. Imported scenes and generated
+ * masks (with the nearest texel map of their last radius) are kept in small
+ * LRU caches across requests, keyed by filename and modification time, and
+ * the mask rendering context and the worker threads stay alive in between.
+ */
+int serve(const char *sockpath, const struct batch_opt *defopt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* SERVER_H_ */
@@ -0,0 +1,223 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#include <sys/resource.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#endif
+#include "stats.h"
+#include "expand.h"
+
+struct phase {
+	const char *name, *item;
+	double wall, cpu;
+	long peak_rss;		/* KB, or -1 if unknown */
+};
+
+static double wall_time(void);
+static double cpu_time(void);
+static long peak_rss(void);
+static void write_rss(FILE *fp, long rss);
+static void write_string(FILE *fp, const char *str);
+
+static struct phase *phases;
+static int num_phases, max_phases;
+static int cur_phase = -1;
+static double start_wall, start_cpu;
+
+static struct expand_stats exp_stats;
+
+int stats_init(void)
+{
+	exp_stats.num_threads = omp_get_max_threads();
+	if(!(exp_stats.busy = calloc(exp_stats.num_threads, sizeof *exp_stats.busy))) {
+		fprintf(stderr, "failed to allocate statistics\n");
+		return -1;
+	}
+	expand_stats = &exp_stats;
+
+	start_wall = wall_time();
+	start_cpu = cpu_time();
+	max_phases = 16;
+	if(!(phases = malloc(max_phases * sizeof *phases))) {
+		fprintf(stderr, "failed to allocate statistics\n");
+		return -1;
+	}
+	return 0;
+}
+
+void stats_begin(const char *phase, const char *item)
+{
+	struct phase *ph;
+
+	if(!phases) return;
+	if(cur_phase >= 0) stats_end();
+
+	if(num_phases >= max_phases) {
+		void *tmp = realloc(phases, max_phases * 2 * sizeof *phases);
+		if(!tmp) return;
+		phases = tmp;
+		max_phases *= 2;
+	}
+
+	cur_phase = num_phases++;
+	ph = phases + cur_phase;
+	ph->name = phase;
+	ph->item = item;
+	ph->wall = wall_time();
+	ph->cpu = cpu_time();
+	ph->peak_rss = 0;
+}
+
+void stats_end(void)
+{
+	struct phase *ph;
+
+	if(!phases || cur_phase < 0) return;
+
+	ph = phases + cur_phase;
+	ph->wall = wall_time() - ph->wall;
+	ph->cpu = cpu_time() - ph->cpu;
+	ph->peak_rss = peak_rss();
+	cur_phase = -1;
+}
+
+int stats_write(const char *fname)
+{
+	int i;
+	FILE *fp;
+
+	if(!phases) return -1;
+
+	/* a phase still running here is the one which failed */
+	if(cur_phase >= 0) stats_end();
+
+	if(!(fp = fopen(fname, "w"))) {
+		fprintf(stderr, "failed to open statistics file: %s\n", fname);
+		return -1;
+	}
+
+	fprintf(fp, "{\n\t\"phases\": [");
+	for(i=0; i<num_phases; i++) {
+		struct phase *ph = phases + i;
+
+		fprintf(fp, "%s\n\t\t{\"phase\": ", i ? "," : "");
+		write_string(fp, ph->name);
+		if(ph->item) {
+			fprintf(fp, ", \"item\": ");
+			write_string(fp, ph->item);
+		}
+		fprintf(fp, ", \"wall\": %.6f, \"cpu\": %.6f", ph->wall, ph->cpu);
+		write_rss(fp, ph->peak_rss);
+		fputc('}', fp);
+	}
+	fprintf(fp, "\n\t],\n");
+
+	fprintf(fp, "\t\"total\": {\"wall\": %.6f, \"cpu\": %.6f", wall_time() - start_wall,
+			cpu_time() - start_cpu);
+	write_rss(fp, peak_rss());
+	fprintf(fp, "},\n");
+
+	fprintf(fp, "\t\"expand\": {\"texels\": %ld, \"candidates\": %ld, \"avg_candidates\": %.3f, ",
+			exp_stats.texels, exp_stats.candidates,
+			exp_stats.texels ? (double)exp_stats.candidates / exp_stats.texels : 0.0);
+	fprintf(fp, "\"thread_busy\": [");
+	for(i=0; i<exp_stats.num_threads; i++) {
+		fprintf(fp, "%s%.6f", i ? ", " : "", exp_stats.busy[i]);
+	}
+	fprintf(fp, "]}\n}\n");
+
+	fclose(fp);
+	return 0;
+}
+
+static double wall_time(void)
+{
+	return omp_get_wtime();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* user + system time of all threads */
+static double cpu_time(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static long peak_rss(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return ru.ru_maxrss >> 10;	/* bytes on macOS */
+#else
+	return ru.ru_maxrss;
+#endif
+}
+#else
+static double cpu_time(void)
+{
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static long peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc)) {
+		return (long)(pmc.PeakWorkingSetSize >> 10);
+	}
+#endif
+	return -1;	/* not available on this platform */
+}
+#endif
+
+/* the peak_rss_kb field, left out where it isn't known */
+static void write_rss(FILE *fp, long rss)
+{
+	if(rss >= 0) {
+		fprintf(fp, ", \"peak_rss_kb\": %ld", rss);
+	}
+}
+
+static void write_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	while(*str) {
+		int c = *str++;
+		if(c == '"' || c == '\\') {
+			fputc('\\', fp);
+			fputc(c, fp);
+		} else if(c >= 0 && c < 32) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
@@ -0,0 +1,44 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STATS_H_
+#define STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Per-phase statistics (-stats): wall clock time, CPU time of all threads,
+ * and the peak resident set size at the end of each phase (where the platform
+ * can report it). Phases may repeat (once per texture, for instance), and
+ * item optionally names what the phase was working on. Until stats_init is
+ * called, stats_begin/stats_end do nothing.
+ */
+int stats_init(void);
+void stats_begin(const char *phase, const char *item);
+void stats_end(void);
+
+/* write all phases and the expansion counters (see expand_stats in expand.h)
+ * as JSON
+ */
+int stats_write(const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* STATS_H_ */
@@ -0,0 +1,586 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <png.h>
+#include <imago2.h>
+#include "stream.h"
+#include "expand.h"
+#include "bitmask.h"
+#include "rawimg.h"
+
+/* rows of the bands expand_nearest_png hands to the encoder, about this many
+ * texels at a time
+ */
+#define BAND_TEXELS		(1 << 20)
+
+/* imago can only load whole images, so the streaming path talks to libpng
+ * directly, one scanline at a time.
+ */
+struct png_reader {
+	FILE *fp;
+	png_structp png;
+	png_infop info;
+	int width, height, nchan;
+	int rowsz;
+};
+
+struct png_writer {
+	FILE *fp;
+	png_structp png;
+	png_infop info;
+};
+
+/* encoder thread of expand_nearest_png */
+struct png_stream {
+	struct png_writer wr;
+	struct img_pixmap *img;
+	int nchan;
+	unsigned char *rowbuf;	/* 8 bit copy of the current row, for the other formats */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;				/* rows [0, ready) are final */
+	int abort;
+	int failed;
+};
+
+static void *encode_func(void *arg);
+static void set_ready(struct png_stream *ps, int ready, int abort);
+static int format_nchan(int fmt);
+static void quantize_row(unsigned char *dest, const struct img_pixmap *img, int y, int nchan);
+static int open_png(struct png_reader *rd, const char *fname, int grey);
+static int read_rows(struct png_reader *rd, unsigned char *dest, int count);
+static void close_png(struct png_reader *rd);
+static int create_png(struct png_writer *wr, const char *fname, int width, int height, int nchan);
+static int write_rows(struct png_writer *wr, unsigned char *src, int rowsz, int count);
+static int finish_png(struct png_writer *wr);
+
+int expand_stream(const char *outfname, const char *infname, const char *maskfname,
+		const struct bitmask *mask, int max_dist, long membudget)
+{
+	struct png_reader in, inmask;
+	struct png_writer out;
+	struct img_pixmap imgwin;
+	struct bitmask maskwin, maskbuf;
+	unsigned char *pixbuf = 0, *maskrow = 0;
+	int *nearest = 0;
+	int width, height, rowsz, winrows, band, y, wy0, wy1, res = -1;
+	long rowmem;
+
+	static const enum img_fmt fmt_by_nchan[] = {
+		0, IMG_FMT_GREY8, 0, IMG_FMT_RGB24, IMG_FMT_RGBA32
+	};
+
+	if(max_dist <= 0) {
+		fprintf(stderr, "expand_stream: streaming expansion requires a finite radius\n");
+		return -1;
+	}
+
+	memset(&inmask, 0, sizeof inmask);
+	memset(&out, 0, sizeof out);
+	maskbuf.bits = 0;
+
+	if(open_png(&in, infname, 0) == -1) {
+		return -1;
+	}
+	width = in.width;
+	height = in.height;
+	rowsz = in.rowsz;
+
+	if(maskfname) {
+		if(open_png(&inmask, maskfname, 1) == -1) {
+			goto end;
+		}
+		if(inmask.width != width || inmask.height != height) {
+			fprintf(stderr, "texture (%s) and mask (%s) dimensions differ\n", infname, maskfname);
+			goto end;
+		}
+	} else if(mask->width != width || mask->height != height) {
+		fprintf(stderr, "texture %s dimensions differ from the mask\n", infname);
+		goto end;
+	}
+
+	/* window of rows kept in memory: pixels, nearest texel map, and packed
+	 * mask if it's streamed. A band needs max_dist rows of context above and
+	 * below.
+	 */
+	rowmem = rowsz + width * sizeof *nearest + (maskfname ? ((width + 63) >> 6) * 8 : 0);
+	winrows = membudget / rowmem;
+	if(winrows >= height) {
+		winrows = band = height;
+	} else {
+		band = winrows - 2 * max_dist;
+	}
+	if(band < 1) {
+		fprintf(stderr, "expand_stream: memory budget too small for radius %d, need at least %ld bytes\n",
+				max_dist, (2 * max_dist + 1) * rowmem);
+		goto end;
+	}
+
+	if(!(pixbuf = malloc((size_t)winrows * rowsz)) ||
+			!(nearest = malloc((size_t)winrows * width * sizeof *nearest)) ||
+			(maskfname && !(maskrow = malloc(width)))) {
+		fprintf(stderr, "expand_stream: failed to allocate %d row window\n", winrows);
+		goto end;
+	}
+	if(maskfname && bitmask_init(&maskbuf, width, winrows) == -1) {
+		goto end;
+	}
+
+	if(create_png(&out, outfname, width, height, in.nchan) == -1) {
+		goto end;
+	}
+
+	img_init(&imgwin);
+	imgwin.width = width;
+	imgwin.fmt = fmt_by_nchan[in.nchan];
+	imgwin.pixelsz = in.nchan;
+	imgwin.pixels = pixbuf;
+
+	/* rows [wy0, wy1) are currently in the window */
+	wy0 = wy1 = 0;
+
+	for(y=0; y<height; y+=band) {
+		int ycount = height - y < band ? height - y : band;
+		int need0 = y > max_dist ? y - max_dist : 0;
+		int need1 = y + ycount + max_dist < height ? y + ycount + max_dist : height;
+
+		/* slide the window down, dropping the rows no longer needed */
+		if(need0 > wy0) {
+			int drop = need0 - wy0;
+			int keep = wy1 - need0;
+
+			memmove(pixbuf, pixbuf + (size_t)drop * rowsz, (size_t)keep * rowsz);
+			if(maskfname) {
+				memmove(maskbuf.bits, BITMASK_ROW(&maskbuf, drop), keep * maskbuf.pitch * sizeof *maskbuf.bits);
+			}
+			wy0 = need0;
+		}
+
+		if(read_rows(&in, pixbuf + (size_t)(wy1 - wy0) * rowsz, need1 - wy1) == -1) {
+			goto end;
+		}
+		if(maskfname) {
+			for(; wy1<need1; wy1++) {
+				if(read_rows(&inmask, maskrow, 1) == -1) {
+					goto end;
+				}
+				bitmask_pack_row(&maskbuf, wy1 - wy0, maskrow, EXPAND_MASK_THRES);
+			}
+			bitmask_rows(&maskwin, &maskbuf, 0, need1 - wy0);
+		} else {
+			bitmask_rows(&maskwin, mask, wy0, need1 - wy0);
+		}
+		wy1 = need1;
+		imgwin.height = wy1 - wy0;
+
+		/* every texel within max_dist of the band is in the window, so the
+		 * nearest texel search doesn't need to look any further
+		 */
+		if(calc_nearest(nearest, max_dist, &maskwin) == -1) {
+			goto end;
+		}
+		if(expand_nearest_scanlines(&imgwin, y - wy0, ycount, &imgwin, nearest) == -1) {
+			goto end;
+		}
+
+		if(write_rows(&out, pixbuf + (size_t)(y - wy0) * rowsz, rowsz, ycount) == -1) {
+			goto end;
+		}
+	}
+
+	if(finish_png(&out) == -1) {
+		goto end;
+	}
+	res = 0;
+
+end:
+	if(out.png) {
+		png_destroy_write_struct(&out.png, &out.info);
+		fclose(out.fp);
+	}
+	close_png(&in);
+	if(inmask.png) {
+		close_png(&inmask);
+	}
+	free(pixbuf);
+	free(maskrow);
+	bitmask_destroy(&maskbuf);
+	free(nearest);
+	return res;
+}
+
+int expand_nearest_png(const char *outfname, struct img_pixmap *img, const int *nearest)
+{
+	struct png_stream ps;
+	pthread_t thread;
+	int y, band, res = 0;
+
+	memset(&ps, 0, sizeof ps);
+	ps.img = img;
+	if(!(ps.nchan = format_nchan(img->fmt))) {
+		fprintf(stderr, "expand_nearest_png: unsupported pixel format: %d\n", (int)img->fmt);
+		return -1;
+	}
+	if(img->fmt != IMG_FMT_GREY8 && img->fmt != IMG_FMT_RGB24 && img->fmt != IMG_FMT_RGBA32) {
+		if(!(ps.rowbuf = malloc(img->width * ps.nchan))) {
+			fprintf(stderr, "expand_nearest_png: failed to allocate row buffer\n");
+			return -1;
+		}
+	}
+	if(create_png(&ps.wr, outfname, img->width, img->height, ps.nchan) == -1) {
+		free(ps.rowbuf);
+		return -1;
+	}
+
+	pthread_mutex_init(&ps.lock, 0);
+	pthread_cond_init(&ps.cond, 0);
+
+	if(pthread_create(&thread, 0, encode_func, &ps) != 0) {
+		/* no overlap then, expand everything and encode it afterwards */
+		if(expand_nearest(img, img, nearest) == -1) {
+			set_ready(&ps, 0, 1);
+		} else {
+			set_ready(&ps, img->height, 0);
+		}
+		encode_func(&ps);
+	} else {
+		if((band = BAND_TEXELS / img->width) < 1) {
+			band = 1;
+		}
+		for(y=0; y<img->height; y+=band) {
+			int ycount = img->height - y < band ? img->height - y : band;
+
+			if(expand_nearest_scanlines(img, y, ycount, img, nearest) == -1) {
+				set_ready(&ps, y, 1);
+				break;
+			}
+			set_ready(&ps, y + ycount, 0);
+		}
+		pthread_join(thread, 0);
+	}
+
+	if(ps.abort || ps.failed || finish_png(&ps.wr) == -1) {
+		res = -1;
+	}
+	png_destroy_write_struct(&ps.wr.png, &ps.wr.info);
+	fclose(ps.wr.fp);
+	if(res == -1) {
+		remove(outfname);
+	}
+
+	pthread_mutex_destroy(&ps.lock);
+	pthread_cond_destroy(&ps.cond);
+	free(ps.rowbuf);
+	return res;
+}
+
+int is_png(const char *fname)
+{
+	const char *suffix = strrchr(fname, '.');
+	return suffix && strcasecmp(suffix, ".png") == 0;
+}
+
+int png_dimensions(const char *fname, int *width, int *height)
+{
+	struct png_reader rd;
+
+	if(open_png(&rd, fname, 0) == -1) {
+		return -1;
+	}
+	*width = rd.width;
+	*height = rd.height;
+	close_png(&rd);
+	return 0;
+}
+
+int image_size(const char *fname, int *width, int *height)
+{
+	FILE *fp;
+	struct img_pixmap tmp;
+
+	if(!(fp = fopen(fname, "rb"))) {
+		return -1;
+	}
+	fclose(fp);
+
+	if(is_png(fname)) {
+		return png_dimensions(fname, width, height);
+	}
+	if(raw_is_raw(fname)) {
+		return raw_size(fname, width, height);
+	}
+
+	img_init(&tmp);
+	if(img_load(&tmp, fname) == -1) {
+		return -1;
+	}
+	*width = tmp.width;
+	*height = tmp.height;
+	img_destroy(&tmp);
+	return 0;
+}
+
+/* encode the rows as they become final, until the whole image is done, the
+ * expansion is aborted, or writing fails
+ */
+static void *encode_func(void *arg)
+{
+	struct png_stream *ps = arg;
+	struct img_pixmap *img = ps->img;
+	int y = 0, ready;
+	int rowsz = img->width * img->pixelsz;
+
+	while(y < img->height) {
+		pthread_mutex_lock(&ps->lock);
+		while(ps->ready <= y && !ps->abort) {
+			pthread_cond_wait(&ps->cond, &ps->lock);
+		}
+		ready = ps->ready;
+		pthread_mutex_unlock(&ps->lock);
+
+		if(ps->abort) break;
+
+		for(; y<ready; y++) {
+			unsigned char *row = (unsigned char*)img->pixels + (size_t)y * rowsz;
+
+			if(ps->rowbuf) {
+				quantize_row(ps->rowbuf, img, y, ps->nchan);
+				row = ps->rowbuf;
+			}
+			if(write_rows(&ps->wr, row, 0, 1) == -1) {
+				ps->failed = 1;
+				return 0;
+			}
+		}
+	}
+	return 0;
+}
+
+static void set_ready(struct png_stream *ps, int ready, int abort)
+{
+	pthread_mutex_lock(&ps->lock);
+	ps->ready = ready;
+	ps->abort = abort;
+	pthread_cond_signal(&ps->cond);
+	pthread_mutex_unlock(&ps->lock);
+}
+
+static int format_nchan(int fmt)
+{
+	switch(fmt) {
+	case IMG_FMT_GREY8:
+	case IMG_FMT_GREYF:
+		return 1;
+	case IMG_FMT_RGB24:
+	case IMG_FMT_RGBF:
+	case IMG_FMT_RGB565:
+		return 3;
+	case IMG_FMT_RGBA32:
+	case IMG_FMT_RGBAF:
+		return 4;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void quantize_row(unsigned char *dest, const struct img_pixmap *img, int y, int nchan)
+{
+	int i, count = img->width * nchan;
+
+	if(img->fmt == IMG_FMT_RGB565) {
+		const unsigned short *src = (const unsigned short*)img->pixels + y * img->width;
+		for(i=0; i<img->width; i++) {
+			unsigned int pix = *src++;
+			*dest++ = ((pix >> 11) & 0x1f) * 255 / 31;
+			*dest++ = ((pix >> 5) & 0x3f) * 255 / 63;
+			*dest++ = (pix & 0x1f) * 255 / 31;
+		}
+	} else {
+		const float *src = (const float*)img->pixels + (size_t)y * count;
+		for(i=0; i<count; i++) {
+			float val = *src++;
+			*dest++ = val <= 0.0f ? 0 : (val >= 1.0f ? 255 : (int)(val * 255.0f + 0.5f));
+		}
+	}
+}
+
+/* opens a PNG file for reading, and sets up the transformations to 8 bits per
+ * channel greyscale, RGB, or RGBA. If grey is non-zero, everything is
+ * converted to single channel greyscale.
+ */
+static int open_png(struct png_reader *rd, const char *fname, int grey)
+{
+	int color, depth;
+
+	memset(rd, 0, sizeof *rd);
+
+	if(!(rd->fp = fopen(fname, "rb"))) {
+		fprintf(stderr, "failed to open %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if(!(rd->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0)) ||
+			!(rd->info = png_create_info_struct(rd->png))) {
+		fprintf(stderr, "failed to initialize libpng\n");
+		goto err;
+	}
+	if(setjmp(png_jmpbuf(rd->png))) {
+		fprintf(stderr, "failed to read PNG file: %s\n", fname);
+		goto err;
+	}
+
+	png_init_io(rd->png, rd->fp);
+	png_read_info(rd->png, rd->info);
+
+	if(png_get_interlace_type(rd->png, rd->info) != PNG_INTERLACE_NONE) {
+		fprintf(stderr, "%s: interlaced PNG files can't be streamed\n", fname);
+		goto err;
+	}
+
+	color = png_get_color_type(rd->png, rd->info);
+	depth = png_get_bit_depth(rd->png, rd->info);
+
+	if(color == PNG_COLOR_TYPE_PALETTE) {
+		png_set_palette_to_rgb(rd->png);
+	}
+	if(color == PNG_COLOR_TYPE_GRAY && depth < 8) {
+		png_set_expand_gray_1_2_4_to_8(rd->png);
+	}
+	if(depth == 16) {
+		png_set_strip_16(rd->png);
+	}
+
+	if(grey) {
+		png_set_strip_alpha(rd->png);
+		if(color & PNG_COLOR_MASK_COLOR) {
+			png_set_rgb_to_gray_fixed(rd->png, 1, -1, -1);
+		}
+	} else {
+		if(png_get_valid(rd->png, rd->info, PNG_INFO_tRNS)) {
+			png_set_tRNS_to_alpha(rd->png);
+		}
+		if(color == PNG_COLOR_TYPE_GRAY_ALPHA) {
+			png_set_gray_to_rgb(rd->png);
+		}
+	}
+	png_read_update_info(rd->png, rd->info);
+
+	rd->width = png_get_image_width(rd->png, rd->info);
+	rd->height = png_get_image_height(rd->png, rd->info);
+	rd->nchan = png_get_channels(rd->png, rd->info);
+	rd->rowsz = png_get_rowbytes(rd->png, rd->info);
+	return 0;
+
+err:
+	close_png(rd);
+	return -1;
+}
+
+static int read_rows(struct png_reader *rd, unsigned char *dest, int count)
+{
+	int i;
+
+	if(setjmp(png_jmpbuf(rd->png))) {
+		fprintf(stderr, "failed to read PNG scanlines\n");
+		return -1;
+	}
+	for(i=0; i<count; i++) {
+		png_read_row(rd->png, dest, 0);
+		dest += rd->rowsz;
+	}
+	return 0;
+}
+
+static void close_png(struct png_reader *rd)
+{
+	if(rd->png) {
+		png_destroy_read_struct(&rd->png, rd->info ? &rd->info : 0, 0);
+	}
+	if(rd->fp) {
+		fclose(rd->fp);
+	}
+	memset(rd, 0, sizeof *rd);
+}
+
+static int create_png(struct png_writer *wr, const char *fname, int width, int height, int nchan)
+{
+	static const int color_by_nchan[] = {
+		0, PNG_COLOR_TYPE_GRAY, 0, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA
+	};
+
+	memset(wr, 0, sizeof *wr);
+
+	if(!(wr->fp = fopen(fname, "wb"))) {
+		fprintf(stderr, "failed to open %s for writing: %s\n", fname, strerror(errno));
+		return -1;
+	}
+	if(!(wr->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0)) ||
+			!(wr->info = png_create_info_struct(wr->png))) {
+		fprintf(stderr, "failed to initialize libpng\n");
+		goto err;
+	}
+	if(setjmp(png_jmpbuf(wr->png))) {
+		fprintf(stderr, "failed to write PNG file: %s\n", fname);
+		goto err;
+	}
+
+	png_init_io(wr->png, wr->fp);
+	png_set_IHDR(wr->png, wr->info, width, height, 8, color_by_nchan[nchan],
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(wr->png, wr->info);
+	return 0;
+
+err:
+	if(wr->png) {
+		png_destroy_write_struct(&wr->png, wr->info ? &wr->info : 0);
+	}
+	fclose(wr->fp);
+	memset(wr, 0, sizeof *wr);
+	return -1;
+}
+
+static int write_rows(struct png_writer *wr, unsigned char *src, int rowsz, int count)
+{
+	int i;
+
+	if(setjmp(png_jmpbuf(wr->png))) {
+		fprintf(stderr, "failed to write PNG scanlines\n");
+		return -1;
+	}
+	for(i=0; i<count; i++) {
+		png_write_row(wr->png, src);
+		src += rowsz;
+	}
+	return 0;
+}
+
+static int finish_png(struct png_writer *wr)
+{
+	if(setjmp(png_jmpbuf(wr->png))) {
+		fprintf(stderr, "failed to finish writing PNG file\n");
+		return -1;
+	}
+	png_write_end(wr->png, 0);
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STREAM_H_
+#define STREAM_H_
+
+struct bitmask;
+struct img_pixmap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Out-of-core expansion of PNG images, which don't need to fit in memory.
+ * The image is processed in horizontal bands, sized so that the band plus the
+ * max_dist rows above and below it fit in membudget bytes. Only those rows are
+ * read from the input, and each band is written to the output file as soon as
+ * it's done. max_dist must be positive.
+ *
+ * The mask is either streamed along with the input from the maskfname PNG file,
+ * or if maskfname is null, taken from the in-memory bitmask.
+ */
+int expand_stream(const char *outfname, const char *infname, const char *maskfname,
+		const struct bitmask *mask, int max_dist, long membudget);
+
+/* Expand img in place with a nearest texel map (see calc_nearest), and write
+ * it to a PNG file at the same time: the image is gathered in bands of rows,
+ * and every finished band is handed to an encoder thread, which deflates it
+ * while the next bands are expanded. Float and RGB565 images are quantized to
+ * 8 bits per channel one row at a time.
+ */
+int expand_nearest_png(const char *outfname, struct img_pixmap *img, const int *nearest);
+
+/* non-zero if fname has the .png suffix */
+int is_png(const char *fname);
+
+/* read just the dimensions of a PNG file */
+int png_dimensions(const char *fname, int *width, int *height);
+
+/* dimensions of any image file imago can load, without decoding PNG files */
+int image_size(const char *fname, int *width, int *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* STREAM_H_ */
@@ -0,0 +1,324 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <omp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "swrast.h"
+
+#define SUBPIX_BITS		8
+#define SUBPIX			(1 << SUBPIX_BITS)
+#define HALF_SUBPIX		(SUBPIX / 2)
+
+#define RTILE_SHIFT		6
+#define RTILE_SIZE		(1 << RTILE_SHIFT)
+
+/* Vertex coordinates are limited to +/- 2^25 subpixels, so that every edge
+ * function value is an integer below 2^53, and exact in a double
+ */
+#define MAX_COORD		33554432.0
+
+/* triangle, with its texel bounding box (empty if x0 > x1) */
+struct tri {
+	const float *uv;
+	int x0, y0, x1, y1;
+};
+
+/* Edge functions e = a * x + b * y + c, in subpixels, positive inside. c
+ * includes the fill convention bias, so that the covered texels are the ones
+ * with all three e >= 0.
+ */
+struct tri_setup {
+	double a[3], b[3], c[3];
+	int x0, y0, x1, y1;
+};
+
+static int setup_tri(struct tri_setup *ts, const float *uv, int xsz, int ysz);
+static void raster_tri(unsigned char *pixels, int xsz, const struct tri_setup *ts,
+		int x0, int y0, int x1, int y1);
+
+int swrast_draw(unsigned char *pixels, int xsz, int ysz, const struct swrast_batch *batches,
+		int num_batches)
+{
+	int i, xtiles, ytiles, num_tiles, max_thr, num_tri = 0, res = -1;
+	struct tri *tris = 0;
+	int *counts = 0, *tile_start = 0, *bins = 0;
+
+	xtiles = (xsz + RTILE_SIZE - 1) >> RTILE_SHIFT;
+	ytiles = (ysz + RTILE_SIZE - 1) >> RTILE_SHIFT;
+	num_tiles = xtiles * ytiles;
+	max_thr = omp_get_max_threads();
+
+	for(i=0; i<num_batches; i++) {
+		num_tri += batches[i].num_tri;
+	}
+
+	if(!(tris = malloc(num_tri * sizeof *tris + 1)) ||
+			!(counts = calloc((size_t)max_thr * num_tiles + 1, sizeof *counts)) ||
+			!(tile_start = malloc((num_tiles + 1) * sizeof *tile_start))) {
+		fprintf(stderr, "swrast_draw: failed to allocate memory\n");
+		goto end;
+	}
+
+	/* bounding boxes of every triangle */
+	num_tri = 0;
+	for(i=0; i<num_batches; i++) {
+		int j;
+		struct tri *tptr = tris + num_tri;
+		const float *uv = batches[i].uv;
+
+#pragma omp parallel for schedule(static)
+		for(j=0; j<batches[i].num_tri; j++) {
+			struct tri_setup ts;
+
+			tptr[j].uv = uv + j * 6;
+			if(setup_tri(&ts, tptr[j].uv, xsz, ysz) == -1) {
+				tptr[j].x0 = 1;
+				tptr[j].x1 = 0;
+				continue;
+			}
+			tptr[j].x0 = ts.x0;
+			tptr[j].y0 = ts.y0;
+			tptr[j].x1 = ts.x1;
+			tptr[j].y1 = ts.y1;
+		}
+		num_tri += batches[i].num_tri;
+	}
+
+	/* Bin the triangles into the tiles they overlap. Both passes split the
+	 * triangles between the threads the same way, so every thread knows where
+	 * its part of each bin starts, and every bin lists its triangles in order
+	 */
+#pragma omp parallel
+	{
+		int j, tx, ty, tile, thr = omp_get_thread_num(), num_thr = omp_get_num_threads();
+		int start = (int)((long long)num_tri * thr / num_thr);
+		int end = (int)((long long)num_tri * (thr + 1) / num_thr);
+		int *count = counts + thr * num_tiles;
+
+		for(j=start; j<end; j++) {
+			struct tri *tri = tris + j;
+			if(tri->x0 > tri->x1) continue;
+
+			for(ty=tri->y0 >> RTILE_SHIFT; ty<=tri->y1 >> RTILE_SHIFT; ty++) {
+				for(tx=tri->x0 >> RTILE_SHIFT; tx<=tri->x1 >> RTILE_SHIFT; tx++) {
+					count[ty * xtiles + tx]++;
+				}
+			}
+		}
+
+#pragma omp barrier
+#pragma omp single
+		{
+			int k, offs = 0;
+			for(tile=0; tile<num_tiles; tile++) {
+				tile_start[tile] = offs;
+				for(k=0; k<num_thr; k++) {
+					int n = counts[k * num_tiles + tile];
+					counts[k * num_tiles + tile] = offs;
+					offs += n;
+				}
+			}
+			tile_start[num_tiles] = offs;
+
+			if(!(bins = malloc(offs * sizeof *bins + 1))) {
+				fprintf(stderr, "swrast_draw: failed to allocate tile bins\n");
+			}
+		}
+
+		if(bins) {
+			for(j=start; j<end; j++) {
+				struct tri *tri = tris + j;
+				if(tri->x0 > tri->x1) continue;
+
+				for(ty=tri->y0 >> RTILE_SHIFT; ty<=tri->y1 >> RTILE_SHIFT; ty++) {
+					for(tx=tri->x0 >> RTILE_SHIFT; tx<=tri->x1 >> RTILE_SHIFT; tx++) {
+						bins[count[ty * xtiles + tx]++] = j;
+					}
+				}
+			}
+		}
+
+#pragma omp barrier
+		if(bins) {
+#pragma omp for schedule(dynamic)
+			for(tile=0; tile<num_tiles; tile++) {
+				int k, y;
+				int x0 = (tile % xtiles) << RTILE_SHIFT;
+				int y0 = (tile / xtiles) << RTILE_SHIFT;
+				int x1 = x0 + RTILE_SIZE - 1;
+				int y1 = y0 + RTILE_SIZE - 1;
+
+				if(x1 >= xsz) x1 = xsz - 1;
+				if(y1 >= ysz) y1 = ysz - 1;
+
+				for(y=y0; y<=y1; y++) {
+					memset(pixels + y * xsz + x0, 0, x1 - x0 + 1);
+				}
+
+				for(k=tile_start[tile]; k<tile_start[tile + 1]; k++) {
+					struct tri_setup ts;
+					const struct tri *tri = tris + bins[k];
+
+					setup_tri(&ts, tri->uv, xsz, ysz);
+					raster_tri(pixels, xsz, &ts, ts.x0 > x0 ? ts.x0 : x0, ts.y0 > y0 ? ts.y0 : y0,
+							ts.x1 < x1 ? ts.x1 : x1, ts.y1 < y1 ? ts.y1 : y1);
+				}
+			}
+		}
+	}
+	if(bins) res = 0;
+
+end:
+	free(bins);
+	free(tile_start);
+	free(counts);
+	free(tris);
+	return res;
+}
+
+/* snap the vertices to the subpixel grid, and set up the edge functions.
+ * Returns -1 for triangles which don't cover any texel
+ */
+static int setup_tri(struct tri_setup *ts, const float *uv, int xsz, int ysz)
+{
+	int i;
+	int64_t x[3], y[3], tmp, area, minx, miny, maxx, maxy;
+
+	for(i=0; i<3; i++) {
+		double u = uv[i * 2] * (double)xsz * SUBPIX;
+		double v = uv[i * 2 + 1] * (double)ysz * SUBPIX;
+		if(!(fabs(u) < MAX_COORD && fabs(v) < MAX_COORD)) {
+			return -1;
+		}
+		x[i] = (int64_t)floor(u + 0.5);
+		y[i] = (int64_t)floor(v + 0.5);
+	}
+
+	/* counter-clockwise, for the edge functions to be positive inside */
+	area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if(!area) return -1;
+	if(area < 0) {
+		tmp = x[1]; x[1] = x[2]; x[2] = tmp;
+		tmp = y[1]; y[1] = y[2]; y[2] = tmp;
+	}
+
+	minx = maxx = x[0];
+	miny = maxy = y[0];
+	for(i=1; i<3; i++) {
+		if(x[i] < minx) minx = x[i];
+		if(x[i] > maxx) maxx = x[i];
+		if(y[i] < miny) miny = y[i];
+		if(y[i] > maxy) maxy = y[i];
+	}
+
+	/* texels with their centers in the bounding box */
+	minx = (minx - HALF_SUBPIX + SUBPIX - 1) >> SUBPIX_BITS;
+	miny = (miny - HALF_SUBPIX + SUBPIX - 1) >> SUBPIX_BITS;
+	maxx = (maxx - HALF_SUBPIX) >> SUBPIX_BITS;
+	maxy = (maxy - HALF_SUBPIX) >> SUBPIX_BITS;
+	ts->x0 = minx < 0 ? 0 : (int)minx;
+	ts->y0 = miny < 0 ? 0 : (int)miny;
+	ts->x1 = maxx >= xsz ? xsz - 1 : (int)maxx;
+	ts->y1 = maxy >= ysz ? ysz - 1 : (int)maxy;
+	if(ts->x0 > ts->x1 || ts->y0 > ts->y1) {
+		return -1;
+	}
+
+	for(i=0; i<3; i++) {
+		int j = i < 2 ? i + 1 : 0;
+		int64_t a = y[i] - y[j];
+		int64_t b = x[j] - x[i];
+		int64_t c = -(a * x[i] + b * y[i]);
+
+		/* texels on left edges (inside to the right), and top edges (inside
+		 * below, along the direction of v), are covered
+		 */
+		if(!(a > 0 || (a == 0 && b < 0))) {
+			c--;
+		}
+		ts->a[i] = (double)a;
+		ts->b[i] = (double)b;
+		ts->c[i] = (double)c;
+	}
+	return 0;
+}
+
+static void raster_tri(unsigned char *pixels, int xsz, const struct tri_setup *ts,
+		int x0, int y0, int x1, int y1)
+{
+	int i, x, y;
+	double px = (double)x0 * SUBPIX + HALF_SUBPIX;
+	double e[3], dx[3];
+
+	for(i=0; i<3; i++) {
+		dx[i] = ts->a[i] * SUBPIX;
+	}
+
+	for(y=y0; y<=y1; y++) {
+		unsigned char *row = pixels + y * xsz;
+		double py = (double)y * SUBPIX + HALF_SUBPIX;
+
+		for(i=0; i<3; i++) {
+			e[i] = ts->a[i] * px + ts->b[i] * py + ts->c[i];
+		}
+		x = x0;
+
+#ifdef __SSE2__
+		{
+			__m128d zero = _mm_setzero_pd();
+			__m128d e0 = _mm_set_pd(e[0] + dx[0], e[0]);
+			__m128d e1 = _mm_set_pd(e[1] + dx[1], e[1]);
+			__m128d e2 = _mm_set_pd(e[2] + dx[2], e[2]);
+			__m128d step0 = _mm_set1_pd(dx[0] * 2.0);
+			__m128d step1 = _mm_set1_pd(dx[1] * 2.0);
+			__m128d step2 = _mm_set1_pd(dx[2] * 2.0);
+
+			for(; x<x1; x+=2) {
+				__m128d in = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(e0, zero), _mm_cmpge_pd(e1, zero)),
+						_mm_cmpge_pd(e2, zero));
+				int bits = _mm_movemask_pd(in);
+
+				if(bits & 1) row[x] = 255;
+				if(bits & 2) row[x + 1] = 255;
+
+				e0 = _mm_add_pd(e0, step0);
+				e1 = _mm_add_pd(e1, step1);
+				e2 = _mm_add_pd(e2, step2);
+			}
+			_mm_storel_pd(e, e0);
+			_mm_storel_pd(e + 1, e1);
+			_mm_storel_pd(e + 2, e2);
+		}
+#endif
+
+		for(; x<=x1; x++) {
+			if(e[0] >= 0.0 && e[1] >= 0.0 && e[2] >= 0.0) {
+				row[x] = 255;
+			}
+			e[0] += dx[0];
+			e[1] += dx[1];
+			e[2] += dx[2];
+		}
+	}
+}
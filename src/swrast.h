@@ -0,0 +1,48 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SWRAST_H_
+#define SWRAST_H_
+
+/* a run of triangles: 3 u,v pairs per triangle, in [0, 1] texture space */
+struct swrast_batch {
+	const float *uv;
+	int num_tri;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Software rasterizer for the texture usage mask, for when there's no OpenGL.
+ * Writes xsz x ysz 8bit texels: 255 where the texel center is covered by any
+ * triangle, and 0 elsewhere. Row 0 is v = 0, as in the OpenGL rendering, and
+ * the sampling rules are the same: texel centers, vertices snapped to 1/256th
+ * of a texel, and texels exactly on an edge going to the triangle on its top
+ * or left side.
+ *
+ * The triangles are binned into 64x64 tiles, and the tiles are rasterized in
+ * parallel, each by a single thread.
+ */
+int swrast_draw(unsigned char *pixels, int xsz, int ysz, const struct swrast_batch *batches,
+		int num_batches);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* SWRAST_H_ */
@@ -0,0 +1,273 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <omp.h>
+#include <imago2.h>
+#include "texpand.h"
+#include "arena.h"
+#include "bitmask.h"
+#include "expand.h"
+#include "pullpush.h"
+#include "genmask.h"
+
+struct texpand_ctx {
+	int num_threads;
+
+	/* the current mask, and its tile index once needed */
+	struct arena mask_mem;
+	struct bitmask bmask;
+	struct bitmask_tiles tiles;
+	unsigned char *tile_state;
+	int has_mask, has_tiles;
+
+	/* nearest texel map of the current mask for nearest_radius, or null */
+	struct arena nearest_mem;
+	int *nearest;
+	int nearest_radius;
+
+	struct arena scratch;		/* per call scratch space */
+	struct img_pixmap maskimg;	/* rasterized masks */
+};
+
+static int run_edt(struct texpand_ctx *ctx, struct img_pixmap *img, int radius);
+static int run_pullpush(struct texpand_ctx *ctx, struct img_pixmap *img);
+static int run_search(struct texpand_ctx *ctx, struct img_pixmap *img, int radius);
+static int grow_render(int width, int height);
+
+/* The mask rendering context of the process, shared by all texpand contexts.
+ * It's current on the thread which created it, so that's the only thread
+ * allowed to rasterize masks, and it's released with the last texpand context.
+ */
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t render_thread;
+static int render_xsz, render_ysz;	/* 0 until the first rasterized mask */
+static int num_contexts;
+
+struct texpand_ctx *texpand_create(int num_threads)
+{
+	struct texpand_ctx *ctx;
+
+	if(!(ctx = calloc(1, sizeof *ctx))) {
+		fprintf(stderr, "texpand_create: failed to allocate context\n");
+		return 0;
+	}
+	ctx->num_threads = num_threads > 0 ? num_threads : omp_get_max_threads();
+
+	pthread_mutex_lock(&render_lock);
+	num_contexts++;
+	pthread_mutex_unlock(&render_lock);
+
+	arena_init(&ctx->mask_mem);
+	arena_init(&ctx->nearest_mem);
+	arena_init(&ctx->scratch);
+	img_init(&ctx->maskimg);
+
+	/* start the worker threads now, instead of in the first expansion */
+#pragma omp parallel num_threads(ctx->num_threads)
+	{
+	}
+	return ctx;
+}
+
+void texpand_destroy(struct texpand_ctx *ctx)
+{
+	if(!ctx) return;
+
+	pthread_mutex_lock(&render_lock);
+	if(--num_contexts == 0 && render_xsz) {
+		if(pthread_equal(render_thread, pthread_self())) {
+			end_gen_mask();
+			render_xsz = render_ysz = 0;
+		} else {
+			fprintf(stderr, "texpand_destroy: can't release the mask rendering context from another thread\n");
+		}
+	}
+	pthread_mutex_unlock(&render_lock);
+
+	arena_destroy(&ctx->mask_mem);
+	arena_destroy(&ctx->nearest_mem);
+	arena_destroy(&ctx->scratch);
+	img_destroy(&ctx->maskimg);
+	free(ctx);
+}
+
+int texpand_set_mask(struct texpand_ctx *ctx, struct img_pixmap *mask)
+{
+	int prev_threads;
+	size_t bmsize, tilesize;
+
+	if(mask->fmt != IMG_FMT_GREY8) {
+		fprintf(stderr, "texpand_set_mask: the mask must be a GREY8 image\n");
+		return -1;
+	}
+	ctx->has_mask = ctx->has_tiles = 0;
+	ctx->nearest = 0;
+
+	bmsize = bitmask_size(mask->width, mask->height);
+	tilesize = bitmask_tiles_size(mask->width, mask->height);
+	if(arena_reset(&ctx->mask_mem, ARENA_SIZE(bmsize) + ARENA_SIZE(tilesize)) == -1) {
+		return -1;
+	}
+	bitmask_init_buf(&ctx->bmask, mask->width, mask->height, arena_alloc(&ctx->mask_mem, bmsize));
+	ctx->tile_state = arena_alloc(&ctx->mask_mem, tilesize);
+
+	prev_threads = omp_get_max_threads();
+	omp_set_num_threads(ctx->num_threads);
+	bitmask_pack(&ctx->bmask, mask, EXPAND_MASK_THRES);
+	omp_set_num_threads(prev_threads);
+
+	ctx->has_mask = 1;
+	return 0;
+}
+
+int texpand_set_mask_scene(struct texpand_ctx *ctx, int width, int height, struct uvscene *scn,
+		int uvset, const char *filter)
+{
+	int res, prev_threads;
+
+	pthread_mutex_lock(&render_lock);
+	if(render_xsz && !pthread_equal(render_thread, pthread_self())) {
+		pthread_mutex_unlock(&render_lock);
+		fprintf(stderr, "texpand_set_mask_scene: masks can only be rasterized by the thread which rasterized the first one\n");
+		return -1;
+	}
+	res = grow_render(width, height);
+	pthread_mutex_unlock(&render_lock);
+	if(res == -1) {
+		return -1;
+	}
+
+	prev_threads = omp_get_max_threads();
+	omp_set_num_threads(ctx->num_threads);
+	res = gen_mask(&ctx->maskimg, width, height, scn, uvset, filter);
+	omp_set_num_threads(prev_threads);
+
+	if(res == -1) {
+		return -1;
+	}
+	return texpand_set_mask(ctx, &ctx->maskimg);
+}
+
+int texpand_expand(struct texpand_ctx *ctx, struct img_pixmap *img, int radius, int alg)
+{
+	int res, prev_threads;
+
+	if(!ctx->has_mask) {
+		fprintf(stderr, "texpand_expand: no mask\n");
+		return -1;
+	}
+	if(img->width != ctx->bmask.width || img->height != ctx->bmask.height) {
+		fprintf(stderr, "texpand_expand: image (%dx%d) and mask (%dx%d) dimensions differ\n",
+				img->width, img->height, ctx->bmask.width, ctx->bmask.height);
+		return -1;
+	}
+
+	prev_threads = omp_get_max_threads();
+	omp_set_num_threads(ctx->num_threads);
+
+	switch(alg) {
+	case TEXPAND_SEARCH:
+		res = run_search(ctx, img, radius);
+		break;
+
+	case TEXPAND_PULLPUSH:
+		res = run_pullpush(ctx, img);
+		break;
+
+	default:
+		res = run_edt(ctx, img, radius);
+	}
+
+	omp_set_num_threads(prev_threads);
+	return res;
+}
+
+/* the nearest texel map is kept until the mask or the radius change */
+static int run_edt(struct texpand_ctx *ctx, struct img_pixmap *img, int radius)
+{
+	size_t size, scratch_size;
+	void *scratch;
+
+	if(!ctx->nearest || ctx->nearest_radius != radius) {
+		size = (size_t)img->width * img->height * sizeof *ctx->nearest;
+		scratch_size = calc_nearest_scratch_size(img->height) * ctx->num_threads;
+
+		if(!ctx->nearest) {
+			if(arena_reset(&ctx->nearest_mem, ARENA_SIZE(size)) == -1) {
+				return -1;
+			}
+			ctx->nearest = arena_alloc(&ctx->nearest_mem, size);
+		}
+		if(arena_reset(&ctx->scratch, ARENA_SIZE(scratch_size)) == -1) {
+			return -1;
+		}
+		scratch = arena_alloc(&ctx->scratch, scratch_size);
+
+		if(calc_nearest_buf(ctx->nearest, radius, &ctx->bmask, 0, scratch) == -1) {
+			ctx->nearest = 0;
+			return -1;
+		}
+		ctx->nearest_radius = radius;
+	}
+	return expand_nearest(img, img, ctx->nearest);
+}
+
+static int run_pullpush(struct texpand_ctx *ctx, struct img_pixmap *img)
+{
+	size_t size = pullpush_scratch_size(img->width, img->height);
+
+	if(arena_reset(&ctx->scratch, ARENA_SIZE(size)) == -1) {
+		return -1;
+	}
+	return expand_pullpush_buf(img, &ctx->bmask, arena_alloc(&ctx->scratch, size));
+}
+
+static int run_search(struct texpand_ctx *ctx, struct img_pixmap *img, int radius)
+{
+	if(!ctx->has_tiles) {
+		bitmask_tiles_init_buf(&ctx->tiles, &ctx->bmask, ctx->tile_state);
+		ctx->has_tiles = 1;
+	}
+	return expand_search_tiled(img, radius, img, &ctx->bmask, &ctx->tiles, 0);
+}
+
+/* grow the rendering context as needed, called with render_lock held */
+static int grow_render(int width, int height)
+{
+	int xsz, ysz;
+
+	if(width <= render_xsz && height <= render_ysz) {
+		return 0;
+	}
+	xsz = width > render_xsz ? width : render_xsz;
+	ysz = height > render_ysz ? height : render_ysz;
+
+	if(render_xsz) {
+		end_gen_mask();
+	}
+	render_xsz = render_ysz = 0;
+	if(begin_gen_mask(xsz, ysz) == -1) {
+		return -1;
+	}
+	render_thread = pthread_self();
+	render_xsz = xsz;
+	render_ysz = ysz;
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TEXPAND_H_
+#define TEXPAND_H_
+
+struct texpand_ctx;
+struct img_pixmap;
+struct uvscene;
+
+/* expansion algorithms, the same as -alg (and ALG_* in batch.h) */
+enum {
+	TEXPAND_EDT,
+	TEXPAND_SEARCH,
+	TEXPAND_PULLPUSH
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Library interface, for programs which expand textures many times over. A
+ * context holds the worker thread count, the current mask with everything
+ * derived from it (packed bitmask, tile index, and the nearest texel map of
+ * the last radius), and the scratch space of the expansion algorithms, all of
+ * it in arenas (see arena.h) which only grow. After the first expansion of
+ * the largest mask, texpand_set_mask and texpand_expand allocate nothing.
+ * Rasterizing masks with texpand_set_mask_scene still allocates the geometry
+ * and image buffers of the rasterizer on every call.
+ *
+ * num_threads is the number of OpenMP worker threads used by the calls on
+ * this context, or 0 for all available. The threads are started by
+ * texpand_create, and kept alive by the OpenMP runtime in between calls.
+ * Contexts may be used from different threads, but each by one at a time,
+ * except for rasterizing masks (see texpand_set_mask_scene).
+ */
+struct texpand_ctx *texpand_create(int num_threads);
+void texpand_destroy(struct texpand_ctx *ctx);
+
+/* set the mask of the following expansions from a GREY8 mask image, where
+ * texels at 255 are the used texels
+ */
+int texpand_set_mask(struct texpand_ctx *ctx, struct img_pixmap *mask);
+
+/* Rasterize the mask from the UV geometry of a scene (see load_scene and
+ * gen_mask in genmask.h). All contexts share one mask rendering context,
+ * which is grown as needed, and kept alive until the last texpand context is
+ * destroyed. Since an OpenGL context is bound to the thread which created it,
+ * only the thread which rasterized the first mask may rasterize masks, and
+ * calls from any other thread fail. The last texpand context should be
+ * destroyed on that thread too, or the rendering context is never released.
+ */
+int texpand_set_mask_scene(struct texpand_ctx *ctx, int width, int height, struct uvscene *scn,
+		int uvset, const char *filter);
+
+/* Expand img in place with the current mask, which must have the same
+ * dimensions, up to radius texels (<= 0 for unlimited).
+ */
+int texpand_expand(struct texpand_ctx *ctx, struct img_pixmap *img, int radius, int alg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* TEXPAND_H_ */
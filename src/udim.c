@@ -0,0 +1,344 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <imago2.h>
+#include "udim.h"
+#include "batch.h"
+#include "genmask.h"
+#include "expand.h"
+#include "bitmask.h"
+#include "pullpush.h"
+#include "stream.h"
+#include "stats.h"
+#include "rawimg.h"
+
+struct tile_job {
+	int udim;
+	int width, height;
+	struct bitmask bmask;
+	int ready;		/* has a texture, and its mask is done */
+	int failed;
+};
+
+static int make_masks(struct tile_job *jobs, struct udim_tile *tiles, int num_tiles,
+		const char *tex_fname);
+static int finish_mask(struct tile_job *job, struct img_pixmap *mask);
+static int expand_tile(struct tile_job *job, const char **tex_fnames, const char **out_fnames,
+		int num_tex, const struct batch_opt *opt);
+static int expand_img(struct img_pixmap *img, const struct bitmask *bmask, int **nearest,
+		const struct batch_opt *opt);
+static char *mask_filter(const char *tex_fname);
+
+int udim_run(const char **tex_fnames, const char **out_fnames, int num_tex,
+		const struct batch_opt *opt)
+{
+	int i, num_tiles, num_ready, num_failed = 0, levels;
+	struct uvscene *scn;
+	struct udim_tile *tiles;
+	struct tile_job *jobs;
+	char *filter = 0;
+
+	stats_begin("import", opt->scene_fname);
+	scn = load_scene(opt->scene_fname);
+	stats_end();
+	if(!scn) {
+		return -1;
+	}
+
+	if(!opt->force && !(filter = mask_filter(tex_fnames[0]))) {
+		free_scene(scn);
+		return -1;
+	}
+	stats_begin("bin", opt->scene_fname);
+	num_tiles = scene_udim_tiles(scn, opt->uvset, filter, &tiles);
+	stats_end();
+	free(filter);
+	/* the tiles have their own copy of the triangles */
+	free_scene(scn);
+
+	if(num_tiles <= 0) {
+		if(!num_tiles) {
+			fprintf(stderr, "no UDIM tiles found in %s\n", opt->scene_fname);
+		}
+		return -1;
+	}
+
+	if(!(jobs = calloc(num_tiles, sizeof *jobs))) {
+		fprintf(stderr, "udim: failed to allocate memory\n");
+		free_udim_tiles(tiles, num_tiles);
+		return -1;
+	}
+
+	num_ready = make_masks(jobs, tiles, num_tiles, tex_fnames[0]);
+	free_udim_tiles(tiles, num_tiles);
+	if(num_ready <= 0) {
+		if(!num_ready) {
+			fprintf(stderr, "no textures found for any of the %d UDIM tiles\n", num_tiles);
+		}
+		free(jobs);
+		return -1;
+	}
+
+	/* one tile per thread. A lone tile gets all the threads instead */
+	levels = omp_get_max_active_levels();
+	omp_set_max_active_levels(1);
+
+	stats_begin("expand_tiles", 0);
+#pragma omp parallel for schedule(dynamic) if(num_ready > 1)
+	for(i=0; i<num_tiles; i++) {
+		if(jobs[i].ready) {
+			jobs[i].failed = expand_tile(jobs + i, tex_fnames, out_fnames, num_tex, opt) == -1;
+		}
+	}
+	stats_end();
+	omp_set_max_active_levels(levels);
+
+	for(i=0; i<num_tiles; i++) {
+		if(jobs[i].ready) {
+			num_failed += jobs[i].failed;
+			bitmask_destroy(&jobs[i].bmask);
+		}
+	}
+	free(jobs);
+
+	if(!opt->silent) {
+		printf("%d of %d UDIM tiles expanded\n", num_ready - num_failed, num_ready);
+	}
+	return num_failed;
+}
+
+char *udim_fname(const char *fname, int udim)
+{
+	char *res;
+	const char *ptr;
+	int len;
+
+	if(!(ptr = strstr(fname, UDIM_TOKEN))) {
+		return 0;
+	}
+	len = ptr - fname;
+
+	if(!(res = malloc(strlen(fname) + 16))) {
+		return 0;
+	}
+	memcpy(res, fname, len);
+	sprintf(res + len, "%d%s", udim, ptr + strlen(UDIM_TOKEN));
+	return res;
+}
+
+/* Rasterize the mask of every tile with a texture, on the main thread, with a
+ * single rendering context as large as the largest tile. Returns the number
+ * of tiles ready to expand.
+ */
+static int make_masks(struct tile_job *jobs, struct udim_tile *tiles, int num_tiles,
+		const char *tex_fname)
+{
+	int i, prev = -1, cur = 0, num_ready = 0, max_xsz = 0, max_ysz = 0;
+	char *fname;
+	struct img_pixmap mask[2];
+
+	for(i=0; i<num_tiles; i++) {
+		jobs[i].udim = tiles[i].udim;
+
+		if(!(fname = udim_fname(tex_fname, tiles[i].udim))) {
+			fprintf(stderr, "udim: failed to allocate memory\n");
+			return -1;
+		}
+		if(image_size(fname, &jobs[i].width, &jobs[i].height) == -1) {
+			fprintf(stderr, "warning: no texture for UDIM %d (%s), skipped\n", tiles[i].udim, fname);
+			free(fname);
+			continue;
+		}
+		free(fname);
+
+		jobs[i].ready = 1;
+		if(jobs[i].width > max_xsz) max_xsz = jobs[i].width;
+		if(jobs[i].height > max_ysz) max_ysz = jobs[i].height;
+	}
+	if(!max_xsz) return 0;
+
+	if(begin_gen_mask(max_xsz, max_ysz) == -1) {
+		return -1;
+	}
+	img_init(mask);
+	img_init(mask + 1);
+
+	/* draw each mask before finishing the previous one, so that its readback
+	 * overlaps with the drawing
+	 */
+	for(i=0; i<num_tiles; i++) {
+		char name[16];
+
+		if(!jobs[i].ready) continue;
+
+		sprintf(name, "%d", jobs[i].udim);
+		stats_begin("rasterize", name);
+		if(gen_mask_tris_begin(mask + cur, jobs[i].width, jobs[i].height, tiles[i].uv,
+					tiles[i].num_tri) == -1) {
+			fprintf(stderr, "failed to generate the mask of UDIM %d\n", jobs[i].udim);
+			jobs[i].ready = 0;
+		}
+		stats_end();
+
+		if(prev >= 0) {
+			num_ready += finish_mask(jobs + prev, mask + (cur ^ 1));
+		}
+		if(jobs[i].ready) {
+			prev = i;
+			cur ^= 1;
+		} else {
+			prev = -1;
+		}
+	}
+	if(prev >= 0) {
+		num_ready += finish_mask(jobs + prev, mask + (cur ^ 1));
+	}
+
+	img_destroy(mask);
+	img_destroy(mask + 1);
+	end_gen_mask();
+	return num_ready;
+}
+
+/* wait for the mask of a tile, and pack it. Returns 1 if the tile is ready */
+static int finish_mask(struct tile_job *job, struct img_pixmap *mask)
+{
+	if(gen_mask_end(mask) == -1 || bitmask_from_img(&job->bmask, mask, EXPAND_MASK_THRES) == -1) {
+		fprintf(stderr, "failed to generate the mask of UDIM %d\n", job->udim);
+		job->ready = 0;
+		return 0;
+	}
+	return 1;
+}
+
+static int expand_tile(struct tile_job *job, const char **tex_fnames, const char **out_fnames,
+		int num_tex, const struct batch_opt *opt)
+{
+	int i, res = -1;
+	int *nearest = 0;
+	char *infname = 0, *outfname = 0;
+	struct img_pixmap img;
+
+	img_init(&img);
+
+	for(i=0; i<num_tex; i++) {
+		if(!(infname = udim_fname(tex_fnames[i], job->udim)) ||
+				!(outfname = udim_fname(out_fnames[i], job->udim))) {
+			fprintf(stderr, "udim: failed to allocate memory\n");
+			goto end;
+		}
+
+		if(load_image(&img, infname) == -1) {
+			fprintf(stderr, "failed to load image: %s\n", infname);
+			goto end;
+		}
+		if(img.width != job->width || img.height != job->height) {
+			fprintf(stderr, "texture %s is %dx%d, while the mask of UDIM %d is %dx%d\n",
+					infname, img.width, img.height, job->udim, job->width, job->height);
+			goto end;
+		}
+
+		if(expand_img(&img, &job->bmask, &nearest, opt) == -1) {
+			goto end;
+		}
+
+		if(save_image(&img, outfname) == -1) {
+			fprintf(stderr, "failed to write output file: %s\n", outfname);
+			goto end;
+		}
+		if(!opt->silent) {
+			printf("%s -> %s\n", infname, outfname);
+		}
+
+		free(infname);
+		free(outfname);
+		infname = outfname = 0;
+	}
+	res = 0;
+
+end:
+	free(infname);
+	free(outfname);
+	free(nearest);
+	img_destroy(&img);
+	return res;
+}
+
+/* the nearest texel map of the tile is computed for its first texture, and
+ * reused for the rest
+ */
+static int expand_img(struct img_pixmap *img, const struct bitmask *bmask, int **nearest,
+		const struct batch_opt *opt)
+{
+	int res;
+	struct bitmask_tiles tiles;
+
+	switch(opt->alg) {
+	case ALG_SEARCH:
+		if(bitmask_tiles_init(&tiles, bmask) == -1) {
+			return -1;
+		}
+		res = expand_search_tiled(img, opt->radius, img, bmask, &tiles, 0);
+		bitmask_tiles_destroy(&tiles);
+		return res;
+
+	case ALG_PULLPUSH:
+		return expand_pullpush(img, bmask);
+
+	default:
+		break;
+	}
+
+	if(!*nearest) {
+		if(!(*nearest = malloc(img->width * img->height * sizeof **nearest))) {
+			fprintf(stderr, "failed to allocate nearest texel map\n");
+			return -1;
+		}
+		if(calc_nearest(*nearest, opt->radius, bmask) == -1) {
+			free(*nearest);
+			*nearest = 0;
+			return -1;
+		}
+	}
+	return expand_nearest(img, img, *nearest);
+}
+
+/* materials are matched against the part of the texture name before the
+ * tile number, since they may reference either a single tile or the pattern
+ */
+static char *mask_filter(const char *tex_fname)
+{
+	char *res;
+	const char *base, *end;
+
+	base = (base = strrchr(tex_fname, '/')) ? base + 1 : tex_fname;
+	if(!(end = strstr(base, UDIM_TOKEN))) {
+		end = base + strlen(base);
+	}
+
+	if(!(res = malloc(end - base + 1))) {
+		fprintf(stderr, "udim: failed to allocate memory\n");
+		return 0;
+	}
+	memcpy(res, base, end - base);
+	res[end - base] = 0;
+	return res;
+}
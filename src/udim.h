@@ -0,0 +1,51 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef UDIM_H_
+#define UDIM_H_
+
+struct batch_opt;
+
+/* placeholder for the tile number in UDIM texture filenames */
+#define UDIM_TOKEN	"<UDIM>"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Expand a UDIM texture set: every texture and output filename contains
+ * UDIM_TOKEN, which stands for the tile number (color.<UDIM>.png ->
+ * color.1001.png, color.1002.png, ...). The scene is imported once, and its
+ * triangles binned by tile in a single pass (see scene_udim_tiles). Then the
+ * mask of every tile with a texture is rasterized from its bin, and the
+ * tiles are expanded in parallel, one tile per thread, with all the textures
+ * of a tile sharing its mask.
+ *
+ * Only the scene, uvset, radius, alg, force, and silent options apply.
+ * Returns the number of failed tiles, or -1 if none could be processed.
+ */
+int udim_run(const char **tex_fnames, const char **out_fnames, int num_tex,
+		const struct batch_opt *opt);
+
+/* replace UDIM_TOKEN in fname with the tile number. Returns a new string */
+char *udim_fname(const char *fname, int udim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* UDIM_H_ */
@@ -0,0 +1,533 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <assimp/mesh.h>
+#include <assimp/material.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+#include "uvscene.h"
+#include "hash.h"
+
+#define PPFLAGS	(aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenUVCoords | \
+		aiProcess_TransformUVCoords | aiProcess_FlipUVs)
+
+#define CACHE_MAGIC		"TXUVSCN"
+#define CACHE_VERSION	1
+#define BYTE_ORDER_MARK	0x01020304
+
+/* Layout of the flat scene block. Everything past the header is addressed by
+ * byte offsets from the start of the block, 8-byte aligned. Strings are nul
+ * terminated.
+ */
+struct block_header {
+	char magic[8];
+	uint32_t version, byte_order;
+	uint64_t key;			/* hash of the scene file and the import settings */
+	uint64_t size;
+	uint32_t num_meshes, num_mtl;
+	uint64_t meshes, mtl;	/* offsets of the mesh and material tables */
+};
+
+struct block_mesh {
+	uint64_t name;
+	uint32_t mtl, num_tri;
+	uint64_t uv[UV_MAX_SETS];	/* 0 for the missing UV sets */
+};
+
+struct block_mtl {
+	uint32_t num_tex, pad;
+	uint64_t tex;			/* offset of num_tex string offsets */
+};
+
+/* growable block, while importing */
+struct block {
+	char *data;
+	size_t size, max_size;
+};
+
+#define BLOCK_PTR(b, offs, type)	((type*)((b)->data + (offs)))
+
+static int import_scene(struct block *blk, const char *fname, uint64_t key);
+static int import_mesh(struct block *blk, uint64_t offs, const struct aiMesh *aimesh);
+static int import_material(struct block *blk, uint64_t offs, const struct aiMaterial *aimtl);
+static int block_alloc(struct block *blk, size_t size, uint64_t *offs);
+static int block_str(struct block *blk, const char *str, uint64_t *offs);
+static struct uvscene *attach(void *data, size_t size, uint64_t key, int mapped);
+static int check_range(size_t size, uint64_t offs, uint64_t count, size_t elemsz);
+static int check_str(const char *data, size_t size, uint64_t offs);
+static int file_key(const char *fname, uint64_t *key);
+static char *cache_path(const char *cachedir, uint64_t key);
+static struct uvscene *read_cache(const char *path, uint64_t key);
+static void write_cache(const char *path, const char *cachedir, const struct block *blk);
+
+static const enum aiTextureType types[] = {
+	aiTextureType_NONE,
+	aiTextureType_DIFFUSE,
+	aiTextureType_SPECULAR,
+	aiTextureType_AMBIENT,
+	aiTextureType_EMISSIVE,
+	aiTextureType_HEIGHT,
+	aiTextureType_NORMALS,
+	aiTextureType_SHININESS,
+	aiTextureType_OPACITY,
+	aiTextureType_DISPLACEMENT,
+	aiTextureType_LIGHTMAP,
+	aiTextureType_REFLECTION,
+	aiTextureType_UNKNOWN
+};
+
+struct uvscene *uvscene_load(const char *fname, const char *cachedir)
+{
+	uint64_t key = 0;
+	char *path = 0;
+	struct block blk = {0, 0, 0};
+	struct uvscene *scn;
+
+	if(cachedir) {
+		if(file_key(fname, &key) == -1) {
+			fprintf(stderr, "failed to load scene file: %s\n", fname);
+			return 0;
+		}
+		if(!(path = cache_path(cachedir, key))) {
+			return 0;
+		}
+		if((scn = read_cache(path, key))) {
+			free(path);
+			return scn;
+		}
+	}
+
+	if(import_scene(&blk, fname, key) == -1) {
+		free(blk.data);
+		free(path);
+		return 0;
+	}
+	if(path) {
+		write_cache(path, cachedir, &blk);
+		free(path);
+	}
+
+	if(!(scn = attach(blk.data, blk.size, key, 0))) {
+		fprintf(stderr, "failed to load scene file: %s\n", fname);
+		free(blk.data);
+	}
+	return scn;
+}
+
+void uvscene_free(struct uvscene *scn)
+{
+	if(!scn) return;
+
+	free(scn->mtl);
+	free(scn->meshes);
+#ifdef USE_MMAP
+	if(scn->mapped) {
+		munmap(scn->data, scn->data_size);
+	} else
+#endif
+	free(scn->data);
+	free(scn);
+}
+
+static int import_scene(struct block *blk, const char *fname, uint64_t key)
+{
+	int i, res = -1;
+	uint64_t offs, meshes, mtl;
+	const struct aiScene *aiscn;
+	struct block_header *hdr;
+
+	if(!(aiscn = aiImportFile(fname, PPFLAGS))) {
+		fprintf(stderr, "failed to load scene file: %s\n", fname);
+		return -1;
+	}
+
+	if(block_alloc(blk, sizeof *hdr, &offs) == -1 ||
+			block_alloc(blk, aiscn->mNumMeshes * sizeof(struct block_mesh), &meshes) == -1 ||
+			block_alloc(blk, aiscn->mNumMaterials * sizeof(struct block_mtl), &mtl) == -1) {
+		goto end;
+	}
+
+	for(i=0; i<(int)aiscn->mNumMeshes; i++) {
+		if(import_mesh(blk, meshes + i * sizeof(struct block_mesh), aiscn->mMeshes[i]) == -1) {
+			goto end;
+		}
+	}
+	for(i=0; i<(int)aiscn->mNumMaterials; i++) {
+		if(import_material(blk, mtl + i * sizeof(struct block_mtl), aiscn->mMaterials[i]) == -1) {
+			goto end;
+		}
+	}
+
+	hdr = BLOCK_PTR(blk, 0, struct block_header);
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof hdr->magic);
+	hdr->version = CACHE_VERSION;
+	hdr->byte_order = BYTE_ORDER_MARK;
+	hdr->key = key;
+	hdr->size = blk->size;
+	hdr->num_meshes = aiscn->mNumMeshes;
+	hdr->num_mtl = aiscn->mNumMaterials;
+	hdr->meshes = meshes;
+	hdr->mtl = mtl;
+	res = 0;
+
+end:
+	if(res == -1) {
+		fprintf(stderr, "failed to allocate memory for scene: %s\n", fname);
+	}
+	aiReleaseImport(aiscn);
+	return res;
+}
+
+/* only the triangles are kept. Point and line meshes end up with none */
+static int import_mesh(struct block *blk, uint64_t offs, const struct aiMesh *aimesh)
+{
+	int i, j, k, num_tri = 0;
+	uint64_t name, uv;
+	float *dest;
+	struct block_mesh *mesh;
+
+	for(i=0; i<(int)aimesh->mNumFaces; i++) {
+		if(aimesh->mFaces[i].mNumIndices == 3) {
+			num_tri++;
+		}
+	}
+
+	if(block_str(blk, aimesh->mName.data, &name) == -1) {
+		return -1;
+	}
+	mesh = BLOCK_PTR(blk, offs, struct block_mesh);
+	mesh->name = name;
+	mesh->mtl = aimesh->mMaterialIndex;
+	mesh->num_tri = num_tri;
+
+	for(i=0; i<UV_MAX_SETS && i<AI_MAX_NUMBER_OF_TEXTURECOORDS; i++) {
+		const struct aiVector3D *aiuv = aimesh->mTextureCoords[i];
+		if(!aiuv) continue;
+
+		if(block_alloc(blk, num_tri * 6 * sizeof *dest, &uv) == -1) {
+			return -1;
+		}
+		BLOCK_PTR(blk, offs, struct block_mesh)->uv[i] = uv;
+
+		dest = BLOCK_PTR(blk, uv, float);
+		for(j=0; j<(int)aimesh->mNumFaces; j++) {
+			const struct aiFace *face = aimesh->mFaces + j;
+			if(face->mNumIndices != 3) continue;
+
+			for(k=0; k<3; k++) {
+				*dest++ = aiuv[face->mIndices[k]].x;
+				*dest++ = aiuv[face->mIndices[k]].y;
+			}
+		}
+	}
+	return 0;
+}
+
+static int import_material(struct block *blk, uint64_t offs, const struct aiMaterial *aimtl)
+{
+	int i, j, num_tex = 0;
+	uint64_t tex, str;
+	struct aiString name;
+
+	for(i=0; i<(int)(sizeof types / sizeof *types); i++) {
+		for(j=0; aiGetMaterialString(aimtl, AI_MATKEY_TEXTURE(types[i], j), &name) == AI_SUCCESS; j++) {
+			num_tex++;
+		}
+	}
+
+	if(block_alloc(blk, num_tex * sizeof(uint64_t), &tex) == -1) {
+		return -1;
+	}
+	BLOCK_PTR(blk, offs, struct block_mtl)->num_tex = num_tex;
+	BLOCK_PTR(blk, offs, struct block_mtl)->tex = tex;
+
+	num_tex = 0;
+	for(i=0; i<(int)(sizeof types / sizeof *types); i++) {
+		for(j=0; aiGetMaterialString(aimtl, AI_MATKEY_TEXTURE(types[i], j), &name) == AI_SUCCESS; j++) {
+			if(block_str(blk, name.data, &str) == -1) {
+				return -1;
+			}
+			BLOCK_PTR(blk, tex, uint64_t)[num_tex++] = str;
+		}
+	}
+	return 0;
+}
+
+/* zero-filled and 8-byte aligned. Returns the offset in *offs, because the
+ * block may move
+ */
+static int block_alloc(struct block *blk, size_t size, uint64_t *offs)
+{
+	size_t start = (blk->size + 7) & ~(size_t)7;
+
+	if(start + size > blk->max_size) {
+		size_t newsz = blk->max_size ? blk->max_size : 65536;
+		void *tmp;
+
+		while(newsz < start + size) newsz *= 2;
+		if(!(tmp = realloc(blk->data, newsz))) {
+			return -1;
+		}
+		blk->data = tmp;
+		blk->max_size = newsz;
+	}
+	memset(blk->data + blk->size, 0, start + size - blk->size);
+	blk->size = start + size;
+	*offs = start;
+	return 0;
+}
+
+static int block_str(struct block *blk, const char *str, uint64_t *offs)
+{
+	size_t len = strlen(str) + 1;
+
+	if(block_alloc(blk, len, offs) == -1) {
+		return -1;
+	}
+	memcpy(blk->data + *offs, str, len);
+	return 0;
+}
+
+/* Make a scene out of a flat block, pointing into it. The block may come from
+ * a corrupt or truncated cache file, so every offset is checked. Returns null
+ * if it doesn't check out.
+ */
+static struct uvscene *attach(void *data, size_t size, uint64_t key, int mapped)
+{
+	int i, j, num_tex = 0;
+	const char *base = data;
+	const struct block_header *hdr = data;
+	const struct block_mesh *bmesh;
+	const struct block_mtl *bmtl;
+	const char **texptr;
+	struct uvscene *scn;
+
+	if(size < sizeof *hdr || memcmp(hdr->magic, CACHE_MAGIC, sizeof hdr->magic) != 0 ||
+			hdr->version != CACHE_VERSION || hdr->byte_order != BYTE_ORDER_MARK ||
+			hdr->key != key || hdr->size != size ||
+			check_range(size, hdr->meshes, hdr->num_meshes, sizeof *bmesh) == -1 ||
+			check_range(size, hdr->mtl, hdr->num_mtl, sizeof *bmtl) == -1) {
+		return 0;
+	}
+	bmesh = (const struct block_mesh*)(base + hdr->meshes);
+	bmtl = (const struct block_mtl*)(base + hdr->mtl);
+
+	for(i=0; i<(int)hdr->num_mtl; i++) {
+		if(check_range(size, bmtl[i].tex, bmtl[i].num_tex, sizeof(uint64_t)) == -1) {
+			return 0;
+		}
+		num_tex += bmtl[i].num_tex;
+	}
+
+	if(!(scn = calloc(1, sizeof *scn))) {
+		return 0;
+	}
+	/* the texture name arrays are allocated along with the materials */
+	if(!(scn->meshes = malloc(hdr->num_meshes * sizeof *scn->meshes + 1)) ||
+			!(scn->mtl = malloc(hdr->num_mtl * sizeof *scn->mtl + num_tex * sizeof *texptr + 1))) {
+		goto fail;
+	}
+	texptr = (const char**)(scn->mtl + hdr->num_mtl);
+	scn->num_meshes = hdr->num_meshes;
+	scn->num_mtl = hdr->num_mtl;
+
+	for(i=0; i<scn->num_meshes; i++) {
+		struct uvmesh *mesh = scn->meshes + i;
+
+		if(check_str(base, size, bmesh[i].name) == -1 || bmesh[i].mtl >= hdr->num_mtl) {
+			goto fail;
+		}
+		mesh->name = base + bmesh[i].name;
+		mesh->mtl = bmesh[i].mtl;
+		mesh->num_tri = bmesh[i].num_tri;
+
+		for(j=0; j<UV_MAX_SETS; j++) {
+			mesh->uv[j] = 0;
+			if(!bmesh[i].uv[j]) continue;
+			if(check_range(size, bmesh[i].uv[j], bmesh[i].num_tri, 6 * sizeof(float)) == -1) {
+				goto fail;
+			}
+			mesh->uv[j] = (const float*)(base + bmesh[i].uv[j]);
+		}
+	}
+
+	for(i=0; i<scn->num_mtl; i++) {
+		const uint64_t *tex = (const uint64_t*)(base + bmtl[i].tex);
+
+		scn->mtl[i].num_tex = bmtl[i].num_tex;
+		scn->mtl[i].tex = texptr;
+		for(j=0; j<(int)bmtl[i].num_tex; j++) {
+			if(check_str(base, size, tex[j]) == -1) {
+				goto fail;
+			}
+			*texptr++ = base + tex[j];
+		}
+	}
+
+	scn->data = data;
+	scn->data_size = size;
+	scn->mapped = mapped;
+	return scn;
+
+fail:
+	free(scn->mtl);
+	free(scn->meshes);
+	free(scn);
+	return 0;
+}
+
+static int check_range(size_t size, uint64_t offs, uint64_t count, size_t elemsz)
+{
+	if(offs > size || count > (size - offs) / elemsz) {
+		return -1;
+	}
+	return 0;
+}
+
+static int check_str(const char *data, size_t size, uint64_t offs)
+{
+	if(offs >= size || !memchr(data + offs, 0, size - offs)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* the cache key: the scene file contents, the import flags, and the cache
+ * format version
+ */
+static int file_key(const char *fname, uint64_t *key)
+{
+	uint64_t hash = HASH_INIT;
+	uint32_t settings[2] = {PPFLAGS, CACHE_VERSION};
+
+	if(hash_file(&hash, fname) == -1) {
+		return -1;
+	}
+	*key = hash_bytes(hash, settings, sizeof settings);
+	return 0;
+}
+
+static char *cache_path(const char *cachedir, uint64_t key)
+{
+	char *path;
+
+	if(!(path = malloc(strlen(cachedir) + 32))) {
+		fprintf(stderr, "failed to allocate scene cache path\n");
+		return 0;
+	}
+	sprintf(path, "%s/%08lx%08lx.uvs", cachedir, (unsigned long)(key >> 32),
+			(unsigned long)(key & 0xffffffff));
+	return path;
+}
+
+static struct uvscene *read_cache(const char *path, uint64_t key)
+{
+	struct uvscene *scn;
+#ifdef USE_MMAP
+	int fd;
+	struct stat st;
+	void *data;
+
+	if((fd = open(path, O_RDONLY)) == -1) {
+		return 0;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+	data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return 0;
+	}
+	if(!(scn = attach(data, st.st_size, key, 1))) {
+		munmap(data, st.st_size);
+	}
+#else
+	FILE *fp;
+	long size;
+	void *data;
+
+	if(!(fp = fopen(path, "rb"))) {
+		return 0;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if(size <= 0 || !(data = malloc(size))) {
+		fclose(fp);
+		return 0;
+	}
+	if(fread(data, 1, size, fp) != (size_t)size || !(scn = attach(data, size, key, 0))) {
+		free(data);
+		scn = 0;
+	}
+	fclose(fp);
+#endif
+	return scn;
+}
+
+/* write to a temporary file first, so that concurrent runs never see a
+ * partially written cache file. Failing to write it is not fatal
+ */
+static void write_cache(const char *path, const char *cachedir, const struct block *blk)
+{
+	char *tmppath;
+	FILE *fp;
+	int pid = 0;
+
+#ifdef USE_MMAP
+	mkdir(cachedir, 0777);
+	pid = getpid();
+#endif
+	if(!(tmppath = malloc(strlen(path) + 32))) {
+		return;
+	}
+	sprintf(tmppath, "%s.%d.tmp", path, pid);
+
+	if(!(fp = fopen(tmppath, "wb"))) {
+		fprintf(stderr, "warning: failed to write scene cache file: %s\n", tmppath);
+		free(tmppath);
+		return;
+	}
+	if(fwrite(blk->data, 1, blk->size, fp) != blk->size) {
+		fprintf(stderr, "warning: failed to write scene cache file: %s\n", tmppath);
+		fclose(fp);
+		remove(tmppath);
+		free(tmppath);
+		return;
+	}
+	fclose(fp);
+
+	if(rename(tmppath, path) == -1) {
+		remove(tmppath);
+	}
+	free(tmppath);
+}
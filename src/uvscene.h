@@ -0,0 +1,72 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef UVSCENE_H_
+#define UVSCENE_H_
+
+#include <stddef.h>
+
+#define UV_MAX_SETS		8
+
+/* UV triangles of a mesh, as flat arrays of 3 u,v pairs per triangle */
+struct uvmesh {
+	const char *name;
+	int mtl;						/* material index */
+	int num_tri;
+	const float *uv[UV_MAX_SETS];	/* null for the missing UV sets */
+};
+
+/* texture filenames referenced by a material */
+struct uvmaterial {
+	int num_tex;
+	const char **tex;
+};
+
+/* Everything mask generation needs from a scene file: the UV triangles of
+ * every mesh, and the texture names of every material. All the names and
+ * triangles live in a single flat block, which is also the on-disk format of
+ * the scene cache, so that cached scenes are used straight from the mapped
+ * file.
+ */
+struct uvscene {
+	int num_meshes;
+	struct uvmesh *meshes;
+	int num_mtl;
+	struct uvmaterial *mtl;
+
+	void *data;
+	size_t data_size;
+	int mapped;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Import a scene file through assimp. If cachedir is not null, the scene is
+ * first looked up in the cache directory, by a hash of the file contents and
+ * the import settings. If it's not there, it's imported, and written to the
+ * cache for next time.
+ */
+struct uvscene *uvscene_load(const char *fname, const char *cachedir);
+void uvscene_free(struct uvscene *scn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* UVSCENE_H_ */
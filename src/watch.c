@@ -0,0 +1,189 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include "watch.h"
+
+#ifdef __linux__
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define SETTLE_MSEC		250
+
+struct watch {
+	int wd;
+	char *name;
+};
+
+static int ifd = -1;
+static struct watch *watches;
+static int num_watches, max_watches;
+
+int watch_init(void)
+{
+	if((ifd = inotify_init1(IN_CLOEXEC)) == -1) {
+		perror("watch_init: failed to initialize inotify");
+		return -1;
+	}
+	return 0;
+}
+
+void watch_cleanup(void)
+{
+	int i;
+
+	for(i=0; i<num_watches; i++) {
+		free(watches[i].name);
+	}
+	free(watches);
+	watches = 0;
+	num_watches = max_watches = 0;
+
+	if(ifd != -1) {
+		close(ifd);
+		ifd = -1;
+	}
+}
+
+int watch_file(const char *fname)
+{
+	int wd;
+	char *dir, *name, *ptr;
+
+	if(!(dir = malloc(strlen(fname) + 2))) {
+		perror("watch_file");
+		return -1;
+	}
+	if((ptr = strrchr(fname, '/'))) {
+		memcpy(dir, fname, ptr - fname);
+		dir[ptr - fname] = 0;
+		if(!*dir) strcpy(dir, "/");
+		ptr++;
+	} else {
+		strcpy(dir, ".");
+		ptr = (char*)fname;
+	}
+
+	/* watching the same directory again just returns the same descriptor */
+	if((wd = inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) == -1) {
+		fprintf(stderr, "failed to watch %s: %s\n", dir, strerror(errno));
+		free(dir);
+		return -1;
+	}
+	free(dir);
+
+	if(num_watches >= max_watches) {
+		int newmax = max_watches ? max_watches * 2 : 8;
+		struct watch *tmp = realloc(watches, newmax * sizeof *watches);
+		if(!tmp) {
+			perror("watch_file");
+			return -1;
+		}
+		watches = tmp;
+		max_watches = newmax;
+	}
+	if(!(name = malloc(strlen(ptr) + 1))) {
+		perror("watch_file");
+		return -1;
+	}
+	strcpy(name, ptr);
+
+	watches[num_watches].wd = wd;
+	watches[num_watches].name = name;
+	return num_watches++;
+}
+
+int watch_wait(int *ids, int max)
+{
+	int i, count = 0, timeout = -1;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+
+	pfd.fd = ifd;
+	pfd.events = POLLIN;
+
+	/* block for the first change, then keep draining events until the
+	 * application writing the files is done
+	 */
+	for(;;) {
+		char *ptr;
+		ssize_t len;
+		int res = poll(&pfd, 1, timeout);
+
+		if(res == -1) {
+			if(errno == EINTR) continue;
+			perror("watch_wait: poll failed");
+			return -1;
+		}
+		if(!res) break;
+
+		if((len = read(ifd, buf, sizeof buf)) == -1) {
+			if(errno == EINTR || errno == EAGAIN) continue;
+			perror("watch_wait: failed to read inotify events");
+			return -1;
+		}
+
+		for(ptr=buf; ptr<buf+len; ptr+=sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len) {
+			struct inotify_event *ev = (struct inotify_event*)ptr;
+			if(!ev->len) continue;
+
+			for(i=0; i<num_watches; i++) {
+				int j;
+				if(watches[i].wd != ev->wd || strcmp(watches[i].name, ev->name) != 0) {
+					continue;
+				}
+				for(j=0; j<count; j++) {
+					if(ids[j] == i) break;
+				}
+				if(j == count && count < max) {
+					ids[count++] = i;
+				}
+			}
+		}
+
+		if(count) timeout = SETTLE_MSEC;
+	}
+	return count;
+}
+
+#else	/* !__linux__ */
+
+int watch_init(void)
+{
+	fprintf(stderr, "watching files for changes is not supported on this platform\n");
+	return -1;
+}
+
+void watch_cleanup(void)
+{
+}
+
+int watch_file(const char *fname)
+{
+	return -1;
+}
+
+int watch_wait(int *ids, int max)
+{
+	return -1;
+}
+
+#endif	/* __linux__ */
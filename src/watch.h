@@ -0,0 +1,47 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* File change notification (currently only implemented with inotify on
+ * GNU/Linux). Files are watched through their directory, so that they are
+ * still picked up when an application saves them by writing a new file and
+ * renaming it over the old one.
+ */
+int watch_init(void);
+void watch_cleanup(void);
+
+/* returns the id of the new watch (0, 1, 2 ...) or -1 on failure */
+int watch_file(const char *fname);
+
+/* Block until at least one of the watched files is written, and keep
+ * collecting changes until they stop arriving for a short while. Writes the
+ * ids of up to max changed files in ids, and returns their number, or -1 on
+ * failure.
+ */
+int watch_wait(int *ids, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* WATCH_H_ */
@@ -0,0 +1,119 @@
+/*
+texpand - Texture pre-processing tool for expanding texels, to avoid filtering artifacts.
+Copyright (C) 2016-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/* Checks of the UDIM tile binning: the triangles of a scene, with V flipped as
+ * on import, have to land in the right tiles, translated back into the unit
+ * square. Exits with a non-zero status on failure.
+ */
+#include <stdio.h>
+#include <math.h>
+#include "uvscene.h"
+#include "genmask.h"
+
+/* a triangle in unflipped UV space, and where it's expected to end up */
+struct tri_check {
+	float uv[6];
+	int udim[2];		/* tiles it should land in, 0 for none */
+};
+
+static struct tri_check checks[] = {
+	/* row 0 */
+	{{0.2f, 0.2f, 0.4f, 0.2f, 0.2f, 0.4f}, {1001, 0}},
+	/* row 1 */
+	{{0.2f, 1.2f, 0.4f, 1.2f, 0.2f, 1.4f}, {1011, 0}},
+	/* column 3, row 2 */
+	{{3.5f, 2.5f, 3.7f, 2.5f, 3.5f, 2.7f}, {1024, 0}},
+	/* across the border of rows 0 and 1 */
+	{{5.2f, 0.9f, 5.4f, 0.9f, 5.2f, 1.1f}, {1006, 1016}},
+	/* ending exactly on the border of rows 1 and 2 */
+	{{7.2f, 1.5f, 7.4f, 1.5f, 7.2f, 2.0f}, {1018, 0}}
+};
+#define NUM_CHECKS	(int)(sizeof checks / sizeof *checks)
+
+static int check_tile(const struct udim_tile *tiles, int num_tiles, const struct tri_check *c);
+
+int main(void)
+{
+	int i, j, num_tiles, num_expected = 0, fail = 0;
+	float uv[NUM_CHECKS * 6];
+	struct uvmesh mesh = {0};
+	struct uvscene scn = {0};
+	struct udim_tile *tiles;
+
+	/* V is flipped on import */
+	for(i=0; i<NUM_CHECKS; i++) {
+		for(j=0; j<3; j++) {
+			uv[i * 6 + j * 2] = checks[i].uv[j * 2];
+			uv[i * 6 + j * 2 + 1] = 1.0f - checks[i].uv[j * 2 + 1];
+		}
+		num_expected += checks[i].udim[1] ? 2 : 1;
+	}
+	mesh.name = "test";
+	mesh.num_tri = NUM_CHECKS;
+	mesh.uv[0] = uv;
+	scn.num_meshes = 1;
+	scn.meshes = &mesh;
+
+	if((num_tiles = scene_udim_tiles(&scn, 0, 0, &tiles)) == -1) {
+		fprintf(stderr, "scene_udim_tiles failed\n");
+		return 1;
+	}
+	if(num_tiles != num_expected) {
+		fprintf(stderr, "expected %d tiles, got %d\n", num_expected, num_tiles);
+		fail = 1;
+	}
+	for(i=0; i<NUM_CHECKS; i++) {
+		if(check_tile(tiles, num_tiles, checks + i) == -1) {
+			fail = 1;
+		}
+	}
+	free_udim_tiles(tiles, num_tiles);
+
+	printf("udim: %s\n", fail ? "FAILED" : "ok");
+	return fail;
+}
+
+/* each tile of a check has its one triangle, with the unflipped V of the
+ * triangle, relative to the tile, flipped back
+ */
+static int check_tile(const struct udim_tile *tiles, int num_tiles, const struct tri_check *c)
+{
+	int i, j, k;
+	float tu, tv;
+
+	for(i=0; i<2 && c->udim[i]; i++) {
+		for(j=0; j<num_tiles; j++) {
+			if(tiles[j].udim == c->udim[i]) break;
+		}
+		if(j >= num_tiles || tiles[j].num_tri != 1) {
+			fprintf(stderr, "tile %d: missing, or not a single triangle\n", c->udim[i]);
+			return -1;
+		}
+
+		tu = (float)((c->udim[i] - 1001) % 10);
+		tv = (float)((c->udim[i] - 1001) / 10);
+		for(k=0; k<3; k++) {
+			if(fabs(tiles[j].uv[k * 2] - (c->uv[k * 2] - tu)) > 1e-5 ||
+					fabs(tiles[j].uv[k * 2 + 1] - (1.0f - (c->uv[k * 2 + 1] - tv))) > 1e-5) {
+				fprintf(stderr, "tile %d: vertex %d at %g,%g\n", c->udim[i], k,
+						tiles[j].uv[k * 2], tiles[j].uv[k * 2 + 1]);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}